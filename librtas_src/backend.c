@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Selection of the layer librtas talks to: the kernel and firmware by
+// default, or the simulated firmware in sim.c.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "internal.h"
+#include "librtas.h"
+
+static int native_check_caller(void)
+{
+	return geteuid() == (uid_t)0 ? 0 : RTAS_PERM;
+}
+
+static int native_chardev_exists(const char *path)
+{
+	struct stat statbuf;
+
+	if (stat(path, &statbuf))
+		return false;
+
+	if (!S_ISCHR(statbuf.st_mode))
+		return false;
+
+	if (close(open(path, O_RDONLY)))
+		return false;
+
+	return true;
+}
+
+static int native_chardev_open(const char *path, int flags)
+{
+	return open(path, flags);
+}
+
+static int native_chardev_ioctl(int fd, unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+static const struct rtas_backend native_backend = {
+	.name = "native",
+	.check_caller = native_check_caller,
+	.interface_exists = native_interface_exists,
+	.syscall = native_rtas_syscall,
+	.read_token = native_read_token,
+	.rmo_bounds = native_rmo_bounds,
+	.rmo_map = native_rmo_map,
+	.rmo_unmap = native_rmo_unmap,
+	.rmo_private = 0,
+	.chardev_exists = native_chardev_exists,
+	.chardev_open = native_chardev_open,
+	.chardev_ioctl = native_chardev_ioctl,
+};
+
+static const struct rtas_backend *current_backend = &native_backend;
+static unsigned int current_generation = 1;
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * backend_get
+ * @brief Backend for the next kernel or firmware access
+ *
+ * @return current backend
+ */
+__attribute__((visibility("hidden")))
+const struct rtas_backend *backend_get(void)
+{
+	return __atomic_load_n(&current_backend, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * backend_generation
+ * @brief Number that changes whenever the backend does
+ *
+ * Lets callers that pick an implementation once (e.g. chardev or
+ * system call) notice that they have to pick again.
+ *
+ * @return current generation, 1 until the first switch
+ */
+__attribute__((visibility("hidden")))
+unsigned int backend_generation(void)
+{
+	return __atomic_load_n(&current_generation, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * backend_set
+ * @brief Switch to another backend
+ *
+ * The RMO region, cached tokens and the kernel interface probe are
+ * dropped, since they came from the previous backend. No other thread
+ * may be using librtas meanwhile.
+ *
+ * @param be new backend, or NULL for the kernel and firmware
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Work areas of the previous backend are in use
+ */
+__attribute__((visibility("hidden")))
+int backend_set(const struct rtas_backend *be)
+{
+	int rc;
+
+	pthread_mutex_lock(&backend_lock);
+
+	rc = rmo_reset();
+	if (rc)
+		goto out;
+
+	__atomic_store_n(&current_backend, be ? be : &native_backend,
+			 __ATOMIC_RELEASE);
+	__atomic_add_fetch(&current_generation, 1, __ATOMIC_ACQ_REL);
+
+	token_cache_invalidate();
+	interface_invalidate();
+
+out:
+	pthread_mutex_unlock(&backend_lock);
+	return rc;
+}
@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Cache of the results of slow-changing queries. Each cacheable call
+// has a time to live, zero (not cached) until set by the application.
+// Results are keyed on the call and its inputs and are dropped early
+// by the events that can change them: DLPAR, node updates, migration,
+// EEH option changes and the matching set calls.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "librtas.h"
+#include "probes.h"
+
+#define CACHE_BUCKETS 64
+#define CACHE_MAX_ENTRIES 1024
+
+struct cache_policy {
+	const char *name;
+	int sysparm;		/* cached by rtas_get_sysparm() */
+	unsigned int ttl_ms;
+};
+
+struct cache_entry {
+	struct cache_entry *next;
+	const char *name;
+	uint64_t expires;
+	size_t keylen;
+	size_t vallen;
+	unsigned char data[];	/* key, then value */
+};
+
+/*
+ * Calls whose results are returned in full in their output words, and
+ * ibm,get-system-parameter which is cached above the call.
+ */
+static struct cache_policy policies[] = {
+	{ .name = "get-power-level" },
+	{ .name = "get-sensor-state" },
+	{ .name = "ibm,get-config-addr-info2" },
+	{ .name = "ibm,get-system-parameter", .sysparm = 1 },
+	{ .name = "ibm,read-slot-reset-state" },
+};
+
+#define NPOLICIES (sizeof(policies) / sizeof(policies[0]))
+
+/* Policies with a time to live, so most calls skip the lookup */
+static unsigned int npolicies_enabled;
+
+/* cache_lock protects the entries and the generation */
+static struct cache_entry *cache[CACHE_BUCKETS];
+static unsigned int nentries;
+static uint64_t cache_generation = 1;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int policy_ttl(const char *name, int sysparm)
+{
+	size_t i;
+
+	if (!__atomic_load_n(&npolicies_enabled, __ATOMIC_RELAXED))
+		return 0;
+
+	for (i = 0; i < NPOLICIES; i++) {
+		if (policies[i].sysparm == sysparm &&
+		    !strcmp(policies[i].name, name))
+			return __atomic_load_n(&policies[i].ttl_ms,
+					       __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+/**
+ * call_cache_ttl
+ * @brief Time to live of the results of a call made through rtas_call()
+ *
+ * @param name call name
+ * @return milliseconds, 0 if results are not cached
+ */
+__attribute__((visibility("hidden")))
+unsigned int call_cache_ttl(const char *name)
+{
+	return policy_ttl(name, 0);
+}
+
+/**
+ * sysparm_cache_ttl
+ * @brief Time to live of system parameters read by rtas_get_sysparm()
+ *
+ * @return milliseconds, 0 if parameters are not cached
+ */
+__attribute__((visibility("hidden")))
+unsigned int sysparm_cache_ttl(void)
+{
+	return policy_ttl("ibm,get-system-parameter", 1);
+}
+
+static unsigned int cache_hash(const char *name, const void *key,
+			       size_t keylen)
+{
+	const unsigned char *p = key;
+	unsigned int h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	while (keylen--)
+		h = h * 33 + *p++;
+
+	return h % CACHE_BUCKETS;
+}
+
+static void cache_unlink(struct cache_entry **pp)
+{
+	struct cache_entry *entry = *pp;
+
+	*pp = entry->next;
+	free(entry);
+	nentries--;
+}
+
+/**
+ * result_cache_generation
+ * @brief Generation to pass to result_cache_store()
+ *
+ * Read before making the call whose result is stored, so a result
+ * that raced with an invalidation is not cached.
+ *
+ * @return current generation
+ */
+__attribute__((visibility("hidden")))
+uint64_t result_cache_generation(void)
+{
+	return __atomic_load_n(&cache_generation, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * result_cache_lookup
+ * @brief Copy out a live cached result
+ *
+ * @param name call name
+ * @param key inputs of the call
+ * @param keylen
+ * @param val buffer for the result
+ * @param vallen size of the result
+ * @return 1 on a hit, 0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int result_cache_lookup(const char *name, const void *key, size_t keylen,
+			void *val, size_t vallen)
+{
+	unsigned int bucket = cache_hash(name, key, keylen);
+	uint64_t now = stats_now();
+	struct cache_entry **pp, *entry;
+	int hit = 0;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for (pp = &cache[bucket]; (entry = *pp) != NULL; pp = &entry->next) {
+		if (entry->keylen != keylen || entry->vallen != vallen ||
+		    strcmp(entry->name, name) ||
+		    memcmp(entry->data, key, keylen))
+			continue;
+
+		if (entry->expires <= now) {
+			cache_unlink(pp);
+			break;
+		}
+
+		memcpy(val, entry->data + keylen, vallen);
+		hit = 1;
+		break;
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	PROBE2(cache__lookup, name, hit);
+	return hit;
+}
+
+/**
+ * result_cache_store
+ * @brief Cache the result of a call
+ *
+ * @param name call name, a string that outlives the cache
+ * @param ttl_ms time to live
+ * @param generation result_cache_generation() before the call was made
+ * @param key inputs of the call
+ * @param keylen
+ * @param val result
+ * @param vallen
+ */
+__attribute__((visibility("hidden")))
+void result_cache_store(const char *name, unsigned int ttl_ms,
+			uint64_t generation, const void *key, size_t keylen,
+			const void *val, size_t vallen)
+{
+	unsigned int bucket = cache_hash(name, key, keylen);
+	uint64_t now = stats_now();
+	struct cache_entry **pp, *entry;
+
+	entry = malloc(sizeof(*entry) + keylen + vallen);
+	if (!entry)
+		return;
+
+	entry->name = name;
+	entry->expires = now + ttl_ms * 1000000ull;
+	entry->keylen = keylen;
+	entry->vallen = vallen;
+	memcpy(entry->data, key, keylen);
+	memcpy(entry->data + keylen, val, vallen);
+
+	pthread_mutex_lock(&cache_lock);
+
+	if (generation != cache_generation)
+		goto drop;
+
+	/* Replace an older result, and reclaim expired ones on the way */
+	pp = &cache[bucket];
+	while (*pp) {
+		struct cache_entry *e = *pp;
+
+		if (e->expires <= now ||
+		    (e->keylen == keylen && e->vallen == vallen &&
+		     !strcmp(e->name, name) && !memcmp(e->data, key, keylen)))
+			cache_unlink(pp);
+		else
+			pp = &e->next;
+	}
+
+	if (nentries >= CACHE_MAX_ENTRIES)
+		goto drop;
+
+	entry->next = cache[bucket];
+	cache[bucket] = entry;
+	nentries++;
+
+	pthread_mutex_unlock(&cache_lock);
+	return;
+
+drop:
+	pthread_mutex_unlock(&cache_lock);
+	free(entry);
+}
+
+/**
+ * result_cache_invalidate
+ * @brief Drop every cached result
+ */
+__attribute__((visibility("hidden")))
+void result_cache_invalidate(void)
+{
+	struct cache_entry **pp;
+	int i;
+
+	pthread_mutex_lock(&cache_lock);
+
+	for (i = 0; i < CACHE_BUCKETS; i++) {
+		pp = &cache[i];
+		while (*pp)
+			cache_unlink(pp);
+	}
+	__atomic_add_fetch(&cache_generation, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * rtas_set_cache_ttl
+ * @brief Interface to cache the results of a slow-changing query
+ *
+ * Results are cached per call and inputs for up to ttl_ms, and dropped
+ * early after DLPAR, node updates, migration, EEH option changes and
+ * the set calls that change them. Only get-power-level,
+ * get-sensor-state, ibm,get-config-addr-info2, ibm,get-system-parameter
+ * and ibm,read-slot-reset-state can be cached. Only successful results
+ * are cached.
+ *
+ * @param name call name
+ * @param ttl_ms time to live in milliseconds, 0 to stop caching
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Call cannot be cached
+ */
+int rtas_set_cache_ttl(const char *name, unsigned int ttl_ms)
+{
+	unsigned int old;
+	size_t i;
+
+	for (i = 0; i < NPOLICIES; i++) {
+		if (!strcmp(policies[i].name, name))
+			break;
+	}
+
+	if (i == NPOLICIES) {
+		dbg("(%s, %u) = %d\n", name, ttl_ms, RTAS_IO_ASSERT);
+		return RTAS_IO_ASSERT;
+	}
+
+	old = __atomic_exchange_n(&policies[i].ttl_ms, ttl_ms,
+				  __ATOMIC_RELAXED);
+	if (!old && ttl_ms)
+		__atomic_add_fetch(&npolicies_enabled, 1, __ATOMIC_RELAXED);
+	else if (old && !ttl_ms)
+		__atomic_sub_fetch(&npolicies_enabled, 1, __ATOMIC_RELAXED);
+
+	/* A shorter time to live applies to results already cached */
+	if (ttl_ms < old)
+		result_cache_invalidate();
+
+	dbg("(%s, %u) = 0\n", name, ttl_ms);
+	return 0;
+}
+
+/**
+ * rtas_flush_result_cache
+ * @brief Interface to drop every cached result
+ *
+ * For events librtas does not see, such as DLPAR or EEH recovery done
+ * by another process.
+ *
+ * @return 0
+ */
+int rtas_flush_result_cache(void)
+{
+	result_cache_invalidate();
+	return 0;
+}
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Single-flight coalescing of read-only calls. When a call marked
+// idempotent is made while an identical one (same token and inputs) is
+// already in firmware, the later caller waits for that call and takes
+// its result instead of queueing behind the kernel's RTAS lock for a
+// call of its own. Off by default, see rtas_set_coalescing().
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "librtas.h"
+#include "probes.h"
+
+#define FLIGHT_BUCKETS 64
+#define IDEMPOTENT_MAX 32
+#define IDEMPOTENT_NAME_MAX 64
+
+/* A call in firmware, and the callers waiting for its result */
+struct flight {
+	struct flight *next;
+	struct rtas_args args;	/* inputs, then the result */
+	int rc;
+	int done;
+	unsigned int waiters;
+	pthread_cond_t cond;
+};
+
+struct idempotent_call {
+	char name[IDEMPOTENT_NAME_MAX];
+	int enabled;
+};
+
+/* flight_lock protects the flights and their fields */
+static struct flight *flights[FLIGHT_BUCKETS];
+static pthread_mutex_t flight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Entries are only appended, under idempotent_lock */
+static struct idempotent_call idempotent_calls[IDEMPOTENT_MAX] = {
+	{ "get-power-level", 1 },
+	{ "get-sensor-state", 1 },
+	{ "get-time-of-day", 1 },
+	{ "ibm,get-config-addr-info2", 1 },
+	{ "ibm,read-slot-reset-state", 1 },
+};
+static unsigned int nidempotent = 5;
+static pthread_mutex_t idempotent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int coalescing;
+
+/**
+ * coalesce_wanted
+ * @brief Should a call go through coalesce_call()?
+ *
+ * @param name call name
+ * @return non-zero if coalescing is on and the call is idempotent
+ */
+__attribute__((visibility("hidden")))
+int coalesce_wanted(const char *name)
+{
+	unsigned int i, n;
+
+	if (!__atomic_load_n(&coalescing, __ATOMIC_RELAXED))
+		return 0;
+
+	n = __atomic_load_n(&nidempotent, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; i++) {
+		if (!strcmp(idempotent_calls[i].name, name))
+			return __atomic_load_n(&idempotent_calls[i].enabled,
+					       __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+static unsigned int flight_hash(const struct rtas_args *args, int ninputs)
+{
+	unsigned int h = be32toh(args->token);
+	int i;
+
+	for (i = 0; i < ninputs; i++)
+		h = h * 31 + args->args[i];
+
+	return h % FLIGHT_BUCKETS;
+}
+
+static int flight_match(const struct flight *f, const struct rtas_args *args,
+			int ninputs)
+{
+	return f->args.token == args->token &&
+		f->args.ninputs == args->ninputs &&
+		f->args.nret == args->nret &&
+		!memcmp(f->args.args, args->args, ninputs * sizeof(rtas_arg_t));
+}
+
+static void flight_free(struct flight *f)
+{
+	pthread_cond_destroy(&f->cond);
+	free(f);
+}
+
+/**
+ * coalesce_call
+ * @brief Make a call, or share the result of an identical one in flight
+ *
+ * @param args argument buffer, inputs already in big endian
+ * @param ninputs number of inputs
+ * @param call makes the call when there is none to share
+ * @param arg passed to call
+ * @return as call
+ */
+__attribute__((visibility("hidden")))
+int coalesce_call(struct rtas_args *args, int ninputs,
+		  int (*call)(struct rtas_args *, int, void *), void *arg)
+{
+	unsigned int bucket = flight_hash(args, ninputs);
+	struct flight *f, **pp;
+	int rc;
+
+	pthread_mutex_lock(&flight_lock);
+
+	for (f = flights[bucket]; f; f = f->next) {
+		if (!flight_match(f, args, ninputs))
+			continue;
+
+		f->waiters++;
+		while (!f->done)
+			pthread_cond_wait(&f->cond, &flight_lock);
+
+		*args = f->args;
+		rc = f->rc;
+		if (--f->waiters == 0)
+			flight_free(f);
+		pthread_mutex_unlock(&flight_lock);
+
+		PROBE2(call__coalesced, be32toh(args->token), rc);
+		return rc;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f) {
+		pthread_mutex_unlock(&flight_lock);
+		return call(args, ninputs, arg);
+	}
+
+	f->args = *args;
+	pthread_cond_init(&f->cond, NULL);
+	f->next = flights[bucket];
+	flights[bucket] = f;
+
+	pthread_mutex_unlock(&flight_lock);
+
+	rc = call(args, ninputs, arg);
+
+	pthread_mutex_lock(&flight_lock);
+
+	for (pp = &flights[bucket]; *pp != f; pp = &(*pp)->next)
+		;
+	*pp = f->next;
+
+	f->args = *args;
+	f->rc = rc;
+	f->done = 1;
+	if (f->waiters)
+		pthread_cond_broadcast(&f->cond);
+	else
+		flight_free(f);
+
+	pthread_mutex_unlock(&flight_lock);
+
+	return rc;
+}
+
+/**
+ * rtas_set_coalescing
+ * @brief Interface to turn single-flight coalescing on or off
+ *
+ * With coalescing on, a call marked idempotent that is made while an
+ * identical call (same token and inputs) is in progress in another
+ * thread shares that call's result instead of calling firmware again.
+ * Only the call's inputs are compared, so a call passing a work area
+ * should only be marked idempotent if callers never share a work area.
+ *
+ * @param enable non-zero to coalesce
+ * @return 0
+ */
+int rtas_set_coalescing(int enable)
+{
+	__atomic_store_n(&coalescing, !!enable, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * rtas_set_idempotent
+ * @brief Interface to mark a call as safe to coalesce
+ *
+ * get-sensor-state, get-power-level, get-time-of-day,
+ * ibm,get-config-addr-info2 and ibm,read-slot-reset-state are marked
+ * by default.
+ *
+ * @param name call name
+ * @param idempotent non-zero if identical concurrent calls may share
+ *	one result
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Name too long, or too many calls marked
+ */
+int rtas_set_idempotent(const char *name, int idempotent)
+{
+	unsigned int i;
+	int rc = 0;
+
+	if (strlen(name) >= IDEMPOTENT_NAME_MAX)
+		return RTAS_IO_ASSERT;
+
+	pthread_mutex_lock(&idempotent_lock);
+
+	for (i = 0; i < nidempotent; i++) {
+		if (!strcmp(idempotent_calls[i].name, name))
+			break;
+	}
+
+	if (i == nidempotent) {
+		if (i == IDEMPOTENT_MAX) {
+			rc = RTAS_IO_ASSERT;
+			goto out;
+		}
+		strcpy(idempotent_calls[i].name, name);
+		__atomic_store_n(&nidempotent, i + 1, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&idempotent_calls[i].enabled, !!idempotent,
+			 __ATOMIC_RELAXED);
+
+out:
+	pthread_mutex_unlock(&idempotent_lock);
+
+	dbg("(%s, %d) = %d\n", name, idempotent, rc);
+	return rc;
+}
@@ -0,0 +1,539 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Output stage for dumps. Chunks are either written as they are, or
+// compressed one by one into a container with an index at the end, so
+// that any chunk can be found and decompressed without reading the
+// ones before it.
+//
+// Container layout, all integers big endian:
+//   header   "RTASDUMP", u32 version, u32 codec, u32 chunk size, u32 0
+//   chunks   compressed chunks, back to back
+//   index    per chunk: u64 file offset, u32 stored length,
+//            u32 raw length
+//   trailer  u64 index offset, u64 chunk count, u64 raw length,
+//            "RTASIDX", NUL
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef LIBRTAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LIBRTAS_ZSTD
+#include <zstd.h>
+#endif
+#include "internal.h"
+#include "librtas.h"
+
+#define DUMP_VERSION 1
+#define DUMP_MAX_CHUNK (64 * 1024 * 1024)
+
+static const char dump_magic[8] = "RTASDUMP";
+static const char index_magic[8] = "RTASIDX";
+
+struct dump_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t codec;
+	uint32_t chunk_size;
+	uint32_t reserved;
+};
+
+struct dump_index_entry {
+	uint64_t offset;
+	uint32_t stored;
+	uint32_t raw;
+};
+
+struct dump_trailer {
+	uint64_t index_offset;
+	uint64_t nchunks;
+	uint64_t raw_bytes;
+	char magic[8];
+};
+
+struct dump_sink {
+	int fd;
+	int codec;
+	size_t chunk_size;
+	uint64_t offset;		/* where the next chunk goes */
+	uint64_t raw_bytes;
+	void *out;			/* compressed chunk */
+	size_t out_size;
+	struct dump_index_entry *index;	/* big endian */
+	size_t nchunks;
+	size_t index_size;
+};
+
+/**
+ * dump_write_all
+ * @brief Write a whole buffer, retrying short writes
+ *
+ * @param fd
+ * @param buf
+ * @param len
+ * @return 0 on success, RTAS_IO_ASSERT otherwise
+ */
+static int dump_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			dbg("write failed, errno=%d\n", errno);
+			return RTAS_IO_ASSERT;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * read_all
+ * @brief Read a whole buffer at an offset
+ *
+ * @param fd
+ * @param buf
+ * @param len
+ * @param offset
+ * @return 0 on success, RTAS_IO_ASSERT otherwise
+ */
+static int read_all(int fd, void *buf, size_t len, uint64_t offset)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = pread(fd, p, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			dbg("read at %llu failed\n", (unsigned long long)offset);
+			return RTAS_IO_ASSERT;
+		}
+
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return 0;
+}
+
+/**
+ * rtas_dump_codec_available
+ * @brief Interface to check whether librtas was built with a codec
+ *
+ * @param codec RTAS_DUMP_* value
+ * @return 1 if the codec can be used, 0 otherwise
+ */
+int rtas_dump_codec_available(int codec)
+{
+	switch (codec) {
+	case RTAS_DUMP_RAW:
+	case RTAS_DUMP_STORE:
+		return 1;
+#ifdef LIBRTAS_ZLIB
+	case RTAS_DUMP_ZLIB:
+		return 1;
+#endif
+#ifdef LIBRTAS_ZSTD
+	case RTAS_DUMP_ZSTD:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+/**
+ * compress_bound
+ * @brief Largest compressed size of a chunk
+ *
+ * @param codec
+ * @param len raw length
+ * @return bound
+ */
+static size_t compress_bound(int codec, size_t len)
+{
+	switch (codec) {
+#ifdef LIBRTAS_ZLIB
+	case RTAS_DUMP_ZLIB:
+		return compressBound(len);
+#endif
+#ifdef LIBRTAS_ZSTD
+	case RTAS_DUMP_ZSTD:
+		return ZSTD_compressBound(len);
+#endif
+	default:
+		return len;
+	}
+}
+
+/**
+ * compress_chunk
+ * @brief Compress one chunk, independently of the others
+ *
+ * Levels favour speed; dumps are taken on systems that are busy with
+ * other work.
+ *
+ * @param codec
+ * @param out
+ * @param out_size in: room in out, out: compressed length
+ * @param in
+ * @param len
+ * @return 0 on success, RTAS_IO_ASSERT otherwise
+ */
+static int compress_chunk(int codec, void *out, size_t *out_size,
+			  const void *in, size_t len)
+{
+	switch (codec) {
+#ifdef LIBRTAS_ZLIB
+	case RTAS_DUMP_ZLIB: {
+		uLongf n = *out_size;
+
+		if (compress2(out, &n, in, len, Z_BEST_SPEED) != Z_OK)
+			return RTAS_IO_ASSERT;
+		*out_size = n;
+		return 0;
+	}
+#endif
+#ifdef LIBRTAS_ZSTD
+	case RTAS_DUMP_ZSTD: {
+		size_t n = ZSTD_compress(out, *out_size, in, len, 1);
+
+		if (ZSTD_isError(n))
+			return RTAS_IO_ASSERT;
+		*out_size = n;
+		return 0;
+	}
+#endif
+	default:
+		return RTAS_IO_ASSERT;
+	}
+}
+
+/**
+ * decompress_chunk
+ *
+ * @param codec
+ * @param out
+ * @param raw expected raw length
+ * @param in
+ * @param len stored length
+ * @return 0 on success, RTAS_IO_ASSERT otherwise
+ */
+static int decompress_chunk(int codec, void *out, size_t raw,
+			    const void *in, size_t len)
+{
+	switch (codec) {
+	case RTAS_DUMP_STORE:
+		if (len != raw)
+			return RTAS_IO_ASSERT;
+		memcpy(out, in, len);
+		return 0;
+#ifdef LIBRTAS_ZLIB
+	case RTAS_DUMP_ZLIB: {
+		uLongf n = raw;
+
+		if (uncompress(out, &n, in, len) != Z_OK || n != raw)
+			return RTAS_IO_ASSERT;
+		return 0;
+	}
+#endif
+#ifdef LIBRTAS_ZSTD
+	case RTAS_DUMP_ZSTD:
+		if (ZSTD_decompress(out, raw, in, len) != raw)
+			return RTAS_IO_ASSERT;
+		return 0;
+#endif
+	default:
+		dbg("codec %d not available\n", codec);
+		return RTAS_IO_ASSERT;
+	}
+}
+
+/**
+ * dump_sink_open
+ * @brief Set up the output stage of a dump
+ *
+ * Codecs that are not available fall back to RTAS_DUMP_STORE.
+ *
+ * @param sinkp reference to the new sink
+ * @param fd output
+ * @param codec RTAS_DUMP_* value
+ * @param chunk_size largest chunk that will be written
+ * @param written reference to the bytes written, i.e. the header
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int dump_sink_open(struct dump_sink **sinkp, int fd, int codec,
+		   size_t chunk_size, uint64_t *written)
+{
+	struct dump_header header;
+	struct dump_sink *sink;
+	int rc;
+
+	*written = 0;
+
+	if (codec < RTAS_DUMP_RAW || codec > RTAS_DUMP_ZSTD ||
+	    chunk_size > DUMP_MAX_CHUNK)
+		return RTAS_IO_ASSERT;
+
+	if (!rtas_dump_codec_available(codec)) {
+		dbg("codec %d not available, storing chunks\n", codec);
+		codec = RTAS_DUMP_STORE;
+	}
+
+	sink = calloc(1, sizeof(*sink));
+	if (!sink)
+		return RTAS_NO_MEM;
+
+	sink->fd = fd;
+	sink->codec = codec;
+	sink->chunk_size = chunk_size;
+	*sinkp = sink;
+
+	if (codec == RTAS_DUMP_RAW)
+		return 0;
+
+	if (codec != RTAS_DUMP_STORE) {
+		sink->out_size = compress_bound(codec, chunk_size);
+		sink->out = malloc(sink->out_size);
+		if (!sink->out) {
+			rc = RTAS_NO_MEM;
+			goto fail;
+		}
+	}
+
+	memcpy(header.magic, dump_magic, sizeof(header.magic));
+	header.version = htobe32(DUMP_VERSION);
+	header.codec = htobe32(codec);
+	header.chunk_size = htobe32(chunk_size);
+	header.reserved = 0;
+
+	rc = dump_write_all(fd, &header, sizeof(header));
+	if (rc)
+		goto fail;
+
+	sink->offset = sizeof(header);
+	*written = sizeof(header);
+	return 0;
+
+fail:
+	free(sink->out);
+	free(sink);
+	*sinkp = NULL;
+	return rc;
+}
+
+/**
+ * dump_sink_write
+ * @brief Pass one chunk through the output stage
+ *
+ * @param sink
+ * @param buf chunk, e.g. straight from the RMO buffer
+ * @param len up to the chunk size given to dump_sink_open()
+ * @param written reference to the bytes written to the output
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int dump_sink_write(struct dump_sink *sink, const void *buf, size_t len,
+		    uint64_t *written)
+{
+	struct dump_index_entry *entry;
+	const void *data = buf;
+	size_t stored = len;
+	int rc;
+
+	*written = 0;
+
+	if (!len)
+		return 0;
+
+	if (len > sink->chunk_size)
+		return RTAS_IO_ASSERT;
+
+	if (sink->codec == RTAS_DUMP_RAW) {
+		rc = dump_write_all(sink->fd, buf, len);
+		if (rc == 0)
+			*written = len;
+		return rc;
+	}
+
+	if (sink->nchunks == sink->index_size) {
+		size_t n = sink->index_size ? sink->index_size * 2 : 64;
+
+		entry = realloc(sink->index, n * sizeof(*entry));
+		if (!entry)
+			return RTAS_NO_MEM;
+		sink->index = entry;
+		sink->index_size = n;
+	}
+
+	if (sink->out) {
+		stored = sink->out_size;
+		rc = compress_chunk(sink->codec, sink->out, &stored, buf, len);
+		if (rc)
+			return rc;
+		data = sink->out;
+	}
+
+	rc = dump_write_all(sink->fd, data, stored);
+	if (rc)
+		return rc;
+
+	entry = &sink->index[sink->nchunks++];
+	entry->offset = htobe64(sink->offset);
+	entry->stored = htobe32(stored);
+	entry->raw = htobe32(len);
+
+	sink->offset += stored;
+	sink->raw_bytes += len;
+	*written = stored;
+	return 0;
+}
+
+/**
+ * dump_sink_close
+ * @brief Finish the output and release the sink
+ *
+ * The index and trailer are only written if the dump was complete, so
+ * an interrupted dump cannot be mistaken for a whole one.
+ *
+ * @param sink
+ * @param complete non-zero if every chunk was written
+ * @param written reference to the bytes written to the output
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int dump_sink_close(struct dump_sink *sink, int complete, uint64_t *written)
+{
+	struct dump_trailer trailer;
+	size_t index_len;
+	int rc = 0;
+
+	*written = 0;
+
+	if (sink->codec != RTAS_DUMP_RAW && complete) {
+		index_len = sink->nchunks * sizeof(*sink->index);
+		rc = dump_write_all(sink->fd, sink->index, index_len);
+
+		trailer.index_offset = htobe64(sink->offset);
+		trailer.nchunks = htobe64(sink->nchunks);
+		trailer.raw_bytes = htobe64(sink->raw_bytes);
+		memcpy(trailer.magic, index_magic, sizeof(trailer.magic));
+
+		if (rc == 0)
+			rc = dump_write_all(sink->fd, &trailer,
+					    sizeof(trailer));
+		if (rc == 0)
+			*written = index_len + sizeof(trailer);
+	}
+
+	free(sink->index);
+	free(sink->out);
+	free(sink);
+
+	return rc;
+}
+
+/**
+ * rtas_dump_decompress
+ * @brief Interface to turn a dump container back into the plain dump
+ *
+ * Chunks are located through the index, so in_fd must be seekable.
+ *
+ * @param in_fd container written with a RTAS_DUMP_* codec other than
+ *	RTAS_DUMP_RAW
+ * @param out_fd where to write the dump
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Not a complete container, or the codec is not
+ *	available
+ */
+int rtas_dump_decompress(int in_fd, int out_fd)
+{
+	struct dump_index_entry *index = NULL;
+	struct dump_header header;
+	struct dump_trailer trailer;
+	void *in = NULL, *out = NULL;
+	uint64_t nchunks, index_offset, index_end, i;
+	uint32_t chunk_size;
+	off_t end;
+	int codec;
+	int rc;
+
+	end = lseek(in_fd, 0, SEEK_END);
+	if (end < (off_t)(sizeof(header) + sizeof(trailer)))
+		return RTAS_IO_ASSERT;
+
+	rc = read_all(in_fd, &header, sizeof(header), 0);
+	if (rc)
+		return rc;
+
+	rc = read_all(in_fd, &trailer, sizeof(trailer), end - sizeof(trailer));
+	if (rc)
+		return rc;
+
+	codec = be32toh(header.codec);
+	chunk_size = be32toh(header.chunk_size);
+	nchunks = be64toh(trailer.nchunks);
+	index_offset = be64toh(trailer.index_offset);
+	index_end = end - sizeof(trailer);
+
+	/* Bound nchunks before multiplying so the size cannot wrap */
+	if (memcmp(header.magic, dump_magic, sizeof(header.magic)) ||
+	    memcmp(trailer.magic, index_magic, sizeof(trailer.magic)) ||
+	    be32toh(header.version) != DUMP_VERSION ||
+	    chunk_size > DUMP_MAX_CHUNK ||
+	    index_offset < sizeof(header) || index_offset > index_end ||
+	    nchunks > (index_end - index_offset) / sizeof(*index) ||
+	    index_offset + nchunks * sizeof(*index) != index_end) {
+		dbg("not a complete dump container\n");
+		return RTAS_IO_ASSERT;
+	}
+
+	index = malloc(nchunks * sizeof(*index) + 1);
+	in = malloc(compress_bound(codec, chunk_size) + 1);
+	out = malloc(chunk_size + 1);
+	if (!index || !in || !out) {
+		rc = RTAS_NO_MEM;
+		goto out;
+	}
+
+	rc = read_all(in_fd, index, nchunks * sizeof(*index), index_offset);
+
+	for (i = 0; rc == 0 && i < nchunks; i++) {
+		uint32_t stored = be32toh(index[i].stored);
+		uint32_t raw = be32toh(index[i].raw);
+
+		if (raw > chunk_size ||
+		    stored > compress_bound(codec, chunk_size)) {
+			rc = RTAS_IO_ASSERT;
+			break;
+		}
+
+		rc = read_all(in_fd, in, stored, be64toh(index[i].offset));
+		if (rc == 0)
+			rc = decompress_chunk(codec, out, raw, in, stored);
+		if (rc == 0)
+			rc = dump_write_all(out_fd, out, raw);
+	}
+
+out:
+	free(index);
+	free(in);
+	free(out);
+
+	dbg("(%d, %d) = %d\n", in_fd, out_fd, rc);
+	return rc;
+}
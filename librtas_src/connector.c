@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Device tree of a newly added connector, from ibm,configure-connector.
+// The work area is parsed in place after every call, either into
+// events for the caller or into a tree of nodes and properties, so a
+// whole connector takes one library call and one RMO work area.
+
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "librtas.h"
+
+/* Layout of the work area on return from ibm,configure-connector */
+struct cc_workarea {
+	uint32_t drc_index;
+	uint32_t zero;
+	uint32_t name_offset;
+	uint32_t prop_length;
+	uint32_t prop_offset;
+};
+
+/* State of rtas_cfg_connector_tree() */
+struct cc_builder {
+	struct rtas_cc_node *tree;
+	struct rtas_cc_node *open;	/* innermost node not yet ended */
+	struct rtas_cc_node *prev;	/* node ended last */
+	struct rtas_cc_property **tail;	/* end of open's properties */
+};
+
+/**
+ * cc_name
+ * @brief Find a name returned in the work area
+ *
+ * @param buf work area
+ * @param offset big endian offset of the name
+ * @return name, or NULL if it does not fit the work area
+ */
+static const char *cc_name(const char *buf, uint32_t offset)
+{
+	offset = be32toh(offset);
+
+	if (offset < sizeof(struct cc_workarea) || offset >= WORK_AREA_SIZE ||
+	    !memchr(buf + offset, '\0', WORK_AREA_SIZE - offset))
+		return NULL;
+
+	return buf + offset;
+}
+
+/**
+ * cc_emit
+ * @brief Turn one ibm,configure-connector return into events
+ *
+ * @param status of the call
+ * @param ccwa work area
+ * @param depth reference to the number of open nodes
+ * @param event
+ * @param arg
+ * @return 0 on success, !0 otherwise
+ */
+static int cc_emit(int status, const struct cc_workarea *ccwa,
+		   unsigned int *depth,
+		   int (*event)(const struct rtas_cc_event *, void *),
+		   void *arg)
+{
+	const char *buf = (const char *)ccwa;
+	struct rtas_cc_event ev = { 0 };
+	uint32_t offset;
+	int rc;
+
+	switch (status) {
+	case RTAS_CC_COMPLETE:
+		ev.type = RTAS_CC_NODE_END;
+		for (rc = 0; *depth && !rc; ) {
+			ev.depth = --*depth;
+			rc = event(&ev, arg);
+		}
+		return rc;
+
+	case RTAS_CC_PREV_PARENT:
+		if (!*depth)
+			return RTAS_IO_ASSERT;
+		ev.type = RTAS_CC_NODE_END;
+		ev.depth = --*depth;
+		return event(&ev, arg);
+
+	case RTAS_CC_NEXT_SIBLING:
+		if (!*depth)
+			return RTAS_IO_ASSERT;
+		ev.type = RTAS_CC_NODE_END;
+		ev.depth = *depth - 1;
+		rc = event(&ev, arg);
+		if (rc)
+			return rc;
+		ev.type = RTAS_CC_NODE_BEGIN;
+		ev.name = cc_name(buf, ccwa->name_offset);
+		return ev.name ? event(&ev, arg) : RTAS_IO_ASSERT;
+
+	case RTAS_CC_NEXT_CHILD:
+		ev.type = RTAS_CC_NODE_BEGIN;
+		ev.depth = (*depth)++;
+		ev.name = cc_name(buf, ccwa->name_offset);
+		return ev.name ? event(&ev, arg) : RTAS_IO_ASSERT;
+
+	case RTAS_CC_NEXT_PROPERTY:
+		if (!*depth)
+			return RTAS_IO_ASSERT;
+		ev.type = RTAS_CC_PROPERTY;
+		ev.depth = *depth - 1;
+		ev.name = cc_name(buf, ccwa->name_offset);
+		ev.length = be32toh(ccwa->prop_length);
+		offset = be32toh(ccwa->prop_offset);
+		if (!ev.name || offset > WORK_AREA_SIZE ||
+		    ev.length > WORK_AREA_SIZE - offset)
+			return RTAS_IO_ASSERT;
+		ev.value = buf + offset;
+		return event(&ev, arg);
+
+	default:
+		return status < 0 ? status : RTAS_IO_ASSERT;
+	}
+}
+
+/**
+ * rtas_cfg_connector_parse
+ * @brief Interface to configure a connector and walk its device tree
+ *
+ * Calls ibm,configure-connector for drc_index until the connector is
+ * configured, and reports each node and property as an event. Node
+ * begin and end events nest; properties belong to the innermost open
+ * node. Names and values point into the work area and are only valid
+ * during the callback.
+ *
+ * Memory extents firmware asks for are kept with the work area handle
+ * for the whole configuration.
+ *
+ * @param wa work area handle of at least 4096 bytes, or NULL to use a
+ *	temporary one
+ * @param drc_index of the connector
+ * @param event callback, a non-zero return stops the walk and is
+ *	returned; the connector is then left partly configured
+ * @param arg passed to the callback
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_cfg_connector_parse(struct rtas_workarea *wa, uint32_t drc_index,
+			     int (*event)(const struct rtas_cc_event *, void *),
+			     void *arg)
+{
+	struct rtas_workarea *tmp = NULL;
+	struct cc_workarea *ccwa;
+	unsigned int depth = 0;
+	int rc, status;
+
+	if (!wa) {
+		rc = rtas_workarea_alloc(WORK_AREA_SIZE, &tmp);
+		if (rc)
+			return rc;
+		wa = tmp;
+	} else if (wa->size < WORK_AREA_SIZE) {
+		return RTAS_IO_ASSERT;
+	}
+
+	ccwa = wa->buf;
+	ccwa->drc_index = htobe32(drc_index);
+	ccwa->zero = 0;
+
+	do {
+		status = rtas_cfg_connector_wa(wa);
+		rc = cc_emit(status, ccwa, &depth, event, arg);
+	} while (!rc && status != RTAS_CC_COMPLETE);
+
+	(void)rtas_workarea_free(tmp);
+
+	dbg("(%p, 0x%x) = %d\n", wa, drc_index, rc);
+	return rc;
+}
+
+/**
+ * cc_build
+ * @brief Event callback of rtas_cfg_connector_tree()
+ *
+ * @param ev
+ * @param arg builder
+ * @return 0 on success, !0 otherwise
+ */
+static int cc_build(const struct rtas_cc_event *ev, void *arg)
+{
+	struct cc_builder *b = arg;
+	struct rtas_cc_property *prop;
+	struct rtas_cc_node *node;
+	size_t len;
+
+	switch (ev->type) {
+	case RTAS_CC_NODE_BEGIN:
+		len = strlen(ev->name) + 1;
+		node = calloc(1, sizeof(*node) + len);
+		if (!node)
+			return RTAS_NO_MEM;
+		node->name = (char *)(node + 1);
+		memcpy(node->name, ev->name, len);
+		node->parent = b->open;
+
+		if (b->prev && b->prev->parent == b->open)
+			b->prev->sibling = node;
+		else if (b->open)
+			b->open->child = node;
+		else
+			b->tree = node;
+
+		b->open = node;
+		b->prev = NULL;
+		b->tail = &node->properties;
+		return 0;
+
+	case RTAS_CC_NODE_END:
+		b->prev = b->open;
+		b->open = b->open->parent;
+		b->tail = NULL;
+		return 0;
+
+	case RTAS_CC_PROPERTY:
+		len = strlen(ev->name) + 1;
+		prop = malloc(sizeof(*prop) + len + ev->length);
+		if (!prop)
+			return RTAS_NO_MEM;
+		prop->next = NULL;
+		prop->name = (char *)(prop + 1);
+		memcpy(prop->name, ev->name, len);
+		prop->value = prop->name + len;
+		memcpy(prop->value, ev->value, ev->length);
+		prop->length = ev->length;
+
+		if (!b->tail) {
+			b->tail = &b->open->properties;
+			while (*b->tail)
+				b->tail = &(*b->tail)->next;
+		}
+		*b->tail = prop;
+		b->tail = &prop->next;
+		return 0;
+
+	default:
+		return RTAS_IO_ASSERT;
+	}
+}
+
+/**
+ * rtas_cfg_connector_tree
+ * @brief Interface to configure a connector and return its device tree
+ *
+ * As rtas_cfg_connector_parse(), with the nodes and properties built
+ * into a tree. Nodes and properties keep the order firmware returned
+ * them in. The first node is returned; further nodes at the top level
+ * are its siblings.
+ *
+ * @param wa work area handle, or NULL to use a temporary one
+ * @param drc_index of the connector
+ * @param tree reference to the tree, free with
+ *	rtas_cfg_connector_tree_free()
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_cfg_connector_tree(struct rtas_workarea *wa, uint32_t drc_index,
+			    struct rtas_cc_node **tree)
+{
+	struct cc_builder b = { 0 };
+	int rc;
+
+	rc = rtas_cfg_connector_parse(wa, drc_index, cc_build, &b);
+	if (rc) {
+		rtas_cfg_connector_tree_free(b.tree);
+		b.tree = NULL;
+	}
+
+	*tree = b.tree;
+	return rc;
+}
+
+/**
+ * rtas_cfg_connector_tree_free
+ * @brief Free a tree from rtas_cfg_connector_tree()
+ *
+ * @param tree may be NULL
+ */
+void rtas_cfg_connector_tree_free(struct rtas_cc_node *tree)
+{
+	struct rtas_cc_property *prop, *next_prop;
+	struct rtas_cc_node *next;
+
+	for (; tree; tree = next) {
+		next = tree->sibling;
+		rtas_cfg_connector_tree_free(tree->child);
+
+		for (prop = tree->properties; prop; prop = next_prop) {
+			next_prop = prop->next;
+			free(prop);
+		}
+
+		free(tree);
+	}
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Explicit warm-up of librtas. The interfaces probe the kernel, read
+// tokens, pick chardevs and map the RMO region lazily on first use, so
+// the first call of each kind is slow. A context does all of it up
+// front. The state it warms is shared by the whole process, as the
+// kernel interface and the RMO region are; contexts only record what
+// their warm-up found, so any number of them can coexist, and calls
+// made without one keep working as before.
+
+#include <stdlib.h>
+#include "internal.h"
+#include "librtas.h"
+#include "probes.h"
+
+struct rtas_context {
+	unsigned int flags;
+	struct rtas_context_info info;
+};
+
+/* Every call librtas makes */
+static const char *const context_calls[] = {
+	"display-character",
+	"get-power-level",
+	"get-sensor-state",
+	"get-time-of-day",
+	"ibm,activate-firmware",
+	"ibm,close-errinjct",
+	"ibm,configure-connector",
+	"ibm,display-message",
+	"ibm,errinjct",
+	"ibm,get-config-addr-info2",
+	"ibm,get-dynamic-sensor-state",
+	"ibm,get-indices",
+	"ibm,get-system-parameter",
+	"ibm,get-vpd",
+	"ibm,lpar-perftools",
+	"ibm,open-errinjct",
+	"ibm,physical-attestation",
+	"ibm,platform-dump",
+	"ibm,read-slot-reset-state",
+	"ibm,scan-log-dump",
+	"ibm,set-dynamic-indicator",
+	"ibm,set-eeh-option",
+	"ibm,set-system-parameter",
+	"ibm,suspend-me",
+	"ibm,update-nodes",
+	"ibm,update-properties",
+	"set-indicator",
+	"set-power-level",
+	"set-time-for-power-on",
+	"set-time-of-day",
+};
+
+#define NCONTEXT_CALLS (sizeof(context_calls) / sizeof(context_calls[0]))
+
+/**
+ * context_warm_up
+ * @brief Do the work calls would otherwise do on first use
+ *
+ * @param ctx context to record the results in
+ * @return 0 on success, !0 otherwise
+ */
+static int context_warm_up(struct rtas_context *ctx)
+{
+	struct rtas_context_info *info = &ctx->info;
+	uint64_t start = stats_now();
+	size_t i;
+	int rc;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	for (i = 0; i < NCONTEXT_CALLS; i++) {
+		if (rtas_token(context_calls[i]) < 0)
+			info->tokens_missing++;
+		else
+			info->tokens++;
+	}
+
+	info->vpd_chardev = vpd_fn_warm_up();
+	info->sysparm_chardev = sysparm_fn_warm_up();
+
+	if (!(ctx->flags & RTAS_CONTEXT_NO_RMO)) {
+		rc = rmo_warm_up(&info->rmo_pages);
+		if (rc)
+			return rc;
+	}
+
+	info->init_ns = stats_now() - start;
+	PROBE3(context__init, info->tokens, info->rmo_pages, info->init_ns);
+
+	return 0;
+}
+
+/**
+ * rtas_context_init
+ * @brief Interface to warm up librtas ahead of the first calls
+ *
+ * Probes the kernel interface, resolves the token of every call
+ * librtas makes, picks the chardevs to use and maps the RMO region,
+ * so that the first call of each kind does not pay for it. Calls made
+ * through any context, or none, share this state. After a backend
+ * change it is rebuilt lazily again unless a new context is made.
+ *
+ * @param flags RTAS_CONTEXT_* flags
+ * @param ctxp set to the new context
+ * @return 0 on success, !0 otherwise
+ *	RTAS_NO_MEM - Out of heap memory
+ *	RTAS_KERNEL_INT - No kernel interface to firmware
+ *	RTAS_PERM - Caller lacks permission
+ */
+int rtas_context_init(unsigned int flags, struct rtas_context **ctxp)
+{
+	struct rtas_context *ctx;
+	int rc;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return RTAS_NO_MEM;
+
+	ctx->flags = flags;
+
+	rc = context_warm_up(ctx);
+	if (rc) {
+		free(ctx);
+		ctx = NULL;
+	}
+
+	*ctxp = ctx;
+
+	dbg("(0x%x) = %d\n", flags, rc);
+	return rc;
+}
+
+/**
+ * rtas_context_info
+ * @brief Interface to report what a context's warm-up found
+ *
+ * @param ctx
+ * @param info set to the results of the warm-up
+ * @return 0
+ */
+int rtas_context_info(const struct rtas_context *ctx,
+		      struct rtas_context_info *info)
+{
+	*info = ctx->info;
+	return 0;
+}
+
+/**
+ * rtas_context_free
+ * @brief Interface to release a context
+ *
+ * The shared state the context warmed up stays in place for other
+ * contexts and for calls made without one.
+ *
+ * @param ctx context, may be NULL
+ * @return 0
+ */
+int rtas_context_free(struct rtas_context *ctx)
+{
+	free(ctx);
+	return 0;
+}
@@ -0,0 +1,429 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Streaming of platform dumps to a file descriptor. Two RMO chunks are
+// kept for the whole dump: while a writer thread writes one of them
+// out, firmware fills the other. Data goes from the RMO buffer to the
+// output stage without an intermediate copy, and is compressed there
+// on the writer thread if a codec was asked for.
+
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "internal.h"
+#include "librtas.h"
+#include "probes.h"
+
+#define DUMP_CHUNKS 2
+#define DUMP_CHUNK_DEFAULT (4 * WORK_AREA_SIZE)
+
+struct dump_chunk {
+	void *buf;
+	uint32_t pa;
+	size_t len;		/* valid bytes */
+	int full;		/* waiting to be written */
+};
+
+/*
+ * lock protects the chunk states, done, error and the write side of
+ * the progress counters. The firmware side is only touched by the
+ * calling thread.
+ */
+struct dump_stream {
+	uint64_t dump_tag;
+	uint64_t sequence;
+	struct dump_sink *sink;
+	size_t chunk_size;
+	struct dump_chunk chunks[DUMP_CHUNKS];
+	unsigned int nchunks;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;		/* no more chunks will be queued */
+	int error;		/* first write error */
+	uint64_t start;
+	struct rtas_dump_progress progress;
+};
+
+/**
+ * dump_write_chunk
+ * @brief Write out a chunk and account for it
+ *
+ * @param ds
+ * @param chunk
+ * @return 0 on success, !0 otherwise
+ */
+static int dump_write_chunk(struct dump_stream *ds, struct dump_chunk *chunk)
+{
+	uint64_t start = stats_now();
+	uint64_t written;
+	int rc;
+
+	rc = dump_sink_write(ds->sink, chunk->buf, chunk->len, &written);
+
+	pthread_mutex_lock(&ds->lock);
+	ds->progress.write_ns += stats_now() - start;
+	ds->progress.bytes_written += written;
+	if (rc && !ds->error)
+		ds->error = rc;
+	chunk->full = 0;
+	pthread_cond_broadcast(&ds->cond);
+	pthread_mutex_unlock(&ds->lock);
+
+	return rc;
+}
+
+/**
+ * dump_writer
+ * @brief Writer thread, writes the chunks out in the order they fill
+ *
+ * @param arg dump stream
+ * @return NULL
+ */
+static void *dump_writer(void *arg)
+{
+	struct dump_stream *ds = arg;
+	struct dump_chunk *chunk;
+	unsigned int i;
+	int full;
+
+	for (i = 0; ; i = (i + 1) % ds->nchunks) {
+		chunk = &ds->chunks[i];
+
+		pthread_mutex_lock(&ds->lock);
+		while (!chunk->full && !ds->done)
+			pthread_cond_wait(&ds->cond, &ds->lock);
+		full = chunk->full;
+		pthread_mutex_unlock(&ds->lock);
+
+		if (!full)
+			break;
+
+		if (dump_write_chunk(ds, chunk))
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * dump_fill
+ * @brief Have firmware fill a chunk with the next part of the dump
+ *
+ * @param ds
+ * @param chunk
+ * @return 0 if this was the last chunk, 1 if more follow, <0 on error
+ */
+static int dump_fill(struct dump_stream *ds, struct dump_chunk *chunk)
+{
+	uint32_t next_hi, next_lo, bytes_hi, bytes_lo;
+	uint64_t start = stats_now();
+	int rc, status;
+
+	rc = rtas_call("ibm,platform-dump", 6, 5,
+		       htobe32(BITS32_HI(ds->dump_tag)),
+		       htobe32(BITS32_LO(ds->dump_tag)),
+		       htobe32(BITS32_HI(ds->sequence)),
+		       htobe32(BITS32_LO(ds->sequence)),
+		       htobe32(chunk->pa), htobe32(ds->chunk_size), &status,
+		       &next_hi, &next_lo, &bytes_hi, &bytes_lo);
+
+	ds->progress.firmware_ns += stats_now() - start;
+
+	if (rc)
+		return rc;
+
+	if (status < 0)
+		return status;
+
+	ds->sequence = BITS64(be32toh(next_hi), be32toh(next_lo));
+	chunk->len = BITS64(be32toh(bytes_hi), be32toh(bytes_lo));
+	PROBE3(dump__chunk, ds->sequence, chunk->len, status);
+
+	if (chunk->len > ds->chunk_size) {
+		dbg("firmware returned %zu bytes for a %zu byte chunk\n",
+		    chunk->len, ds->chunk_size);
+		return RTAS_IO_ASSERT;
+	}
+
+	return status;
+}
+
+/**
+ * dump_snapshot
+ * @brief Copy the progress counters
+ *
+ * @param ds
+ * @param progress
+ */
+static void dump_snapshot(struct dump_stream *ds,
+			  struct rtas_dump_progress *progress)
+{
+	pthread_mutex_lock(&ds->lock);
+	*progress = ds->progress;
+	pthread_mutex_unlock(&ds->lock);
+
+	progress->elapsed_ns = stats_now() - ds->start;
+	progress->bytes_per_sec = progress->elapsed_ns ?
+		progress->bytes_written * 1000000000 / progress->elapsed_ns : 0;
+}
+
+/**
+ * rtas_platform_dump_compress
+ * @brief Stream a whole platform dump to a file descriptor
+ *
+ * Calls ibm,platform-dump from the start of the dump until firmware
+ * reports that it is complete, and writes the data to fd. Two RMO
+ * chunks of chunk_size bytes are used, so that writing one overlaps
+ * with firmware filling the other; if the RMO region only has room
+ * for one, the dump is read and written in turn.
+ *
+ * With a codec other than RTAS_DUMP_RAW each chunk is compressed on
+ * its own as it is written, into a container that
+ * rtas_dump_decompress() turns back into the dump. Codecs librtas was
+ * built without fall back to RTAS_DUMP_STORE.
+ *
+ * The progress callback runs on the calling thread after each chunk
+ * is read. A non-zero return stops the dump, and is returned.
+ *
+ * @param dump_tag
+ * @param fd file descriptor to write the dump to
+ * @param codec RTAS_DUMP_* value
+ * @param chunk_size bytes per firmware call, 0 for the default
+ * @param progress callback, may be NULL
+ * @param arg passed to the callback
+ * @param result reference to the final counters, may be NULL
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_platform_dump_compress(uint64_t dump_tag, int fd, int codec,
+				size_t chunk_size,
+				int (*progress)(const struct rtas_dump_progress *,
+						void *),
+				void *arg, struct rtas_dump_progress *result)
+{
+	struct dump_stream ds = {
+		.dump_tag = dump_tag,
+		.nchunks = DUMP_CHUNKS,
+	};
+	struct rtas_dump_progress snap;
+	struct dump_chunk *chunk;
+	uint64_t written;
+	pthread_t writer;
+	unsigned int i;
+	int rc, err, status = 1;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	if (!chunk_size)
+		chunk_size = DUMP_CHUNK_DEFAULT;
+	ds.chunk_size = (chunk_size + WORK_AREA_SIZE - 1) /
+		WORK_AREA_SIZE * WORK_AREA_SIZE;
+
+	pthread_mutex_init(&ds.lock, NULL);
+	pthread_cond_init(&ds.cond, NULL);
+	ds.start = stats_now();
+
+	rc = dump_sink_open(&ds.sink, fd, codec, ds.chunk_size, &written);
+	ds.progress.bytes_written += written;
+	if (rc)
+		goto out;
+
+	rc = rtas_get_rmo_buffer(ds.chunk_size, &ds.chunks[0].buf,
+				 &ds.chunks[0].pa);
+	if (rc) {
+		(void)dump_sink_close(ds.sink, 0, &written);
+		goto out;
+	}
+
+	if (rtas_get_rmo_buffer(ds.chunk_size, &ds.chunks[1].buf,
+				&ds.chunks[1].pa)) {
+		dbg("only one chunk available, not overlapping writes\n");
+		ds.nchunks = 1;
+	} else if (pthread_create(&writer, NULL, dump_writer, &ds)) {
+		(void)rtas_free_rmo_buffer(ds.chunks[1].buf, ds.chunks[1].pa,
+					   ds.chunk_size);
+		ds.nchunks = 1;
+	}
+
+	for (i = 0; ; i = (i + 1) % ds.nchunks) {
+		chunk = &ds.chunks[i];
+
+		pthread_mutex_lock(&ds.lock);
+		while (chunk->full && !ds.error)
+			pthread_cond_wait(&ds.cond, &ds.lock);
+		rc = ds.error;
+		pthread_mutex_unlock(&ds.lock);
+
+		if (rc)
+			break;
+
+		status = dump_fill(&ds, chunk);
+		if (status < 0) {
+			rc = status;
+			break;
+		}
+
+		ds.progress.bytes_read += chunk->len;
+		ds.progress.chunks++;
+
+		if (ds.nchunks == 1) {
+			rc = dump_write_chunk(&ds, chunk);
+			if (rc)
+				break;
+		} else {
+			pthread_mutex_lock(&ds.lock);
+			chunk->full = 1;
+			pthread_cond_broadcast(&ds.cond);
+			pthread_mutex_unlock(&ds.lock);
+		}
+
+		if (progress) {
+			dump_snapshot(&ds, &snap);
+			rc = progress(&snap, arg);
+			if (rc)
+				break;
+		}
+
+		if (status == 0)
+			break;
+	}
+
+	if (ds.nchunks > 1) {
+		pthread_mutex_lock(&ds.lock);
+		ds.done = 1;
+		pthread_cond_broadcast(&ds.cond);
+		pthread_mutex_unlock(&ds.lock);
+
+		pthread_join(writer, NULL);
+		if (!rc)
+			rc = ds.error;
+	}
+
+	for (i = 0; i < ds.nchunks; i++)
+		(void)rtas_free_rmo_buffer(ds.chunks[i].buf, ds.chunks[i].pa,
+					   ds.chunk_size);
+
+	/* Only a complete dump gets an index */
+	err = dump_sink_close(ds.sink, !rc && status == 0, &written);
+	ds.progress.bytes_written += written;
+	if (!rc)
+		rc = err;
+
+out:
+	if (result)
+		dump_snapshot(&ds, result);
+
+	pthread_cond_destroy(&ds.cond);
+	pthread_mutex_destroy(&ds.lock);
+
+	dbg("(0x%" PRIx64 ", %d, %d, %zu) = %d, %" PRIu64 " bytes\n",
+	    dump_tag, fd, codec, chunk_size, rc, ds.progress.bytes_written);
+	return rc;
+}
+
+/**
+ * rtas_platform_dump_to_fd
+ * @brief Stream a whole platform dump to a file descriptor
+ *
+ * As rtas_platform_dump_compress() with RTAS_DUMP_RAW.
+ *
+ * @param dump_tag
+ * @param fd file descriptor to write the dump to
+ * @param chunk_size bytes per firmware call, 0 for the default
+ * @param progress callback, may be NULL
+ * @param arg passed to the callback
+ * @param result reference to the final counters, may be NULL
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_platform_dump_to_fd(uint64_t dump_tag, int fd, size_t chunk_size,
+			     int (*progress)(const struct rtas_dump_progress *,
+					     void *),
+			     void *arg, struct rtas_dump_progress *result)
+{
+	return rtas_platform_dump_compress(dump_tag, fd, RTAS_DUMP_RAW,
+					   chunk_size, progress, arg, result);
+}
+
+/**
+ * rtas_scan_log_dump_compress
+ * @brief Write a scan log dump to a file descriptor
+ *
+ * The dump is taken into an RMO buffer of length bytes with
+ * ibm,scan-log-dump and written from there in chunks, compressed with
+ * codec as for rtas_platform_dump_compress(). Firmware returns the
+ * dump in one call, so there is nothing for a writer thread to
+ * overlap with and the chunks are written on the calling thread.
+ *
+ * @param fd file descriptor to write the dump to
+ * @param length size of the scan log dump buffer
+ * @param codec RTAS_DUMP_* value
+ * @param result reference to the final counters, may be NULL
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_scan_log_dump_compress(int fd, size_t length, int codec,
+				struct rtas_dump_progress *result)
+{
+	struct rtas_dump_progress progress = { 0 };
+	struct dump_sink *sink = NULL;
+	uint64_t start = stats_now(), t, written;
+	size_t off, n;
+	uint32_t pa;
+	void *buf;
+	int rc, status = 0;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	rc = rtas_get_rmo_buffer(length, &buf, &pa);
+	if (rc)
+		return rc;
+
+	memset(buf, 0, length);
+
+	t = stats_now();
+	rc = rtas_call("ibm,scan-log-dump", 2, 1, htobe32(pa), htobe32(length),
+		       &status);
+	progress.firmware_ns = stats_now() - t;
+	if (rc == 0 && status)
+		rc = status;
+	if (rc)
+		goto out;
+
+	progress.bytes_read = length;
+
+	t = stats_now();
+	rc = dump_sink_open(&sink, fd, codec, DUMP_CHUNK_DEFAULT, &written);
+	progress.bytes_written += written;
+
+	for (off = 0; rc == 0 && off < length; off += n) {
+		n = length - off < DUMP_CHUNK_DEFAULT ?
+			length - off : DUMP_CHUNK_DEFAULT;
+		rc = dump_sink_write(sink, (char *)buf + off, n, &written);
+		progress.bytes_written += written;
+		progress.chunks++;
+	}
+
+	if (sink) {
+		status = dump_sink_close(sink, rc == 0, &written);
+		progress.bytes_written += written;
+		if (!rc)
+			rc = status;
+	}
+	progress.write_ns = stats_now() - t;
+
+out:
+	(void)rtas_free_rmo_buffer(buf, pa, length);
+
+	progress.elapsed_ns = stats_now() - start;
+	progress.bytes_per_sec = progress.elapsed_ns ?
+		progress.bytes_written * 1000000000 / progress.elapsed_ns : 0;
+	if (result)
+		*result = progress;
+
+	dbg("(%d, %zu, %d) = %d\n", fd, length, codec, rc);
+	return rc;
+}
@@ -0,0 +1,344 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Cache of the sensors and indicators of each type, as listed by
+// ibm,get-indices. A type is walked once, through a single work area,
+// into one allocation holding its indices and location codes. Tables
+// are shared read-only and reference counted, so a refresh does not
+// pull a table out from under a caller still iterating it. The cache
+// is refreshed after events that change the device tree: migration,
+// DLPAR and node updates.
+
+#include <endian.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "librtas.h"
+
+#define INDICES_WA_SIZE (4 * WORK_AREA_SIZE)
+
+struct index_table {
+	struct rtas_index_table pub;
+	unsigned int refs;
+	uint64_t generation;
+	struct index_table *next;
+};
+
+/* Indices and location codes while a type is walked */
+struct index_list {
+	int *indices;
+	size_t *loc_offsets;
+	size_t count;
+	size_t size;
+	char *locs;
+	size_t locs_len;
+	size_t locs_size;
+};
+
+static struct index_table *index_cache;
+static pthread_mutex_t index_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t index_generation = 1;
+
+/**
+ * index_cache_invalidate
+ * @brief Have the index tables walked again on their next use
+ */
+__attribute__((visibility("hidden")))
+void index_cache_invalidate(void)
+{
+	__atomic_add_fetch(&index_generation, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * table_put
+ * @brief Drop a reference to a table
+ *
+ * @param table
+ */
+static void table_put(struct index_table *table)
+{
+	if (__atomic_sub_fetch(&table->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(table);
+}
+
+/**
+ * list_add
+ * @brief Add an index and its location code to a list
+ *
+ * @param list
+ * @param index
+ * @param loc location code, not necessarily NUL terminated
+ * @param len length of loc
+ * @return 0 on success, RTAS_NO_MEM otherwise
+ */
+static int list_add(struct index_list *list, int index, const char *loc,
+		    size_t len)
+{
+	size_t n;
+	void *p;
+
+	len = strnlen(loc, len);
+
+	if (list->count == list->size) {
+		n = list->size ? list->size * 2 : 64;
+		p = realloc(list->indices, n * sizeof(*list->indices));
+		if (!p)
+			return RTAS_NO_MEM;
+		list->indices = p;
+		p = realloc(list->loc_offsets, n * sizeof(*list->loc_offsets));
+		if (!p)
+			return RTAS_NO_MEM;
+		list->loc_offsets = p;
+		list->size = n;
+	}
+
+	if (list->locs_len + len + 1 > list->locs_size) {
+		n = list->locs_size ? list->locs_size : 1024;
+		while (n < list->locs_len + len + 1)
+			n *= 2;
+		p = realloc(list->locs, n);
+		if (!p)
+			return RTAS_NO_MEM;
+		list->locs = p;
+		list->locs_size = n;
+	}
+
+	list->indices[list->count] = index;
+	list->loc_offsets[list->count] = list->locs_len;
+	memcpy(list->locs + list->locs_len, loc, len);
+	list->locs[list->locs_len + len] = '\0';
+	list->locs_len += len + 1;
+	list->count++;
+
+	return 0;
+}
+
+/**
+ * list_parse
+ * @brief Add the entries of one ibm,get-indices work area to a list
+ *
+ * The work area holds the number of entries, then for each the
+ * index, the length of the location code and the location code.
+ *
+ * @param list
+ * @param buf work area
+ * @param size of the work area
+ * @return 0 on success, !0 otherwise
+ */
+static int list_parse(struct index_list *list, const char *buf, size_t size)
+{
+	uint32_t count, index, len, i;
+	size_t off = sizeof(count);
+	int rc;
+
+	memcpy(&count, buf, sizeof(count));
+	count = be32toh(count);
+
+	for (i = 0; i < count; i++) {
+		if (size - off < sizeof(index) + sizeof(len))
+			return RTAS_IO_ASSERT;
+
+		memcpy(&index, buf + off, sizeof(index));
+		memcpy(&len, buf + off + sizeof(index), sizeof(len));
+		off += sizeof(index) + sizeof(len);
+		len = be32toh(len);
+
+		if (len > size - off)
+			return RTAS_IO_ASSERT;
+
+		rc = list_add(list, be32toh(index), buf + off, len);
+		if (rc)
+			return rc;
+		off += len;
+	}
+
+	return 0;
+}
+
+/**
+ * table_build
+ * @brief Walk all indices of a type into a new table
+ *
+ * @param is_sensor
+ * @param type
+ * @param tablep reference to the new table
+ * @return 0 on success, !0 otherwise
+ */
+static int table_build(int is_sensor, int type, struct index_table **tablep)
+{
+	struct index_list list = { 0 };
+	struct index_table *table;
+	struct rtas_workarea *wa;
+	const char **locs;
+	size_t i, len;
+	int start = 1, next;
+	int *indices;
+	char *p;
+	int rc;
+
+	rc = rtas_workarea_alloc(INDICES_WA_SIZE, &wa);
+	if (rc)
+		return rc;
+
+	do {
+		rc = rtas_get_indices_wa(is_sensor, type, wa, INDICES_WA_SIZE,
+					 start, &next);
+		if (rc < 0)
+			break;
+
+		if (list_parse(&list, rtas_workarea_buf(wa), INDICES_WA_SIZE)) {
+			rc = RTAS_IO_ASSERT;
+			break;
+		}
+
+		start = next;
+	} while (rc == 1);
+
+	(void)rtas_workarea_free(wa);
+	if (rc)
+		goto out;
+
+	/* Location code pointers, indices and codes in one allocation */
+	len = sizeof(*table) + list.count * (sizeof(*locs) + sizeof(*indices)) +
+		list.locs_len;
+	table = malloc(len);
+	if (!table) {
+		rc = RTAS_NO_MEM;
+		goto out;
+	}
+
+	locs = (const char **)(table + 1);
+	indices = (int *)(locs + list.count);
+	p = (char *)(indices + list.count);
+
+	if (list.count) {
+		memcpy(indices, list.indices, list.count * sizeof(*indices));
+		memcpy(p, list.locs, list.locs_len);
+	}
+	for (i = 0; i < list.count; i++)
+		locs[i] = p + list.loc_offsets[i];
+
+	table->pub.is_sensor = is_sensor;
+	table->pub.type = type;
+	table->pub.count = list.count;
+	table->pub.indices = indices;
+	table->pub.loc_codes = locs;
+	table->refs = 1;
+	*tablep = table;
+
+out:
+	free(list.indices);
+	free(list.loc_offsets);
+	free(list.locs);
+	return rc;
+}
+
+/**
+ * rtas_get_index_table
+ * @brief Interface to the cached sensors or indicators of a type
+ *
+ * The first use of a type walks all of its ibm,get-indices pages; later
+ * uses return the cached table until migration, DLPAR, a node update
+ * or rtas_flush_index_cache() makes it stale. Tables are read-only and
+ * stay valid until released with rtas_put_index_table(), even if the
+ * cache is refreshed in the meantime.
+ *
+ * @param is_sensor non-zero for sensors, zero for indicators
+ * @param type sensor or indicator type
+ * @param table reference to the table
+ * @return 0 on success, !0 otherwise
+ *	as rtas_get_indices()
+ */
+int rtas_get_index_table(int is_sensor, int type,
+			 const struct rtas_index_table **table)
+{
+	struct index_table *entry, **pp, *built = NULL;
+	uint64_t generation, built_generation = 0;
+	int rc;
+
+	*table = NULL;
+	is_sensor = !!is_sensor;
+
+	for (;;) {
+		generation = __atomic_load_n(&index_generation,
+					     __ATOMIC_ACQUIRE);
+
+		pthread_mutex_lock(&index_cache_lock);
+		for (pp = &index_cache; (entry = *pp); pp = &entry->next) {
+			if (entry->pub.is_sensor == is_sensor &&
+			    entry->pub.type == type)
+				break;
+		}
+
+		if (entry && entry->generation == generation) {
+			__atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&index_cache_lock);
+			break;
+		}
+
+		if (built) {
+			/* Replace the stale table, if any */
+			if (entry) {
+				*pp = entry->next;
+				table_put(entry);
+			}
+			built->generation = built_generation;
+			__atomic_add_fetch(&built->refs, 1, __ATOMIC_RELAXED);
+			built->next = index_cache;
+			index_cache = built;
+			pthread_mutex_unlock(&index_cache_lock);
+
+			entry = built;
+			built = NULL;
+			break;
+		}
+		pthread_mutex_unlock(&index_cache_lock);
+
+		/*
+		 * Walk outside the lock; firmware may ask for delays. The
+		 * table is stored under the generation read before the walk,
+		 * so a change during the walk leaves it stale.
+		 */
+		built_generation = generation;
+		rc = table_build(is_sensor, type, &built);
+		if (rc) {
+			dbg("(%d, %d) = %d\n", is_sensor, type, rc);
+			return rc;
+		}
+	}
+
+	if (built)
+		table_put(built);
+
+	*table = &entry->pub;
+	dbg("(%d, %d) = 0, %zu indices\n", is_sensor, type, entry->pub.count);
+	return 0;
+}
+
+/**
+ * rtas_put_index_table
+ * @brief Release a table from rtas_get_index_table()
+ *
+ * @param table may be NULL
+ */
+void rtas_put_index_table(const struct rtas_index_table *table)
+{
+	if (table)
+		table_put((struct index_table *)table);
+}
+
+/**
+ * rtas_flush_index_cache
+ * @brief Interface to drop the cached sensor and indicator tables
+ *
+ * Callers that change the device tree by other means than librtas
+ * (e.g. DLPAR or migration driven by the kernel) should call this so
+ * that the tables are walked again.
+ *
+ * @return 0
+ */
+int rtas_flush_index_cache(void)
+{
+	index_cache_invalidate();
+	return 0;
+}
@@ -45,15 +45,120 @@ struct region {
 	struct region *next;
 };
 
+/*
+ * Layer below librtas: the kernel and firmware, or the simulated
+ * firmware in sim.c. Every system call, RMO mapping, chardev access and
+ * token lookup goes through the current backend.
+ */
+struct rtas_backend {
+	const char *name;
+	int (*check_caller)(void);
+	int (*interface_exists)(void);
+	int (*syscall)(struct rtas_args *args);
+	int (*read_token)(const char *call_name, int *token);
+	int (*rmo_bounds)(struct region *kregion);
+	int (*rmo_map)(struct region *kregion, void **buf);
+	void (*rmo_unmap)(struct region *kregion, void *buf);
+	int rmo_private;	/* region not shared with other processes */
+	int (*chardev_exists)(const char *path);
+	int (*chardev_open)(const char *path, int flags);
+	int (*chardev_ioctl)(int fd, unsigned long request, void *arg);
+};
+
+const struct rtas_backend *backend_get(void);
+int backend_set(const struct rtas_backend *be);
+unsigned int backend_generation(void);
+
+int native_interface_exists(void);
+int native_rtas_syscall(struct rtas_args *args);
+int native_read_token(const char *call_name, int *token);
+int native_rmo_bounds(struct region *kregion);
+int native_rmo_map(struct region *kregion, void **buf);
+void native_rmo_unmap(struct region *kregion, void *buf);
+
 int rtas_get_rmo_buffer(size_t size, void **buf, uint32_t *phys_addr);
 int rtas_free_rmo_buffer(void *buf, uint32_t phys_addr, size_t size);
+int rmo_reset(void);
+int rmo_warm_up(size_t *n_pages);
+int vpd_fn_warm_up(void);
+int sysparm_fn_warm_up(void);
+
+/* Work area handle, see rtas_workarea_alloc() */
+struct wa_extent {
+	void *buf;
+	uint32_t pa;
+};
+
+struct rtas_workarea {
+	void *buf;
+	uint32_t pa;
+	size_t size;
+	struct wa_extent *extents;	/* ibm,configure-connector memory */
+	unsigned int nextents;
+	unsigned int extents_used;	/* by the configuration in progress */
+};
+int workarea_init(struct rtas_workarea *wa, size_t size);
+int workarea_extent(struct rtas_workarea *wa, uint32_t *pa);
+void workarea_release(struct rtas_workarea *wa);
+void interface_invalidate(void);
 int interface_exists(void);
 int read_entire_file(int fd, char **buf, size_t *len);
 int rtas_token(const char *call_name);
+void token_cache_invalidate(void);
+void index_cache_invalidate(void);
 int sanity_check(void);
 
 #define CALL_AGAIN 1
-unsigned int handle_delay(int status, uint64_t * elapsed);
+
+/* Delay handling state of one call, zero before the first attempt */
+struct delay_state {
+	uint64_t elapsed;	/* ms spent in extended delays */
+	unsigned int busy;	/* consecutive RC_BUSY retries */
+};
+
+unsigned int handle_delay(int status, struct delay_state *delay);
+struct token_stats;
+struct token_stats *stats_get(int token);
+uint64_t stats_now(void);
+void stats_status(struct token_stats *ts, int status);
+void stats_call_done(struct token_stats *ts, uint64_t start, uint64_t end,
+		     int failed);
+void stats_rmo_alloc(size_t n_pages);
+void stats_rmo_free(void);
+
+void trace_call(const struct rtas_args *args, uint64_t start, uint64_t end,
+		int rc, unsigned int attempts);
+
+struct dump_sink;
+int dump_sink_open(struct dump_sink **sinkp, int fd, int codec,
+		   size_t chunk_size, uint64_t *written);
+int dump_sink_write(struct dump_sink *sink, const void *buf, size_t len,
+		    uint64_t *written);
+int dump_sink_close(struct dump_sink *sink, int complete, uint64_t *written);
+
+unsigned int call_cache_ttl(const char *name);
+unsigned int sysparm_cache_ttl(void);
+uint64_t result_cache_generation(void);
+int result_cache_lookup(const char *name, const void *key, size_t keylen,
+			void *val, size_t vallen);
+void result_cache_store(const char *name, unsigned int ttl_ms,
+			uint64_t generation, const void *key, size_t keylen,
+			const void *val, size_t vallen);
+void result_cache_invalidate(void);
+
+int sched_enter(void);
+void sched_exit(void);
+
+int coalesce_wanted(const char *name);
+int coalesce_call(struct rtas_args *args, int ninputs,
+		  int (*call)(struct rtas_args *, int, void *), void *arg);
+
+struct rate_limiter;
+struct rate_limiter *rate_limiter_get(const char *name);
+struct rate_limiter *rate_limiter_get_token(int token);
+int rate_limit_coalesces(struct rate_limiter *rl);
+int rate_limit_take(struct rate_limiter *rl);
+
 int rtas_call_no_delay(const char *name, int ninputs, int nrets, ...);
 int rtas_call(const char *name, int ninputs, int nrets, ...);
 
@@ -65,7 +170,7 @@ extern int dbg_lvl;
 
 #define dbg(_fmt, _args...)						  \
 	do {								  \
-		if (dbg_lvl > 0)					  \
+		if (__atomic_load_n(&dbg_lvl, __ATOMIC_RELAXED) > 0)	  \
 			printf("librtas %s(): " _fmt, __func__, ##_args); \
 	} while (0)
 
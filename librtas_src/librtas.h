@@ -35,6 +35,8 @@
 #define RTAS_NO_LOWMEM	-1005	/* Kernel out of low memory */
 #define RTAS_FREE_ERR	-1006	/* Attempt to free nonexistant rmo buffer */
 #define RTAS_TIMEOUT	-1007	/* RTAS delay exceeded specified timeout */
+#define RTAS_AGAIN	-1008	/* Call in progress, resume after delay */
+#define RTAS_THROTTLED	-1009	/* Call over its rate limit */
 #define RTAS_IO_ASSERT	-1098	/* Unexpected I/O Error */
 #define RTAS_UNKNOWN_OP -1099	/* No Firmware Implementation of Function */
 
@@ -48,27 +50,276 @@
  * 2) An implementation of the RTAS function, in syscall_calls.c.
  */
 
+#define RTAS_BATCH_MAX_ARGS 16
+
+/* One entry of a rtas_call_batch() request */
+struct rtas_batch_call {
+	const char *name;	/* RTAS call name, or NULL to use token */
+	int token;		/* RTAS token, set from name if given */
+	int ninputs;
+	int nrets;		/* including the status in rets[0] */
+	uint32_t inputs[RTAS_BATCH_MAX_ARGS];
+	uint32_t rets[RTAS_BATCH_MAX_ARGS];
+	int rc;			/* librtas result for this entry */
+};
+
+/* Retry policy for RC_BUSY returns, see rtas_set_busy_backoff() */
+struct rtas_busy_backoff {
+	unsigned int spin;		/* immediate retries */
+	unsigned int yield;		/* retries after yielding the cpu */
+	unsigned int min_sleep_us;	/* first sleep, doubled on each retry */
+	unsigned int max_sleep_us;	/* upper bound for a single sleep */
+	unsigned int max_retries;	/* give up after this many, 0 for no cap */
+};
+
+/* Number of RC_BUSY retries handled by each backoff stage */
+struct rtas_busy_stats {
+	uint64_t spins;
+	uint64_t yields;
+	uint64_t sleeps;
+	uint64_t sleep_us;		/* total time slept */
+	uint64_t exhausted;		/* calls that reached max_retries */
+};
+
+#define RTAS_STATS_LATENCY_BUCKETS 16
+
+/* Counters for one RTAS token, see rtas_get_stats() */
+struct rtas_call_stats {
+	int token;
+	uint64_t calls;
+	uint64_t errors;	/* kernel failures and negative statuses */
+	uint64_t busy;		/* RC_BUSY returns */
+	uint64_t delays[EXTENDED_DELAY_MAX - EXTENDED_DELAY_MIN + 1];
+	uint64_t total_ns;	/* time spent in calls, including retries */
+	uint64_t max_ns;
+	/*
+	 * latency[0] counts calls under 1us, latency[i] calls from
+	 * 2^(i-1) up to 2^i us, and the last bucket all slower calls.
+	 */
+	uint64_t latency[RTAS_STATS_LATENCY_BUCKETS];
+};
+
+/* RMO buffer counters, see rtas_get_stats() */
+struct rtas_rmo_stats {
+	uint64_t allocs;
+	uint64_t pages;		/* pages handed out by allocs */
+	uint64_t alloc_failures;
+	uint64_t frees;
+};
+
+/* What rtas_context_init() found, see rtas_context_info() */
+struct rtas_context_info {
+	uint64_t init_ns;		/* time the warm-up took */
+	unsigned int tokens;		/* calls with a token */
+	unsigned int tokens_missing;	/* calls firmware does not provide */
+	size_t rmo_pages;		/* RMO region pages, 0 if not mapped */
+	int vpd_chardev;		/* ibm,get-vpd through /dev/papr-vpd */
+	int sysparm_chardev;		/* sysparms through /dev/papr-sysparm */
+};
+
+/* rtas_context_init() flags */
+#define RTAS_CONTEXT_NO_RMO	0x1	/* leave the RMO region unmapped */
+
+struct rtas_context;
+
+/* Scheduling classes, see rtas_sched_set_class() */
+#define RTAS_SCHED_CRITICAL	0	/* e.g. EPOW sensor reads */
+#define RTAS_SCHED_INTERACTIVE	1	/* the default */
+#define RTAS_SCHED_BULK		2	/* dumps, configure-connector */
+#define RTAS_SCHED_CLASSES	3
+
+/* rtas_sched_start() settings, 0 for the defaults */
+struct rtas_sched_config {
+	unsigned int slots;	/* calls in firmware at once, default 1 */
+	unsigned int workers;	/* threads for rtas_sched_submit(), default 2 */
+	unsigned int aging_ms;	/* wait that moves a call up a class, 100 */
+};
+
+struct rtas_sched_class_stats {
+	uint64_t dispatched;
+	uint64_t aged;		/* dispatched ahead of their class by aging */
+	uint64_t wait_ns;	/* total time spent queued */
+	uint64_t max_wait_ns;
+	unsigned int depth;	/* queued now */
+	unsigned int max_depth;
+};
+
+/* Scheduler queues, see rtas_sched_get_stats() */
+struct rtas_sched_stats {
+	struct rtas_sched_class_stats calls[RTAS_SCHED_CLASSES];
+	struct rtas_sched_class_stats jobs[RTAS_SCHED_CLASSES];
+};
+
+/* What a call over its rate limit does, see rtas_set_rate_limit() */
+#define RTAS_RATE_BLOCK		0	/* wait its turn */
+#define RTAS_RATE_FAIL		1	/* fail with RTAS_THROTTLED */
+#define RTAS_RATE_COALESCE	2	/* share an identical call's result */
+
+struct rtas_rate_limit {
+	unsigned int rate;	/* calls per second, 0 for no limit */
+	unsigned int burst;	/* calls at once above the rate, default 1 */
+	int mode;		/* RTAS_RATE_* */
+};
+
+/* Throttling counters, see rtas_get_rate_limit_stats() */
+struct rtas_rate_limit_stats {
+	uint64_t calls;		/* let through to firmware */
+	uint64_t delayed;	/* had to wait their turn */
+	uint64_t delay_ns;	/* total time they waited */
+	uint64_t rejected;	/* failed with RTAS_THROTTLED */
+};
+
+/* Output formats of the dump interfaces */
+#define RTAS_DUMP_RAW	0	/* the dump as is */
+#define RTAS_DUMP_STORE	1	/* container, chunks not compressed */
+#define RTAS_DUMP_ZLIB	2	/* container, zlib chunks */
+#define RTAS_DUMP_ZSTD	3	/* container, zstd chunks */
+
+/* Progress of rtas_platform_dump_to_fd() and friends */
+struct rtas_dump_progress {
+	uint64_t bytes_read;	/* received from firmware */
+	uint64_t bytes_written;	/* written to the output */
+	uint64_t chunks;
+	uint64_t elapsed_ns;
+	uint64_t firmware_ns;	/* spent in firmware calls */
+	uint64_t write_ns;	/* spent writing the output */
+	uint64_t bytes_per_sec;	/* written, over the elapsed time */
+};
+
+/* State of a call started with one of the *_start() interfaces */
+struct rtas_continuation;
+
+/* RMO-resident work area, see rtas_workarea_alloc() */
+struct rtas_workarea;
+
+/* Sensors or indicators of one type, see rtas_get_index_table() */
+struct rtas_index_table {
+	int is_sensor;
+	int type;
+	size_t count;
+	const int *indices;		/* count entries */
+	const char *const *loc_codes;	/* count entries */
+};
+
+/* A sensor polled by a monitor, see rtas_monitor_add() */
+struct rtas_sensor_spec {
+	int sensor;			/* sensor token */
+	int index;			/* for get-sensor-state */
+	const char *loc_code;		/* for ibm,get-dynamic-sensor-state */
+	unsigned int interval_ms;	/* 0 for one second */
+};
+
+/* Latest reading of a polled sensor */
+struct rtas_sensor_reading {
+	int sensor;
+	int index;
+	const char *loc_code;	/* valid until rtas_monitor_destroy() */
+	int state;		/* of the last successful read */
+	int status;		/* result of the last read */
+	uint64_t timestamp_ns;	/* CLOCK_MONOTONIC time of the last read */
+	uint64_t reads;
+	uint64_t changes;	/* reads that changed state or status */
+};
+
+/* Sensor polling engine, see rtas_monitor_create() */
+struct rtas_monitor;
+
+struct rtas_monitor_config {
+	unsigned int workers;	/* reader threads, default 2 */
+	/* Called on a worker thread for every change, may be NULL */
+	void (*notify)(const struct rtas_sensor_reading *reading, void *arg);
+	void *arg;
+};
+
+/* ibm,configure-connector statuses */
+#define RTAS_CC_COMPLETE	0
+#define RTAS_CC_NEXT_SIBLING	1
+#define RTAS_CC_NEXT_CHILD	2
+#define RTAS_CC_NEXT_PROPERTY	3
+#define RTAS_CC_PREV_PARENT	4
+#define RTAS_CC_MORE_MEMORY	5
+
+/* Events of rtas_cfg_connector_parse() */
+#define RTAS_CC_NODE_BEGIN	1
+#define RTAS_CC_PROPERTY	2
+#define RTAS_CC_NODE_END	3
+
+struct rtas_cc_event {
+	int type;		/* RTAS_CC_NODE_BEGIN, _PROPERTY or _NODE_END */
+	unsigned int depth;	/* of the node, 0 for the connector's nodes */
+	const char *name;	/* node or property name, NULL for NODE_END */
+	const void *value;	/* property value */
+	uint32_t length;	/* of the property value */
+};
+
+/* Device tree built by rtas_cfg_connector_tree() */
+struct rtas_cc_property {
+	struct rtas_cc_property *next;
+	char *name;
+	void *value;
+	uint32_t length;
+};
+
+struct rtas_cc_node {
+	struct rtas_cc_node *parent;
+	struct rtas_cc_node *child;	/* first child */
+	struct rtas_cc_node *sibling;	/* next sibling */
+	char *name;
+	struct rtas_cc_property *properties;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int rtas_activate_firmware(void);
+int rtas_call_batch(struct rtas_batch_call *calls, size_t ncalls);
+void rtas_cancel(struct rtas_continuation *cont);
 int rtas_cfg_connector(char *workarea);
+int rtas_cfg_connector_start(struct rtas_continuation **cont,
+			     char *workarea, unsigned int *delay_ms);
+int rtas_cfg_connector_parse(struct rtas_workarea *wa, uint32_t drc_index,
+			     int (*event)(const struct rtas_cc_event *, void *),
+			     void *arg);
+int rtas_cfg_connector_tree(struct rtas_workarea *wa, uint32_t drc_index,
+			    struct rtas_cc_node **tree);
+void rtas_cfg_connector_tree_free(struct rtas_cc_node *tree);
+int rtas_cfg_connector_wa(struct rtas_workarea *wa);
+int rtas_context_free(struct rtas_context *ctx);
+int rtas_context_info(const struct rtas_context *ctx,
+		      struct rtas_context_info *info);
+int rtas_context_init(unsigned int flags, struct rtas_context **ctxp);
 int rtas_delay_timeout(uint64_t timeout_ms) __attribute__ ((deprecated));
 int rtas_display_char(char c);
 int rtas_display_msg(char *buf);
+int rtas_dump_codec_available(int codec);
+int rtas_dump_decompress(int in_fd, int out_fd);
 int rtas_errinjct(int etoken, int otoken, char *workarea);
 int rtas_errinjct_close(int otoken);
 int rtas_errinjct_open(int *otoken);
+int rtas_errinjct_wa(int etoken, int otoken, struct rtas_workarea *wa);
+int rtas_flush_index_cache(void);
+int rtas_flush_result_cache(void);
+int rtas_flush_token_cache(void);
 int rtas_free_rmo_buffer(void *buf, uint32_t phys_addr, size_t size);
+int rtas_get_busy_backoff(struct rtas_busy_backoff *policy);
+int rtas_get_busy_stats(struct rtas_busy_stats *stats, int reset);
 int rtas_get_config_addr_info2(uint32_t cfg_addr, uint64_t phb_id,
 			       uint32_t func, uint32_t *info);
 int rtas_get_dynamic_sensor(int sensor, void *loc_code, int *state);
 int rtas_get_indices(int is_sensor, int type, char *workarea,
 		     size_t size, int start, int *next);
+int rtas_get_index_table(int is_sensor, int type,
+			 const struct rtas_index_table **table);
+int rtas_get_indices_wa(int is_sensor, int type, struct rtas_workarea *wa,
+			size_t size, int start, int *next);
 int rtas_get_power_level(int powerdomain, int *level);
+int rtas_get_rate_limit_stats(const char *name,
+			      struct rtas_rate_limit_stats *stats, int reset);
 int rtas_get_rmo_buffer(size_t size, void **buf, uint32_t *phys_addr);
 int rtas_get_sensor(int sensor, int index, int *state);
+int rtas_get_stats(struct rtas_call_stats *calls, size_t *ncalls,
+		   struct rtas_rmo_stats *rmo);
 int rtas_get_sysparm(unsigned int parameter, unsigned int length, char *data);
 int rtas_get_time(uint32_t *year, uint32_t *month, uint32_t *day,
 		  uint32_t *hour, uint32_t *min, uint32_t *sec, uint32_t *nsec);
@@ -78,26 +329,87 @@ int rtas_get_vpd(char *loc_code, char *workarea, size_t size,
 int rtas_lpar_perftools(int subfunc, char *workarea,
 			unsigned int length, unsigned int sequence,
 			unsigned int *seq_next);
+int rtas_lpar_perftools_start(struct rtas_continuation **cont, int subfunc,
+			      char *workarea, unsigned int length,
+			      unsigned int sequence, unsigned int *seq_next,
+			      unsigned int *delay_ms);
+int rtas_monitor_add(struct rtas_monitor *mon,
+		     const struct rtas_sensor_spec *specs, size_t n);
+int rtas_monitor_add_type(struct rtas_monitor *mon, int type,
+			  unsigned int interval_ms);
+int rtas_monitor_changes(struct rtas_monitor *mon,
+			 struct rtas_sensor_reading *readings, size_t *n);
+int rtas_monitor_create(const struct rtas_monitor_config *config,
+			struct rtas_monitor **mon);
+int rtas_monitor_destroy(struct rtas_monitor *mon);
+int rtas_monitor_fd(const struct rtas_monitor *mon);
+int rtas_monitor_read(struct rtas_monitor *mon,
+		      struct rtas_sensor_reading *readings, size_t *n);
 int rtas_platform_dump(uint64_t dump_tag, uint64_t sequence,
 		       void *buffer, size_t length,
 		       uint64_t *next_seq, uint64_t *bytes_ret);
+int rtas_platform_dump_to_fd(uint64_t dump_tag, int fd, size_t chunk_size,
+			     int (*progress)(const struct rtas_dump_progress *,
+					     void *),
+			     void *arg, struct rtas_dump_progress *result);
+int rtas_platform_dump_compress(uint64_t dump_tag, int fd, int codec,
+				size_t chunk_size,
+				int (*progress)(const struct rtas_dump_progress *,
+						void *),
+				void *arg, struct rtas_dump_progress *result);
+int rtas_platform_dump_start(struct rtas_continuation **cont,
+			     uint64_t dump_tag, uint64_t sequence,
+			     void *buffer, size_t length, uint64_t *next_seq,
+			     uint64_t *bytes_ret, unsigned int *delay_ms);
+void rtas_put_index_table(const struct rtas_index_table *table);
 int rtas_read_slot_reset(uint32_t cfg_addr, uint64_t phbid, int *state, int *eeh);
+int rtas_reprobe_interface(void);
+int rtas_reset_stats(void);
+int rtas_resume(struct rtas_continuation *cont, unsigned int *delay_ms);
 int rtas_scan_log_dump(void *buffer, size_t length);
+int rtas_scan_log_dump_compress(int fd, size_t length, int codec,
+				struct rtas_dump_progress *result);
+int rtas_scan_log_dump_wa(struct rtas_workarea *wa, size_t length);
+int rtas_sched_get_stats(struct rtas_sched_stats *out, int reset);
+int rtas_sched_set_class(int class);
+int rtas_sched_start(const struct rtas_sched_config *config);
+int rtas_sched_stop(void);
+int rtas_sched_submit(int class, void (*fn)(void *), void *arg);
+int rtas_set_busy_backoff(const struct rtas_busy_backoff *policy);
+int rtas_set_cache_ttl(const char *name, unsigned int ttl_ms);
+int rtas_set_coalescing(int enable);
 int rtas_set_debug(int level);
 int rtas_set_dynamic_indicator(int indicator, int new_value, void *loc_code);
 int rtas_set_eeh_option(uint32_t cfg_addr, uint64_t phbid, int function);
+int rtas_set_idempotent(const char *name, int idempotent);
 int rtas_set_indicator(int indicator, int index, int new_value);
 int rtas_set_power_level(int powerdomain, int level, int *setlevel);
 int rtas_set_poweron_time(uint32_t year, uint32_t month, uint32_t day,
 			  uint32_t hour, uint32_t min, uint32_t sec, uint32_t nsec);
+int rtas_set_rate_limit(const char *name, const struct rtas_rate_limit *limit);
 int rtas_set_sysparm(unsigned int parameter, char *data);
 int rtas_set_time(uint32_t year, uint32_t month, uint32_t day,
 		  uint32_t hour, uint32_t min, uint32_t sec, uint32_t nsec);
+int rtas_set_trace(unsigned int nrecords);
 int rtas_suspend_me(uint64_t streamid);
+int rtas_trace_decode(int fd, FILE *out);
+int rtas_trace_dump(int fd);
+int rtas_trace_dump_on_crash(int fd);
 int rtas_update_nodes(char *workarea, unsigned int scope);
+int rtas_update_nodes_wa(struct rtas_workarea *wa, unsigned int scope);
+int rtas_use_shared_rmo_allocator(int enable);
 int rtas_update_properties(char *workarea, unsigned int scope);
+int rtas_update_properties_wa(struct rtas_workarea *wa, unsigned int scope);
+int rtas_workarea_alloc(size_t size, struct rtas_workarea **wa);
+void *rtas_workarea_buf(const struct rtas_workarea *wa);
+int rtas_workarea_free(struct rtas_workarea *wa);
+size_t rtas_workarea_size(const struct rtas_workarea *wa);
 int rtas_physical_attestation(char *workarea, int seq_num,
 			      int *next_seq_num, int *work_area_bytes);
+int rtas_physical_attestation_start(struct rtas_continuation **cont,
+				    char *workarea, int seq_num,
+				    int *next_seq_num, int *work_area_bytes,
+				    unsigned int *delay_ms);
 
 #ifdef __cplusplus
 }
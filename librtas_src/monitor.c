@@ -0,0 +1,570 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Sensor polling engine. Sensors are read by a small pool of worker
+// threads, each sensor at its own interval, in order of when it is next
+// due, so a slow sensor holds up one worker rather than the whole
+// scan. The latest readings live in a table shared with the
+// consumer, which is told about state changes through an eventfd and
+// an optional callback.
+
+#include <endian.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "internal.h"
+#include "librtas.h"
+
+#define MONITOR_WORKERS_DEFAULT 2
+#define MONITOR_WORKERS_MAX 64
+#define MONITOR_INTERVAL_DEFAULT 1000
+
+struct monitor_sensor {
+	struct rtas_sensor_reading reading;
+	void *loc_buf;		/* length prefixed location code, or NULL */
+	uint64_t interval_ns;
+	uint64_t due;
+	int changed;		/* not yet returned by rtas_monitor_changes() */
+};
+
+/*
+ * lock protects the sensor readings, the heap and stop. The heap holds
+ * the sensors not being read, ordered by when they are next due.
+ */
+struct rtas_monitor {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct monitor_sensor **sensors;
+	size_t nsensors;
+	size_t size;
+	struct monitor_sensor **heap;
+	size_t nheap;
+	int stop;
+	int efd;
+	pthread_t *workers;
+	unsigned int nworkers;
+	void (*notify)(const struct rtas_sensor_reading *, void *);
+	void *arg;
+};
+
+static void heap_swap(struct monitor_sensor **heap, size_t a, size_t b)
+{
+	struct monitor_sensor *t = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = t;
+}
+
+static void heap_push(struct rtas_monitor *mon, struct monitor_sensor *s)
+{
+	size_t i = mon->nheap++;
+
+	mon->heap[i] = s;
+	while (i && mon->heap[(i - 1) / 2]->due > mon->heap[i]->due) {
+		heap_swap(mon->heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static struct monitor_sensor *heap_pop(struct rtas_monitor *mon)
+{
+	struct monitor_sensor *top = mon->heap[0];
+	size_t i = 0, child;
+
+	mon->heap[0] = mon->heap[--mon->nheap];
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= mon->nheap)
+			break;
+		if (child + 1 < mon->nheap &&
+		    mon->heap[child + 1]->due < mon->heap[child]->due)
+			child++;
+		if (mon->heap[i]->due <= mon->heap[child]->due)
+			break;
+		heap_swap(mon->heap, i, child);
+		i = child;
+	}
+
+	return top;
+}
+
+/**
+ * monitor_signal
+ * @brief Make the eventfd readable
+ *
+ * @param mon
+ */
+static void monitor_signal(struct rtas_monitor *mon)
+{
+	uint64_t one = 1;
+
+	if (write(mon->efd, &one, sizeof(one)) < 0)
+		dbg("eventfd write failed, errno=%d\n", errno);
+}
+
+/**
+ * monitor_read
+ * @brief Read one sensor
+ *
+ * @param s
+ * @param state reference to the state
+ * @return as rtas_get_sensor()
+ */
+static int monitor_read(struct monitor_sensor *s, int *state)
+{
+	if (s->loc_buf)
+		return rtas_get_dynamic_sensor(s->reading.sensor, s->loc_buf,
+					       state);
+
+	return rtas_get_sensor(s->reading.sensor, s->reading.index, state);
+}
+
+/**
+ * monitor_update
+ * @brief Publish a reading
+ *
+ * The first reading of a sensor counts as a change, so that consumers
+ * learn the initial states from the notifications alone.
+ *
+ * @param s
+ * @param rc result of the read
+ * @param state
+ * @param when time of the read
+ * @return non-zero if the state or status changed
+ */
+static int monitor_update(struct monitor_sensor *s, int rc, int state,
+			  uint64_t when)
+{
+	struct rtas_sensor_reading *r = &s->reading;
+	int changed;
+
+	changed = !r->reads || rc != r->status ||
+		(rc == 0 && state != r->state);
+
+	r->status = rc;
+	if (rc == 0)
+		r->state = state;
+	r->timestamp_ns = when;
+	r->reads++;
+
+	if (changed) {
+		r->changes++;
+		s->changed = 1;
+	}
+
+	return changed;
+}
+
+/**
+ * monitor_worker
+ * @brief Worker thread, reads the sensors as they fall due
+ *
+ * @param arg monitor
+ * @return NULL
+ */
+static void *monitor_worker(void *arg)
+{
+	struct rtas_monitor *mon = arg;
+	struct rtas_sensor_reading snap;
+	struct monitor_sensor *s;
+	struct timespec ts;
+	uint64_t now;
+	int rc, changed, state = 0;
+
+	/* Sensor reads go ahead of bulk calls when calls are scheduled */
+	(void)rtas_sched_set_class(RTAS_SCHED_CRITICAL);
+
+	pthread_mutex_lock(&mon->lock);
+
+	while (!mon->stop) {
+		if (!mon->nheap) {
+			pthread_cond_wait(&mon->cond, &mon->lock);
+			continue;
+		}
+
+		now = stats_now();
+		if (mon->heap[0]->due > now) {
+			ts.tv_sec = mon->heap[0]->due / 1000000000;
+			ts.tv_nsec = mon->heap[0]->due % 1000000000;
+			pthread_cond_timedwait(&mon->cond, &mon->lock, &ts);
+			continue;
+		}
+
+		s = heap_pop(mon);
+		pthread_mutex_unlock(&mon->lock);
+
+		rc = monitor_read(s, &state);
+
+		pthread_mutex_lock(&mon->lock);
+		changed = monitor_update(s, rc, state, stats_now());
+		snap = s->reading;
+
+		s->due = now + s->interval_ns;
+		heap_push(mon, s);
+		pthread_cond_signal(&mon->cond);
+
+		if (changed) {
+			pthread_mutex_unlock(&mon->lock);
+			monitor_signal(mon);
+			if (mon->notify)
+				mon->notify(&snap, mon->arg);
+			pthread_mutex_lock(&mon->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&mon->lock);
+	return NULL;
+}
+
+/**
+ * rtas_monitor_create
+ * @brief Start a sensor polling engine
+ *
+ * The workers sleep until sensors are added with rtas_monitor_add()
+ * or rtas_monitor_add_type().
+ *
+ * @param config workers and change callback, may be NULL for the
+ *	defaults
+ * @param monp reference to the new monitor
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_monitor_create(const struct rtas_monitor_config *config,
+			struct rtas_monitor **monp)
+{
+	struct rtas_monitor *mon;
+	pthread_condattr_t attr;
+	unsigned int i, n;
+	int rc;
+
+	*monp = NULL;
+
+	n = config && config->workers ? config->workers :
+		MONITOR_WORKERS_DEFAULT;
+	if (n > MONITOR_WORKERS_MAX)
+		return RTAS_IO_ASSERT;
+
+	mon = calloc(1, sizeof(*mon));
+	if (!mon)
+		return RTAS_NO_MEM;
+
+	mon->workers = calloc(n, sizeof(*mon->workers));
+	mon->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!mon->workers || mon->efd < 0) {
+		rc = mon->workers ? RTAS_IO_ASSERT : RTAS_NO_MEM;
+		if (mon->efd >= 0)
+			close(mon->efd);
+		free(mon->workers);
+		free(mon);
+		return rc;
+	}
+
+	if (config) {
+		mon->notify = config->notify;
+		mon->arg = config->arg;
+	}
+
+	pthread_mutex_init(&mon->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mon->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&mon->workers[i], NULL, monitor_worker,
+				   mon))
+			break;
+		mon->nworkers++;
+	}
+
+	if (!mon->nworkers) {
+		(void)rtas_monitor_destroy(mon);
+		return RTAS_IO_ASSERT;
+	}
+
+	*monp = mon;
+	dbg("(%p) = 0, %u workers\n", config, mon->nworkers);
+	return 0;
+}
+
+/**
+ * sensor_new
+ * @brief Set up one sensor
+ *
+ * @param spec
+ * @param now
+ * @return new sensor, or NULL if out of memory
+ */
+static struct monitor_sensor *sensor_new(const struct rtas_sensor_spec *spec,
+					 uint64_t now)
+{
+	struct monitor_sensor *s;
+	uint32_t len = 0, be_len;
+	char *loc;
+
+	if (spec->loc_code)
+		len = strlen(spec->loc_code) + 1;
+
+	/* The location code is kept plain and length prefixed */
+	s = calloc(1, sizeof(*s) + (len ? 2 * len + sizeof(len) : 0));
+	if (!s)
+		return NULL;
+
+	s->reading.sensor = spec->sensor;
+	s->reading.index = spec->index;
+	s->interval_ns = (uint64_t)(spec->interval_ms ? spec->interval_ms :
+				    MONITOR_INTERVAL_DEFAULT) * 1000000;
+	s->due = now;
+
+	if (len) {
+		loc = (char *)(s + 1);
+		memcpy(loc, spec->loc_code, len);
+		s->reading.loc_code = loc;
+
+		s->loc_buf = loc + len;
+		be_len = htobe32(len);
+		memcpy(s->loc_buf, &be_len, sizeof(be_len));
+		memcpy((char *)s->loc_buf + sizeof(be_len), loc, len);
+	}
+
+	return s;
+}
+
+/**
+ * rtas_monitor_add
+ * @brief Add sensors to a monitor
+ *
+ * Sensors with a location code are read with
+ * ibm,get-dynamic-sensor-state, the others with get-sensor-state.
+ * Each is read right away and then every interval_ms.
+ *
+ * @param mon
+ * @param specs sensors to add
+ * @param n number of entries in specs
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_monitor_add(struct rtas_monitor *mon,
+		     const struct rtas_sensor_spec *specs, size_t n)
+{
+	struct monitor_sensor **sensors, **heap;
+	uint64_t now = stats_now();
+	size_t i, size;
+	int rc = 0;
+
+	pthread_mutex_lock(&mon->lock);
+
+	if (mon->nsensors + n > mon->size) {
+		size = mon->size ? mon->size : 64;
+		while (size < mon->nsensors + n)
+			size *= 2;
+
+		sensors = realloc(mon->sensors, size * sizeof(*sensors));
+		if (sensors)
+			mon->sensors = sensors;
+		heap = realloc(mon->heap, size * sizeof(*heap));
+		if (heap)
+			mon->heap = heap;
+		if (!sensors || !heap) {
+			rc = RTAS_NO_MEM;
+			goto out;
+		}
+		mon->size = size;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct monitor_sensor *s = sensor_new(&specs[i], now);
+
+		if (!s) {
+			rc = RTAS_NO_MEM;
+			break;
+		}
+
+		mon->sensors[mon->nsensors++] = s;
+		heap_push(mon, s);
+	}
+
+	pthread_cond_broadcast(&mon->cond);
+
+out:
+	pthread_mutex_unlock(&mon->lock);
+
+	dbg("(%p, %zu) = %d\n", mon, n, rc);
+	return rc;
+}
+
+/**
+ * rtas_monitor_add_type
+ * @brief Add every sensor of a type to a monitor
+ *
+ * The sensors are taken from rtas_get_index_table().
+ *
+ * @param mon
+ * @param type sensor type
+ * @param interval_ms read interval, 0 for the default of one second
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_monitor_add_type(struct rtas_monitor *mon, int type,
+			  unsigned int interval_ms)
+{
+	const struct rtas_index_table *table;
+	struct rtas_sensor_spec *specs;
+	size_t i;
+	int rc;
+
+	rc = rtas_get_index_table(1, type, &table);
+	if (rc)
+		return rc;
+
+	specs = calloc(table->count ? table->count : 1, sizeof(*specs));
+	if (!specs) {
+		rtas_put_index_table(table);
+		return RTAS_NO_MEM;
+	}
+
+	for (i = 0; i < table->count; i++) {
+		specs[i].sensor = type;
+		specs[i].index = table->indices[i];
+		specs[i].interval_ms = interval_ms;
+	}
+
+	rc = rtas_monitor_add(mon, specs, table->count);
+
+	free(specs);
+	rtas_put_index_table(table);
+	return rc;
+}
+
+/**
+ * rtas_monitor_read
+ * @brief Interface to the latest readings of all sensors
+ *
+ * Fills in up to *n readings, in the order the sensors were added, and
+ * sets *n to the number of sensors.
+ *
+ * @param mon
+ * @param readings array for the readings, may be NULL if *n is 0
+ * @param n reference to the array size, updated to the sensor count
+ * @return 0
+ */
+int rtas_monitor_read(struct rtas_monitor *mon,
+		      struct rtas_sensor_reading *readings, size_t *n)
+{
+	size_t i;
+
+	pthread_mutex_lock(&mon->lock);
+
+	for (i = 0; i < *n && i < mon->nsensors; i++)
+		readings[i] = mon->sensors[i]->reading;
+	*n = mon->nsensors;
+
+	pthread_mutex_unlock(&mon->lock);
+
+	return 0;
+}
+
+/**
+ * rtas_monitor_changes
+ * @brief Interface to the sensors that changed since the last call
+ *
+ * Returns the latest reading of each sensor whose state or status
+ * changed since it was last returned here. If there are more than fit,
+ * the rest are returned by the next call and the eventfd stays
+ * readable.
+ *
+ * @param mon
+ * @param readings array for the readings
+ * @param n reference to the array size, updated to the readings returned
+ * @return 0
+ */
+int rtas_monitor_changes(struct rtas_monitor *mon,
+			 struct rtas_sensor_reading *readings, size_t *n)
+{
+	struct monitor_sensor *s;
+	uint64_t count;
+	size_t i, found = 0;
+	int more = 0;
+
+	/* Drain first, so a change from here on leaves the fd readable */
+	if (read(mon->efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		dbg("eventfd read failed, errno=%d\n", errno);
+
+	pthread_mutex_lock(&mon->lock);
+
+	for (i = 0; i < mon->nsensors; i++) {
+		s = mon->sensors[i];
+		if (!s->changed)
+			continue;
+
+		if (found == *n) {
+			more = 1;
+			break;
+		}
+
+		readings[found++] = s->reading;
+		s->changed = 0;
+	}
+
+	pthread_mutex_unlock(&mon->lock);
+
+	if (more)
+		monitor_signal(mon);
+
+	*n = found;
+	return 0;
+}
+
+/**
+ * rtas_monitor_fd
+ * @brief File descriptor to wait on for sensor changes
+ *
+ * The eventfd becomes readable when a sensor changes, and is cleared
+ * by rtas_monitor_changes(). It is closed by rtas_monitor_destroy().
+ *
+ * @param mon
+ * @return file descriptor
+ */
+int rtas_monitor_fd(const struct rtas_monitor *mon)
+{
+	return mon->efd;
+}
+
+/**
+ * rtas_monitor_destroy
+ * @brief Stop the workers and free a monitor
+ *
+ * Reads in progress are completed first.
+ *
+ * @param mon may be NULL
+ * @return 0
+ */
+int rtas_monitor_destroy(struct rtas_monitor *mon)
+{
+	unsigned int i;
+	size_t j;
+
+	if (!mon)
+		return 0;
+
+	pthread_mutex_lock(&mon->lock);
+	mon->stop = 1;
+	pthread_cond_broadcast(&mon->cond);
+	pthread_mutex_unlock(&mon->lock);
+
+	for (i = 0; i < mon->nworkers; i++)
+		pthread_join(mon->workers[i], NULL);
+
+	for (j = 0; j < mon->nsensors; j++)
+		free(mon->sensors[j]);
+
+	pthread_cond_destroy(&mon->cond);
+	pthread_mutex_destroy(&mon->lock);
+	close(mon->efd);
+	free(mon->sensors);
+	free(mon->heap);
+	free(mon->workers);
+	free(mon);
+
+	return 0;
+}
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <endian.h>
 #include <byteswap.h>
+#include <pthread.h>
 #include "librtas.h"
 #include "internal.h"
 
@@ -43,7 +44,7 @@ static const char *ofdt_rtas_path = "/proc/device-tree/rtas";
 static int open_prop_file(const char *prop_path, const char *prop_name, int *fd)
 {
 	char *path;
-	int len;
+	int len, err;
 
 	/* allocate enough for two string, a slash and trailing NULL */
 	len = strlen(prop_path) + strlen(prop_name) + 1 + 1;
@@ -56,9 +57,11 @@ static int open_prop_file(const char *prop_path, const char *prop_name, int *fd)
 	snprintf(path, len, "%s/%s", prop_path, prop_name);
 
 	*fd = open(path, O_RDONLY);
+	err = errno;
 	free(path);
 	if (*fd < 0) {
-		errno = ENOSYS;
+		/* ENOENT if there is no such property */
+		errno = err;
 		return -1;
 	}
 
@@ -90,14 +93,44 @@ static int get_property(const char *prop_path, const char *prop_name,
 	return rc;
 }
 
+/*
+ * Tokens are looked up once per process and remembered, including names
+ * that have no property under /proc/device-tree/rtas. The cache is dropped
+ * when the device tree may have changed (migration, DLPAR updates).
+ */
+#define TOKEN_CACHE_BUCKETS 64
+
+struct token_entry {
+	struct token_entry *next;
+	int token;		/* RTAS_UNKNOWN_OP for missing calls */
+	char name[];
+};
+
+static struct token_entry *token_cache[TOKEN_CACHE_BUCKETS];
+static pthread_mutex_t token_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int token_hash(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+
+	return hash % TOKEN_CACHE_BUCKETS;
+}
+
 /**
- * rtas_token
- * @brief Retrive a rtas token for a given name
+ * native_read_token
+ * @brief Read a rtas token from the device tree
+ *
+ * errno is set to ENOENT if the device tree has no such call.
  *
  * @param call_name rtas name to retrieve token for
+ * @param token reference to token variable
  * @return 0 on success, !0 otherwise
  */
-int rtas_token(const char *call_name)
+__attribute__((visibility("hidden")))
+int native_read_token(const char *call_name, int *token)
 {
 	char *prop_buf = NULL;
 	size_t len;
@@ -108,17 +141,113 @@ int rtas_token(const char *call_name)
 		if (prop_buf)
 			free(prop_buf);
 
-		return RTAS_UNKNOWN_OP;
+		return rc;
 	}
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
-	rc = bswap_32(*(int *)prop_buf);
+	*token = bswap_32(*(int *)prop_buf);
 #else
-	rc = *(int *)prop_buf;
+	*token = *(int *)prop_buf;
 #endif
 	free(prop_buf);
 
-	return rc;
+	return 0;
+}
+
+/**
+ * rtas_token
+ * @brief Retrive a rtas token for a given name
+ *
+ * @param call_name rtas name to retrieve token for
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_token(const char *call_name)
+{
+	struct token_entry **bucket = &token_cache[token_hash(call_name)];
+	struct token_entry *entry;
+	size_t name_len;
+	int token;
+	int rc;
+
+	pthread_mutex_lock(&token_cache_lock);
+
+	for (entry = *bucket; entry; entry = entry->next) {
+		if (!strcmp(entry->name, call_name)) {
+			token = entry->token;
+			goto out;
+		}
+	}
+
+	rc = backend_get()->read_token(call_name, &token);
+	if (rc < 0) {
+		token = RTAS_UNKNOWN_OP;
+
+		/*
+		 * Only remember names that are really absent, not lookups
+		 * that failed for want of memory or permissions.
+		 */
+		if (errno != ENOENT)
+			goto out;
+	}
+
+	name_len = strlen(call_name) + 1;
+	entry = malloc(sizeof(*entry) + name_len);
+	if (entry) {
+		memcpy(entry->name, call_name, name_len);
+		entry->token = token;
+		entry->next = *bucket;
+		*bucket = entry;
+	}
+
+out:
+	pthread_mutex_unlock(&token_cache_lock);
+
+	return token;
+}
+
+/**
+ * token_cache_invalidate
+ * @brief Forget all cached rtas tokens
+ *
+ * Tokens are re-read from the device tree on their next use. Whatever
+ * changes the tokens can change the sensors and indicators too, so the
+ * index tables and cached results are dropped as well.
+ */
+__attribute__((visibility("hidden")))
+void token_cache_invalidate(void)
+{
+	struct token_entry *entry;
+	int i;
+
+	pthread_mutex_lock(&token_cache_lock);
+
+	for (i = 0; i < TOKEN_CACHE_BUCKETS; i++) {
+		while ((entry = token_cache[i]) != NULL) {
+			token_cache[i] = entry->next;
+			free(entry);
+		}
+	}
+
+	pthread_mutex_unlock(&token_cache_lock);
+
+	index_cache_invalidate();
+	result_cache_invalidate();
+}
+
+/**
+ * rtas_flush_token_cache
+ * @brief Interface to drop the cached rtas tokens
+ *
+ * Callers that change the device tree by other means than librtas
+ * (e.g. partition migration driven by the kernel) should call this so
+ * that tokens are looked up again.
+ *
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_flush_token_cache(void)
+{
+	token_cache_invalidate();
+	return 0;
 }
 
 #define BLOCK_SIZE 4096
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Static probes for perf, bpftrace and systemtap, in the librtas
+// provider. With sys/sdt.h each probe is a single nop until a tracer
+// attaches; without it they compile to nothing.
+
+#ifndef LIBRTAS_PROBES_H
+#define LIBRTAS_PROBES_H
+
+#ifdef LIBRTAS_SDT
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)			STAP_PROBE1(librtas, name, a)
+#define PROBE2(name, a, b)		STAP_PROBE2(librtas, name, a, b)
+#define PROBE3(name, a, b, c)		STAP_PROBE3(librtas, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	STAP_PROBE4(librtas, name, a, b, c, d)
+
+#else /* LIBRTAS_SDT */
+
+#define PROBE1(name, a)			do { (void)(a); } while (0)
+#define PROBE2(name, a, b)		do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c)		\
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d)	\
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+
+#endif /* LIBRTAS_SDT */
+
+#endif /* LIBRTAS_PROBES_H */
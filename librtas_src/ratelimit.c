@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Token bucket limits on how often a call reaches firmware. Each
+// limited call has a rate and a burst; a call over its limit either
+// waits its turn, fails with RTAS_THROTTLED, or shares the result of
+// an identical call already waiting or in flight. The bucket is kept
+// as the time the next call is due (GCRA), so a call reserves its turn
+// under the lock and sleeps, if it has to, outside it.
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "internal.h"
+#include "librtas.h"
+#include "probes.h"
+
+#define RATE_LIMITS_MAX 32
+#define RATE_NAME_MAX 64
+
+struct rate_limiter {
+	char name[RATE_NAME_MAX];
+	pthread_mutex_t lock;
+	int enabled;
+	int mode;
+	uint64_t interval_ns;	/* between calls at the rate */
+	uint64_t tolerance_ns;	/* how far ahead the burst may run */
+	uint64_t tat;		/* when the next call is due */
+	struct rtas_rate_limit_stats stats;
+};
+
+/* Limiters are only appended, under limits_lock */
+static struct rate_limiter limiters[RATE_LIMITS_MAX];
+static unsigned int nlimiters;
+static unsigned int nlimiters_enabled;
+static pthread_mutex_t limits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct rate_limiter *limiter_find(const char *name)
+{
+	unsigned int i, n;
+
+	n = __atomic_load_n(&nlimiters, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; i++) {
+		if (!strcmp(limiters[i].name, name))
+			return &limiters[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * rate_limiter_get
+ * @brief Limiter of a call
+ *
+ * @param name call name
+ * @return limiter, or NULL if the call is not limited
+ */
+__attribute__((visibility("hidden")))
+struct rate_limiter *rate_limiter_get(const char *name)
+{
+	struct rate_limiter *rl;
+
+	if (!__atomic_load_n(&nlimiters_enabled, __ATOMIC_RELAXED))
+		return NULL;
+
+	rl = limiter_find(name);
+	if (!rl || !__atomic_load_n(&rl->enabled, __ATOMIC_RELAXED))
+		return NULL;
+
+	return rl;
+}
+
+/**
+ * rate_limiter_get_token
+ * @brief Limiter of a call known only by its token
+ *
+ * @param token rtas token
+ * @return limiter, or NULL if the call is not limited
+ */
+__attribute__((visibility("hidden")))
+struct rate_limiter *rate_limiter_get_token(int token)
+{
+	unsigned int i, n;
+
+	if (!__atomic_load_n(&nlimiters_enabled, __ATOMIC_RELAXED))
+		return NULL;
+
+	n = __atomic_load_n(&nlimiters, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n; i++) {
+		if (__atomic_load_n(&limiters[i].enabled, __ATOMIC_RELAXED) &&
+		    rtas_token(limiters[i].name) == token)
+			return &limiters[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * rate_limit_coalesces
+ * @brief Should calls over the limit share results?
+ *
+ * @param rl limiter, may be NULL
+ * @return non-zero for RTAS_RATE_COALESCE
+ */
+__attribute__((visibility("hidden")))
+int rate_limit_coalesces(struct rate_limiter *rl)
+{
+	return rl && __atomic_load_n(&rl->mode, __ATOMIC_RELAXED) ==
+		RTAS_RATE_COALESCE;
+}
+
+/**
+ * rate_limit_take
+ * @brief Wait for the call's turn under its limit
+ *
+ * @param rl limiter
+ * @return 0 when the call may go ahead, !0 otherwise
+ *	RTAS_THROTTLED - Over the limit, and the limit fails fast
+ */
+__attribute__((visibility("hidden")))
+int rate_limit_take(struct rate_limiter *rl)
+{
+	uint64_t now = stats_now(), due, wait = 0;
+	struct timespec ts;
+
+	pthread_mutex_lock(&rl->lock);
+
+	due = rl->tat > now ? rl->tat : now;
+	if (due - now > rl->tolerance_ns)
+		wait = due - now - rl->tolerance_ns;
+
+	if (wait && rl->mode == RTAS_RATE_FAIL) {
+		rl->stats.rejected++;
+		pthread_mutex_unlock(&rl->lock);
+		PROBE2(call__throttled, rl->name, 0);
+		return RTAS_THROTTLED;
+	}
+
+	rl->tat = due + rl->interval_ns;
+	rl->stats.calls++;
+	if (wait) {
+		rl->stats.delayed++;
+		rl->stats.delay_ns += wait;
+	}
+
+	pthread_mutex_unlock(&rl->lock);
+
+	if (wait) {
+		PROBE2(call__throttled, rl->name, wait);
+		ts.tv_sec = wait / 1000000000ull;
+		ts.tv_nsec = wait % 1000000000ull;
+		while (nanosleep(&ts, &ts))
+			;
+	}
+
+	return 0;
+}
+
+/**
+ * rtas_set_rate_limit
+ * @brief Interface to limit how often a call reaches firmware
+ *
+ * Calls are let through at up to limit->rate per second, with bursts
+ * of up to limit->burst. Over the limit, limit->mode decides:
+ *	RTAS_RATE_BLOCK - the call waits its turn
+ *	RTAS_RATE_FAIL - the call fails with RTAS_THROTTLED
+ *	RTAS_RATE_COALESCE - the call shares the result of an identical
+ *		call (same inputs) waiting or in flight, and waits its turn
+ *		if there is none
+ *
+ * @param name call name
+ * @param limit new limit, NULL or a rate of 0 to remove the limit
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Bad limit, name too long or too many calls limited
+ */
+int rtas_set_rate_limit(const char *name, const struct rtas_rate_limit *limit)
+{
+	int enable = limit && limit->rate;
+	struct rate_limiter *rl;
+	unsigned int burst;
+	int rc = 0;
+
+	if (strlen(name) >= RATE_NAME_MAX)
+		return RTAS_IO_ASSERT;
+
+	if (enable && (limit->mode < RTAS_RATE_BLOCK ||
+		       limit->mode > RTAS_RATE_COALESCE))
+		return RTAS_IO_ASSERT;
+
+	pthread_mutex_lock(&limits_lock);
+
+	rl = limiter_find(name);
+	if (!rl) {
+		if (!enable)
+			goto out;
+
+		if (nlimiters == RATE_LIMITS_MAX) {
+			rc = RTAS_IO_ASSERT;
+			goto out;
+		}
+
+		rl = &limiters[nlimiters];
+		strcpy(rl->name, name);
+		pthread_mutex_init(&rl->lock, NULL);
+		__atomic_store_n(&nlimiters, nlimiters + 1, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_lock(&rl->lock);
+
+	if (enable) {
+		burst = limit->burst ? limit->burst : 1;
+		rl->interval_ns = 1000000000ull / limit->rate;
+		rl->tolerance_ns = rl->interval_ns * (burst - 1);
+		rl->tat = 0;
+		__atomic_store_n(&rl->mode, limit->mode, __ATOMIC_RELAXED);
+	}
+
+	if (enable != rl->enabled) {
+		__atomic_store_n(&rl->enabled, enable, __ATOMIC_RELAXED);
+		if (enable)
+			__atomic_add_fetch(&nlimiters_enabled, 1,
+					   __ATOMIC_RELAXED);
+		else
+			__atomic_sub_fetch(&nlimiters_enabled, 1,
+					   __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&rl->lock);
+
+out:
+	pthread_mutex_unlock(&limits_lock);
+
+	dbg("(%s, %u) = %d\n", name, enable ? limit->rate : 0, rc);
+	return rc;
+}
+
+/**
+ * rtas_get_rate_limit_stats
+ * @brief Interface to the throttling counters of a limited call
+ *
+ * @param name call name
+ * @param stats reference to the counters to fill in
+ * @param reset non-zero to clear the counters after reading them
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - The call was never limited
+ */
+int rtas_get_rate_limit_stats(const char *name,
+			      struct rtas_rate_limit_stats *stats, int reset)
+{
+	struct rate_limiter *rl = limiter_find(name);
+
+	if (!rl)
+		return RTAS_IO_ASSERT;
+
+	pthread_mutex_lock(&rl->lock);
+
+	*stats = rl->stats;
+	if (reset)
+		memset(&rl->stats, 0, sizeof(rl->stats));
+
+	pthread_mutex_unlock(&rl->lock);
+	return 0;
+}
@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Simulated firmware, see sim.c. Only built into librtas_sim.la, the
+// test build of librtas that the simulator tests and benchmarks link
+// against; it is not part of the installed library or its ABI.
+
+#ifndef LIBRTAS_SIM_H
+#define LIBRTAS_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Token of a simulated RTAS call, see rtas_sim_enable() */
+struct rtas_sim_token {
+	const char *name;
+	int token;
+};
+
+/* Value of a simulated system parameter */
+struct rtas_sim_sysparm {
+	unsigned int parameter;
+	const void *data;
+	uint16_t length;
+};
+
+/* State of a simulated sensor, see get-sensor-state */
+struct rtas_sim_sensor {
+	int sensor;
+	int index;
+	int state;
+};
+
+/* A simulated sensor or indicator, see ibm,get-indices */
+struct rtas_sim_index {
+	int is_sensor;
+	int type;
+	int index;
+	const char *loc_code;
+};
+
+/* One simulated ibm,configure-connector return */
+struct rtas_sim_cc_entry {
+	int status;		/* RTAS_CC_NEXT_* */
+	const char *name;	/* node or property name */
+	const void *value;	/* property value */
+	uint32_t length;
+};
+
+/*
+ * Simulated firmware, see rtas_sim_enable(). Zeroed fields select the
+ * defaults. Pointers must stay valid while the simulator is enabled.
+ */
+struct rtas_sim_config {
+	const struct rtas_sim_token *tokens;	/* NULL for all librtas calls */
+	size_t ntokens;
+	unsigned int latency_us;	/* time spent in each call */
+	unsigned int busy_every;	/* every Nth call returns RC_BUSY */
+	unsigned int delay_every;	/* every Nth call returns delay_status */
+	int delay_status;		/* EXTENDED_DELAY_MIN..MAX */
+	const void *vpd;		/* ibm,get-vpd data, any location code */
+	size_t vpd_length;
+	const struct rtas_sim_sysparm *sysparms;
+	size_t nsysparms;
+	const void *dump;		/* ibm,platform-dump and scan-log data */
+	size_t dump_length;
+	const struct rtas_sim_cc_entry *connector; /* configure-connector */
+	size_t nconnector;
+	unsigned int connector_extents;	/* extents asked for per connector */
+	const struct rtas_sim_index *indices;	/* ibm,get-indices */
+	size_t nindices;
+	const struct rtas_sim_sensor *sensors;	/* others read as 0 */
+	size_t nsensors;
+	size_t rmo_pages;		/* RMO region size, default 64 */
+	int chardevs;			/* provide /dev/papr-vpd, papr-sysparm */
+};
+
+/* Requests seen by the simulated firmware, see rtas_sim_get_stats() */
+struct rtas_sim_stats {
+	uint64_t syscalls;	/* rtas system calls */
+	uint64_t opens;		/* chardev opens */
+	uint64_t ioctls;	/* chardev ioctls */
+	uint64_t busy;		/* injected RC_BUSY returns */
+	uint64_t delays;	/* injected extended delays */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rtas_sim_disable(void);
+int rtas_sim_enable(const struct rtas_sim_config *config);
+int rtas_sim_get_stats(struct rtas_sim_stats *stats, int reset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBRTAS_SIM_H */
@@ -0,0 +1,456 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Priority scheduling of firmware calls. The kernel serializes RTAS
+// calls in arrival order, so a stream of bulk calls (platform dump
+// chunks, configure-connector steps) delays a sensor read queued
+// behind them. With the scheduler started, each firmware call first
+// takes a slot here, and waiting calls get slots by class: critical,
+// then interactive, then bulk, first come first served within a class.
+// A waiter moves up one class for every aging period it waits, so bulk
+// calls are never starved. Work can also be queued to a small worker
+// pool, which runs it in order of the same classes.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "librtas.h"
+#include "probes.h"
+
+#define SCHED_WORKERS_DEFAULT 2
+#define SCHED_WORKERS_MAX 64
+#define SCHED_SLOTS_DEFAULT 1
+#define SCHED_AGING_DEFAULT 100
+
+struct sched_node {
+	struct sched_node *next;
+	uint64_t enqueued;
+	int class;
+};
+
+struct sched_queues {
+	struct sched_node *head[RTAS_SCHED_CLASSES];
+	struct sched_node *tail[RTAS_SCHED_CLASSES];
+	struct rtas_sched_class_stats *stats;
+};
+
+/* A thread waiting for a slot */
+struct sched_waiter {
+	struct sched_node node;
+	pthread_cond_t cond;
+	int granted;
+};
+
+/* Work queued by rtas_sched_submit() */
+struct sched_job {
+	struct sched_node node;
+	void (*fn)(void *);
+	void *arg;
+};
+
+/*
+ * sched_lock protects everything below but active, which is only
+ * written under it. lifecycle_lock serializes start and stop.
+ */
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t lifecycle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static int active;
+static int stopping;
+static unsigned int slots;
+static unsigned int busy;
+static uint64_t aging_ns;
+static struct rtas_sched_stats stats;
+static struct sched_queues calls = { .stats = stats.calls };
+static struct sched_queues jobs = { .stats = stats.jobs };
+static pthread_t *workers;
+static unsigned int nworkers;
+
+static __thread int thread_class = RTAS_SCHED_INTERACTIVE;
+
+static void queue_push(struct sched_queues *q, struct sched_node *node,
+		       int class)
+{
+	struct rtas_sched_class_stats *cs = &q->stats[class];
+
+	node->next = NULL;
+	node->class = class;
+	node->enqueued = stats_now();
+
+	if (q->tail[class])
+		q->tail[class]->next = node;
+	else
+		q->head[class] = node;
+	q->tail[class] = node;
+
+	if (++cs->depth > cs->max_depth)
+		cs->max_depth = cs->depth;
+}
+
+/**
+ * queue_pop
+ * @brief Take the next node to run
+ *
+ * The head of each class is ranked by its class less one for every
+ * aging period it has waited; the best rank wins, and the one waiting
+ * longest breaks a tie.
+ *
+ * @param q
+ * @return node, or NULL if all classes are empty
+ */
+static struct sched_node *queue_pop(struct sched_queues *q)
+{
+	uint64_t now = stats_now(), waited;
+	struct rtas_sched_class_stats *cs;
+	struct sched_node *node, *best = NULL;
+	int64_t rank, best_rank = 0;
+	int class;
+
+	for (class = 0; class < RTAS_SCHED_CLASSES; class++) {
+		node = q->head[class];
+		if (!node)
+			continue;
+
+		rank = class - (int64_t)((now - node->enqueued) / aging_ns);
+		if (!best || rank < best_rank ||
+		    (rank == best_rank && node->enqueued < best->enqueued)) {
+			best = node;
+			best_rank = rank;
+		}
+	}
+
+	if (!best)
+		return NULL;
+
+	class = best->class;
+	q->head[class] = best->next;
+	if (!q->head[class])
+		q->tail[class] = NULL;
+
+	waited = now - best->enqueued;
+	cs = &q->stats[class];
+	cs->depth--;
+	cs->dispatched++;
+	cs->wait_ns += waited;
+	if (waited > cs->max_wait_ns)
+		cs->max_wait_ns = waited;
+	if (best_rank < class)
+		cs->aged++;
+
+	return best;
+}
+
+/* Hand free slots to waiting calls */
+static void sched_grant(void)
+{
+	struct sched_waiter *w;
+
+	while (busy < slots) {
+		w = (struct sched_waiter *)queue_pop(&calls);
+		if (!w)
+			break;
+
+		w->granted = 1;
+		busy++;
+		pthread_cond_signal(&w->cond);
+	}
+}
+
+/**
+ * sched_enter
+ * @brief Wait for a slot to call firmware in
+ *
+ * @return 1 if a slot was taken and must be given back with
+ *	sched_exit(), 0 if the scheduler is not running
+ */
+__attribute__((visibility("hidden")))
+int sched_enter(void)
+{
+	struct sched_waiter w;
+	int class = thread_class;
+	int i, queued = 0;
+
+	if (!__atomic_load_n(&active, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&sched_lock);
+
+	if (!active) {
+		pthread_mutex_unlock(&sched_lock);
+		return 0;
+	}
+
+	for (i = 0; i < RTAS_SCHED_CLASSES; i++)
+		queued |= calls.head[i] != NULL;
+
+	if (busy < slots && !queued) {
+		busy++;
+		stats.calls[class].dispatched++;
+		pthread_mutex_unlock(&sched_lock);
+		return 1;
+	}
+
+	w.granted = 0;
+	pthread_cond_init(&w.cond, NULL);
+	queue_push(&calls, &w.node, class);
+
+	while (!w.granted)
+		pthread_cond_wait(&w.cond, &sched_lock);
+
+	pthread_mutex_unlock(&sched_lock);
+	pthread_cond_destroy(&w.cond);
+
+	PROBE2(sched__dispatch, class, stats_now() - w.node.enqueued);
+
+	/* Released by rtas_sched_stop() rather than given a slot */
+	return w.granted == 1;
+}
+
+/**
+ * sched_exit
+ * @brief Give back a slot taken by sched_enter()
+ */
+__attribute__((visibility("hidden")))
+void sched_exit(void)
+{
+	pthread_mutex_lock(&sched_lock);
+	busy--;
+	sched_grant();
+	pthread_mutex_unlock(&sched_lock);
+}
+
+static void *sched_worker(void *arg)
+{
+	struct sched_job *job;
+
+	pthread_mutex_lock(&sched_lock);
+
+	for (;;) {
+		job = (struct sched_job *)queue_pop(&jobs);
+		if (!job) {
+			if (stopping)
+				break;
+			pthread_cond_wait(&jobs_cond, &sched_lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&sched_lock);
+
+		/* Firmware calls made by the job wait in its class */
+		thread_class = job->node.class;
+		job->fn(job->arg);
+		free(job);
+
+		pthread_mutex_lock(&sched_lock);
+	}
+
+	pthread_mutex_unlock(&sched_lock);
+	return NULL;
+}
+
+/**
+ * rtas_sched_start
+ * @brief Interface to start scheduling firmware calls by priority
+ *
+ * Until rtas_sched_stop(), every firmware call waits for one of a
+ * fixed number of slots, handed out by the class set with
+ * rtas_sched_set_class(), and rtas_sched_submit() runs work on a pool
+ * of worker threads.
+ *
+ * @param config slots, workers and aging period, may be NULL for the
+ *	defaults
+ * @return 0 on success, !0 otherwise
+ *	RTAS_NO_MEM - Out of heap memory
+ *	RTAS_IO_ASSERT - Already started, bad configuration or no threads
+ */
+int rtas_sched_start(const struct rtas_sched_config *config)
+{
+	unsigned int n, i;
+	int rc = 0;
+
+	n = config && config->workers ? config->workers :
+		SCHED_WORKERS_DEFAULT;
+	if (n > SCHED_WORKERS_MAX)
+		return RTAS_IO_ASSERT;
+
+	pthread_mutex_lock(&lifecycle_lock);
+
+	if (__atomic_load_n(&active, __ATOMIC_RELAXED)) {
+		rc = RTAS_IO_ASSERT;
+		goto out;
+	}
+
+	workers = calloc(n, sizeof(*workers));
+	if (!workers) {
+		rc = RTAS_NO_MEM;
+		goto out;
+	}
+
+	pthread_mutex_lock(&sched_lock);
+	slots = config && config->slots ? config->slots : SCHED_SLOTS_DEFAULT;
+	aging_ns = (config && config->aging_ms ? config->aging_ms :
+		    SCHED_AGING_DEFAULT) * 1000000ull;
+	stopping = 0;
+	pthread_mutex_unlock(&sched_lock);
+
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&workers[i], NULL, sched_worker, NULL))
+			break;
+		nworkers++;
+	}
+
+	if (!nworkers) {
+		free(workers);
+		workers = NULL;
+		rc = RTAS_IO_ASSERT;
+		goto out;
+	}
+
+	pthread_mutex_lock(&sched_lock);
+	__atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&sched_lock);
+
+out:
+	pthread_mutex_unlock(&lifecycle_lock);
+	dbg("(%p) = %d, %u workers\n", config, rc, nworkers);
+	return rc;
+}
+
+/**
+ * rtas_sched_stop
+ * @brief Interface to stop scheduling firmware calls
+ *
+ * Work already submitted is run first. Calls waiting for a slot go
+ * ahead unscheduled.
+ *
+ * @return 0
+ */
+int rtas_sched_stop(void)
+{
+	struct sched_waiter *w;
+	unsigned int i;
+
+	pthread_mutex_lock(&lifecycle_lock);
+
+	if (!__atomic_load_n(&active, __ATOMIC_RELAXED))
+		goto out;
+
+	pthread_mutex_lock(&sched_lock);
+	stopping = 1;
+	pthread_cond_broadcast(&jobs_cond);
+	pthread_mutex_unlock(&sched_lock);
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	workers = NULL;
+	nworkers = 0;
+
+	pthread_mutex_lock(&sched_lock);
+	__atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+	while ((w = (struct sched_waiter *)queue_pop(&calls)) != NULL) {
+		w->granted = 2;
+		pthread_cond_signal(&w->cond);
+	}
+	pthread_mutex_unlock(&sched_lock);
+
+out:
+	pthread_mutex_unlock(&lifecycle_lock);
+	return 0;
+}
+
+/**
+ * rtas_sched_set_class
+ * @brief Interface to set the class of the calling thread's calls
+ *
+ * Threads start in RTAS_SCHED_INTERACTIVE.
+ *
+ * @param class RTAS_SCHED_CRITICAL, RTAS_SCHED_INTERACTIVE or
+ *	RTAS_SCHED_BULK
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Unknown class
+ */
+int rtas_sched_set_class(int class)
+{
+	if (class < 0 || class >= RTAS_SCHED_CLASSES)
+		return RTAS_IO_ASSERT;
+
+	thread_class = class;
+	return 0;
+}
+
+/**
+ * rtas_sched_submit
+ * @brief Interface to run work on the scheduler's worker pool
+ *
+ * Queued work is run in order of class, with the same aging as calls,
+ * and the firmware calls it makes are scheduled in its class.
+ *
+ * @param class RTAS_SCHED_* class of the work
+ * @param fn function to run
+ * @param arg passed to fn
+ * @return 0 on success, !0 otherwise
+ *	RTAS_NO_MEM - Out of heap memory
+ *	RTAS_IO_ASSERT - Unknown class, or the scheduler is not running
+ */
+int rtas_sched_submit(int class, void (*fn)(void *), void *arg)
+{
+	struct sched_job *job;
+
+	if (class < 0 || class >= RTAS_SCHED_CLASSES)
+		return RTAS_IO_ASSERT;
+
+	job = malloc(sizeof(*job));
+	if (!job)
+		return RTAS_NO_MEM;
+
+	job->fn = fn;
+	job->arg = arg;
+
+	pthread_mutex_lock(&sched_lock);
+
+	if (!active || stopping) {
+		pthread_mutex_unlock(&sched_lock);
+		free(job);
+		return RTAS_IO_ASSERT;
+	}
+
+	queue_push(&jobs, &job->node, class);
+	pthread_cond_signal(&jobs_cond);
+
+	pthread_mutex_unlock(&sched_lock);
+	return 0;
+}
+
+/**
+ * rtas_sched_get_stats
+ * @brief Interface to the scheduler's queue depths and wait times
+ *
+ * @param out reference to the stats to fill in
+ * @param reset non-zero to clear the counters after reading them
+ * @return 0
+ */
+int rtas_sched_get_stats(struct rtas_sched_stats *out, int reset)
+{
+	struct rtas_sched_class_stats *cs;
+	int i;
+
+	pthread_mutex_lock(&sched_lock);
+
+	*out = stats;
+
+	if (reset) {
+		for (i = 0; i < 2 * RTAS_SCHED_CLASSES; i++) {
+			cs = i < RTAS_SCHED_CLASSES ? &stats.calls[i] :
+				&stats.jobs[i - RTAS_SCHED_CLASSES];
+			cs->dispatched = 0;
+			cs->aged = 0;
+			cs->wait_ns = 0;
+			cs->max_wait_ns = 0;
+			cs->max_depth = cs->depth;
+		}
+	}
+
+	pthread_mutex_unlock(&sched_lock);
+	return 0;
+}
@@ -0,0 +1,821 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Simulated firmware, for running and benchmarking librtas where there
+// is no RTAS. Calls are served in-process from a token table and
+// scripted payloads, with a configurable latency and injected RC_BUSY
+// and extended delay statuses. Like the kernel, the simulator runs one
+// call at a time.
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "internal.h"
+#include "librtas.h"
+#include "papr-sysparm.h"
+#include "papr-vpd.h"
+#include "rtas_sim.h"
+
+#define SIM_RMO_ADDR 0x10000000
+#define SIM_RMO_PAGES 64
+
+/* PAPR statuses returned by the simulated calls */
+#define SIM_PARAM_ERROR -3
+#define SIM_CONTINUE 1
+
+static const struct rtas_sim_token sim_default_tokens[] = {
+	{ "display-character", 1 },
+	{ "get-power-level", 2 },
+	{ "get-sensor-state", 3 },
+	{ "get-time-of-day", 4 },
+	{ "ibm,activate-firmware", 5 },
+	{ "ibm,close-errinjct", 6 },
+	{ "ibm,configure-connector", 7 },
+	{ "ibm,display-message", 8 },
+	{ "ibm,errinjct", 9 },
+	{ "ibm,get-config-addr-info2", 10 },
+	{ "ibm,get-dynamic-sensor-state", 11 },
+	{ "ibm,get-indices", 12 },
+	{ "ibm,get-system-parameter", 13 },
+	{ "ibm,get-vpd", 14 },
+	{ "ibm,lpar-perftools", 15 },
+	{ "ibm,open-errinjct", 16 },
+	{ "ibm,physical-attestation", 17 },
+	{ "ibm,platform-dump", 18 },
+	{ "ibm,read-slot-reset-state", 19 },
+	{ "ibm,scan-log-dump", 20 },
+	{ "ibm,set-dynamic-indicator", 21 },
+	{ "ibm,set-eeh-option", 22 },
+	{ "ibm,set-system-parameter", 23 },
+	{ "ibm,suspend-me", 24 },
+	{ "ibm,update-nodes", 25 },
+	{ "ibm,update-properties", 26 },
+	{ "set-indicator", 27 },
+	{ "set-power-level", 28 },
+	{ "set-time-for-power-on", 29 },
+	{ "set-time-of-day", 30 },
+};
+
+/*
+ * sim_lock serializes calls and configuration changes. The RMO fields
+ * are only changed through the allocator, which maps and unmaps the
+ * region while no work areas are in use.
+ */
+struct sim_state {
+	struct rtas_sim_config config;
+	struct rtas_sim_stats stats;
+	uint64_t calls;
+	char *rmo;
+	uint64_t rmo_addr;
+	size_t rmo_size;
+	size_t cc_pos;			/* next configure-connector entry */
+	unsigned int cc_extents;	/* extents received */
+	uint32_t cc_extent_pa;		/* last extent received */
+};
+
+static struct sim_state sim;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char sim_vpd_devpath[] = "/dev/papr-vpd";
+static const char sim_sysparm_devpath[] = "/dev/papr-sysparm";
+
+/**
+ * sim_token_name
+ * @brief Look up the name of a simulated token
+ *
+ * @param token
+ * @return call name, or NULL if the token is not simulated
+ */
+static const char *sim_token_name(int token)
+{
+	size_t i;
+
+	for (i = 0; i < sim.config.ntokens; i++) {
+		if (sim.config.tokens[i].token == token)
+			return sim.config.tokens[i].name;
+	}
+
+	return NULL;
+}
+
+/**
+ * sim_buffer
+ * @brief Translate a work area physical address
+ *
+ * @param pa big endian physical address passed to the call
+ * @param len length of the work area
+ * @return mapping of the work area, or NULL if it is not in the region
+ */
+static char *sim_buffer(rtas_arg_t pa, size_t len)
+{
+	uint64_t addr = be32toh(pa);
+
+	if (!sim.rmo || addr < sim.rmo_addr ||
+	    addr - sim.rmo_addr + len > sim.rmo_size)
+		return NULL;
+
+	return sim.rmo + (addr - sim.rmo_addr);
+}
+
+/**
+ * sim_spin
+ * @brief Keep the cpu busy for the configured call latency
+ *
+ * Firmware runs on the calling cpu, so the time is spun rather than
+ * slept.
+ */
+static void sim_spin(void)
+{
+	struct timespec start, now;
+	uint64_t ns = sim.config.latency_us * 1000ull;
+
+	if (!ns)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((uint64_t)(now.tv_sec - start.tv_sec) * 1000000000ull +
+		 now.tv_nsec - start.tv_nsec < ns);
+}
+
+/**
+ * sim_chunk
+ * @brief Copy the next chunk of a payload into a work area
+ *
+ * @param data payload
+ * @param length payload length
+ * @param offset start of the chunk in the payload
+ * @param buf work area
+ * @param size work area size
+ * @param copied reference to the chunk length
+ * @return SIM_CONTINUE if more data follows, 0 otherwise
+ */
+static int sim_chunk(const void *data, size_t length, uint64_t offset,
+		     char *buf, size_t size, size_t *copied)
+{
+	size_t n = 0;
+
+	if (offset < length) {
+		n = length - offset;
+		if (n > size)
+			n = size;
+		memcpy(buf, (const char *)data + offset, n);
+	}
+
+	*copied = n;
+	return offset + n < length ? SIM_CONTINUE : 0;
+}
+
+/*
+ * ibm,get-vpd: the sequence number is one past the offset of the next
+ * chunk in the VPD payload.
+ */
+static int sim_get_vpd(const rtas_arg_t *in, rtas_arg_t *out, int nret)
+{
+	uint32_t size = be32toh(in[2]);
+	uint32_t sequence = be32toh(in[3]);
+	size_t copied;
+	char *buf;
+	int status;
+
+	buf = sim_buffer(in[1], size);
+	if (!buf || !sim_buffer(in[0], 1) || !sequence || nret < 3)
+		return SIM_PARAM_ERROR;
+
+	status = sim_chunk(sim.config.vpd, sim.config.vpd_length,
+			   sequence - 1, buf, size, &copied);
+	out[1] = htobe32(status ? sequence + copied : 1);
+	out[2] = htobe32(copied);
+
+	return status;
+}
+
+static const struct rtas_sim_sysparm *sim_sysparm(unsigned int parameter)
+{
+	size_t i;
+
+	for (i = 0; i < sim.config.nsysparms; i++) {
+		if (sim.config.sysparms[i].parameter == parameter)
+			return &sim.config.sysparms[i];
+	}
+
+	return NULL;
+}
+
+/* ibm,get-system-parameter: a length prefixed value */
+static int sim_get_sysparm(const rtas_arg_t *in)
+{
+	const struct rtas_sim_sysparm *param = sim_sysparm(be32toh(in[0]));
+	uint32_t length = be32toh(in[2]);
+	uint16_t value_len;
+	char *buf;
+
+	buf = sim_buffer(in[1], length);
+	if (!buf || length < sizeof(value_len))
+		return SIM_PARAM_ERROR;
+
+	if (!param)
+		return SIM_PARAM_ERROR;
+
+	value_len = htobe16(param->length);
+	memcpy(buf, &value_len, sizeof(value_len));
+	length -= sizeof(value_len);
+	memcpy(buf + sizeof(value_len), param->data,
+	       param->length < length ? param->length : length);
+
+	return 0;
+}
+
+/* ibm,platform-dump: the sequence number is the offset in the dump */
+static int sim_platform_dump(const rtas_arg_t *in, rtas_arg_t *out, int nret)
+{
+	uint64_t sequence = BITS64(be32toh(in[2]), be32toh(in[3]));
+	uint32_t length = be32toh(in[5]);
+	size_t copied;
+	char *buf;
+	int status;
+
+	if (nret < 5)
+		return SIM_PARAM_ERROR;
+
+	/* No buffer means the dump is being invalidated */
+	if (!in[4])
+		return 0;
+
+	buf = sim_buffer(in[4], length);
+	if (!buf)
+		return SIM_PARAM_ERROR;
+
+	status = sim_chunk(sim.config.dump, sim.config.dump_length, sequence,
+			   buf, length, &copied);
+	sequence += copied;
+	out[1] = htobe32(BITS32_HI(sequence));
+	out[2] = htobe32(BITS32_LO(sequence));
+	out[3] = htobe32(BITS32_HI((uint64_t)copied));
+	out[4] = htobe32(BITS32_LO((uint64_t)copied));
+
+	return status;
+}
+
+/* ibm,scan-log-dump: the start of the dump payload */
+static int sim_scan_log_dump(const rtas_arg_t *in)
+{
+	uint32_t length = be32toh(in[1]);
+	size_t copied;
+	char *buf;
+
+	buf = sim_buffer(in[0], length);
+	if (!buf)
+		return SIM_PARAM_ERROR;
+
+	(void)sim_chunk(sim.config.dump, sim.config.dump_length, 0, buf,
+			length, &copied);
+
+	return 0;
+}
+
+/* get-sensor-state: the scripted state */
+static int sim_get_sensor(const rtas_arg_t *in, rtas_arg_t *out, int nret)
+{
+	int sensor = be32toh(in[0]), index = be32toh(in[1]);
+	size_t i;
+
+	if (nret < 2)
+		return SIM_PARAM_ERROR;
+
+	for (i = 0; i < sim.config.nsensors; i++) {
+		if (sim.config.sensors[i].sensor == sensor &&
+		    sim.config.sensors[i].index == index) {
+			out[1] = htobe32(sim.config.sensors[i].state);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * ibm,get-indices: the entries of the type from position start (1
+ * based) on, as many as fit: count, then index, location code length
+ * and location code for each.
+ */
+static int sim_get_indices(const rtas_arg_t *in, rtas_arg_t *out, int nret)
+{
+	int is_sensor = be32toh(in[0]), type = be32toh(in[1]);
+	uint32_t size = be32toh(in[3]), start = be32toh(in[4]);
+	const struct rtas_sim_index *e;
+	uint32_t count = 0, pos = 0, len, word;
+	size_t i, off = sizeof(count);
+	char *buf;
+
+	buf = sim_buffer(in[2], size);
+	if (!buf || nret < 2 || size < sizeof(count))
+		return SIM_PARAM_ERROR;
+
+	for (i = 0; i < sim.config.nindices; i++) {
+		e = &sim.config.indices[i];
+		if (e->is_sensor != is_sensor || e->type != type)
+			continue;
+
+		if (++pos < start)
+			continue;
+
+		len = strlen(e->loc_code) + 1;
+		if (off + 2 * sizeof(word) + len > size) {
+			out[1] = htobe32(pos);
+			word = htobe32(count);
+			memcpy(buf, &word, sizeof(word));
+			return 1;
+		}
+
+		word = htobe32(e->index);
+		memcpy(buf + off, &word, sizeof(word));
+		word = htobe32(len);
+		memcpy(buf + off + sizeof(word), &word, sizeof(word));
+		memcpy(buf + off + 2 * sizeof(word), e->loc_code, len);
+		off += 2 * sizeof(word) + len;
+		count++;
+	}
+
+	if (!pos)
+		return SIM_PARAM_ERROR;
+
+	word = htobe32(count);
+	memcpy(buf, &word, sizeof(word));
+	return 0;
+}
+
+/*
+ * ibm,configure-connector: the scripted entries in order, laid out as
+ * firmware does: drc index, 0, name offset, value length, value offset.
+ * The extents are asked for spread over the entries, and each one has
+ * to be a new RMO page.
+ */
+static int sim_cfg_connector(const rtas_arg_t *in)
+{
+	const struct rtas_sim_cc_entry *e;
+	uint32_t *words, name_off, value_off;
+	size_t name_len;
+	char *buf;
+
+	buf = sim_buffer(in[0], WORK_AREA_SIZE);
+	if (!buf)
+		return SIM_PARAM_ERROR;
+
+	if (in[1]) {
+		if (!sim_buffer(in[1], WORK_AREA_SIZE) ||
+		    be32toh(in[1]) == sim.cc_extent_pa)
+			return SIM_PARAM_ERROR;
+		sim.cc_extent_pa = be32toh(in[1]);
+		sim.cc_extents++;
+	}
+
+	if (sim.cc_extents < sim.config.connector_extents &&
+	    sim.cc_pos >= sim.cc_extents * sim.config.nconnector /
+	    sim.config.connector_extents)
+		return RTAS_CC_MORE_MEMORY;
+
+	if (sim.cc_pos == sim.config.nconnector) {
+		sim.cc_pos = 0;
+		sim.cc_extents = 0;
+		sim.cc_extent_pa = 0;
+		return RTAS_CC_COMPLETE;
+	}
+
+	e = &sim.config.connector[sim.cc_pos++];
+	words = (uint32_t *)buf;
+	name_off = 6 * sizeof(*words);
+	name_len = e->name ? strlen(e->name) + 1 : 0;
+	value_off = (name_off + name_len + 3) & ~3u;
+
+	if (value_off + e->length > WORK_AREA_SIZE)
+		return SIM_PARAM_ERROR;
+
+	words[2] = htobe32(name_len ? name_off : 0);
+	words[3] = htobe32(e->length);
+	words[4] = htobe32(value_off);
+	if (name_len)
+		memcpy(buf + name_off, e->name, name_len);
+	if (e->length)
+		memcpy(buf + value_off, e->value, e->length);
+
+	return e->status;
+}
+
+/**
+ * sim_call
+ * @brief Run a simulated call
+ *
+ * Calls without scripted data succeed and return zeroes.
+ *
+ * @param name call name
+ * @param in big endian inputs
+ * @param out big endian outputs, zeroed
+ * @param ninputs
+ * @param nret
+ * @return rtas status
+ */
+static int sim_call(const char *name, const rtas_arg_t *in, rtas_arg_t *out,
+		    int ninputs, int nret)
+{
+	if (!strcmp(name, "ibm,get-vpd") && ninputs == 4)
+		return sim_get_vpd(in, out, nret);
+
+	if (!strcmp(name, "ibm,get-system-parameter") && ninputs == 3)
+		return sim_get_sysparm(in);
+
+	if (!strcmp(name, "ibm,platform-dump") && ninputs == 6)
+		return sim_platform_dump(in, out, nret);
+
+	if (!strcmp(name, "ibm,scan-log-dump") && ninputs == 2)
+		return sim_scan_log_dump(in);
+
+	if (!strcmp(name, "get-sensor-state") && ninputs == 2)
+		return sim_get_sensor(in, out, nret);
+
+	if (!strcmp(name, "ibm,get-indices") && ninputs == 5)
+		return sim_get_indices(in, out, nret);
+
+	if (!strcmp(name, "ibm,configure-connector") && ninputs == 2 &&
+	    sim.config.connector)
+		return sim_cfg_connector(in);
+
+	return 0;
+}
+
+/**
+ * sim_no_progress
+ * @brief Fill in the outputs of a call that returns busy or a delay
+ *
+ * Sequence numbers are handed back unchanged, so that the retry asks
+ * for the same chunk again.
+ *
+ * @param name call name
+ * @param in big endian inputs
+ * @param out big endian outputs, zeroed
+ * @param ninputs
+ * @param nret
+ */
+static void sim_no_progress(const char *name, const rtas_arg_t *in,
+			    rtas_arg_t *out, int ninputs, int nret)
+{
+	if (!strcmp(name, "ibm,get-vpd") && ninputs == 4 && nret >= 2) {
+		out[1] = in[3];
+	} else if (!strcmp(name, "ibm,platform-dump") && ninputs == 6 &&
+		   nret >= 3) {
+		out[1] = in[2];
+		out[2] = in[3];
+	}
+}
+
+static int sim_check_caller(void)
+{
+	return 0;
+}
+
+static int sim_interface_exists(void)
+{
+	return 1;
+}
+
+/**
+ * sim_syscall
+ * @brief Simulated rtas system call
+ *
+ * @param args argument buffer, as for the kernel
+ * @return 0 on success, -1 with errno set otherwise
+ */
+static int sim_syscall(struct rtas_args *args)
+{
+	int ninputs = be32toh(args->ninputs);
+	int nret = be32toh(args->nret);
+	rtas_arg_t *out = &args->args[ninputs];
+	const char *name;
+	int status;
+
+	if (ninputs < 0 || nret < 0 || ninputs + nret > MAX_ARGS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&sim_lock);
+
+	name = sim_token_name(be32toh(args->token));
+	if (!name) {
+		pthread_mutex_unlock(&sim_lock);
+		errno = EINVAL;
+		return -1;
+	}
+
+	sim_spin();
+	sim.calls++;
+	memset(out, 0, nret * sizeof(*out));
+
+	sim.stats.syscalls++;
+
+	if (sim.config.busy_every && sim.calls % sim.config.busy_every == 0) {
+		status = RC_BUSY;
+		sim.stats.busy++;
+	} else if (sim.config.delay_every &&
+		   sim.calls % sim.config.delay_every == 0) {
+		status = sim.config.delay_status;
+		sim.stats.delays++;
+	} else {
+		status = sim_call(name, args->args, out, ninputs, nret);
+	}
+
+	if (status == RC_BUSY || status >= EXTENDED_DELAY_MIN)
+		sim_no_progress(name, args->args, out, ninputs, nret);
+
+	pthread_mutex_unlock(&sim_lock);
+
+	if (nret)
+		out[0] = htobe32(status);
+
+	return 0;
+}
+
+static int sim_read_token(const char *call_name, int *token)
+{
+	int rc = -1;
+	size_t i;
+
+	pthread_mutex_lock(&sim_lock);
+
+	for (i = 0; i < sim.config.ntokens; i++) {
+		if (!strcmp(sim.config.tokens[i].name, call_name)) {
+			*token = sim.config.tokens[i].token;
+			rc = 0;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&sim_lock);
+
+	if (rc)
+		errno = ENOENT;
+
+	return rc;
+}
+
+static int sim_rmo_bounds(struct region *kregion)
+{
+	pthread_mutex_lock(&sim_lock);
+	kregion->addr = SIM_RMO_ADDR;
+	kregion->size = sim.config.rmo_pages * WORK_AREA_SIZE;
+	pthread_mutex_unlock(&sim_lock);
+
+	return 0;
+}
+
+static int sim_rmo_map(struct region *kregion, void **buf)
+{
+	void *newbuf;
+
+	newbuf = mmap(NULL, kregion->size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (newbuf == MAP_FAILED) {
+		dbg("mmap failed\n");
+		return RTAS_IO_ASSERT;
+	}
+
+	pthread_mutex_lock(&sim_lock);
+	sim.rmo = newbuf;
+	sim.rmo_addr = kregion->addr;
+	sim.rmo_size = kregion->size;
+	pthread_mutex_unlock(&sim_lock);
+
+	*buf = newbuf;
+	return 0;
+}
+
+static void sim_rmo_unmap(struct region *kregion, void *buf)
+{
+	pthread_mutex_lock(&sim_lock);
+	sim.rmo = NULL;
+	sim.rmo_size = 0;
+	pthread_mutex_unlock(&sim_lock);
+
+	munmap(buf, kregion->size);
+}
+
+static int sim_chardev_exists(const char *path)
+{
+	int chardevs;
+
+	pthread_mutex_lock(&sim_lock);
+	chardevs = sim.config.chardevs;
+	pthread_mutex_unlock(&sim_lock);
+
+	return chardevs && (!strcmp(path, sim_vpd_devpath) ||
+			    !strcmp(path, sim_sysparm_devpath));
+}
+
+/*
+ * The simulated devices are backed by /dev/null, so that callers get
+ * a descriptor they can close as usual.
+ */
+static int sim_chardev_open(const char *path, int flags)
+{
+	if (!sim_chardev_exists(path)) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&sim_lock);
+	sim.stats.opens++;
+	pthread_mutex_unlock(&sim_lock);
+
+	return open("/dev/null", flags);
+}
+
+/**
+ * sim_vpd_handle
+ * @brief Create a VPD handle that reads back the VPD payload
+ *
+ * @return file descriptor, or -1 with errno set
+ */
+static int sim_vpd_handle(void)
+{
+	const char *data = sim.config.vpd;
+	size_t left = sim.config.vpd_length;
+	ssize_t n;
+	int fd;
+
+	fd = memfd_create("librtas-sim-vpd", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	while (left) {
+		n = write(fd, data, left);
+		if (n < 0) {
+			close(fd);
+			return -1;
+		}
+		data += n;
+		left -= n;
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int sim_chardev_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct papr_sysparm_io_block *block = arg;
+	const struct rtas_sim_sysparm *param;
+	int rc = 0;
+
+	pthread_mutex_lock(&sim_lock);
+	sim_spin();
+	sim.calls++;
+	sim.stats.ioctls++;
+
+	switch (request) {
+	case PAPR_VPD_IOC_CREATE_HANDLE:
+		rc = sim_vpd_handle();
+		break;
+	case PAPR_SYSPARM_IOC_GET:
+		param = sim_sysparm(block->parameter);
+		if (!param) {
+			errno = EOPNOTSUPP;
+			rc = -1;
+			break;
+		}
+		block->length = param->length < PAPR_SYSPARM_MAX_OUTPUT ?
+			param->length : PAPR_SYSPARM_MAX_OUTPUT;
+		memcpy(block->data, param->data, block->length);
+		break;
+	case PAPR_SYSPARM_IOC_SET:
+		break;
+	default:
+		errno = ENOTTY;
+		rc = -1;
+		break;
+	}
+
+	pthread_mutex_unlock(&sim_lock);
+
+	return rc;
+}
+
+static const struct rtas_backend sim_backend = {
+	.name = "sim",
+	.check_caller = sim_check_caller,
+	.interface_exists = sim_interface_exists,
+	.syscall = sim_syscall,
+	.read_token = sim_read_token,
+	.rmo_bounds = sim_rmo_bounds,
+	.rmo_map = sim_rmo_map,
+	.rmo_unmap = sim_rmo_unmap,
+	.rmo_private = 1,
+	.chardev_exists = sim_chardev_exists,
+	.chardev_open = sim_chardev_open,
+	.chardev_ioctl = sim_chardev_ioctl,
+};
+
+/**
+ * rtas_sim_enable
+ * @brief Serve librtas calls from the simulated firmware
+ *
+ * Every call after this one goes to the simulator instead of the kernel,
+ * and needs neither root nor a powerpc host. Calling it again changes
+ * the configuration. Work areas must not be in use, and no other thread
+ * may be making calls while the backend changes.
+ *
+ * Every busy_every-th and delay_every-th call returns RC_BUSY or
+ * delay_status before doing anything, so librtas retries it. Other
+ * calls succeed; ibm,get-vpd, ibm,get-system-parameter,
+ * ibm,platform-dump and ibm,scan-log-dump return the scripted data.
+ *
+ * @param config simulator configuration, or NULL for the defaults
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Invalid configuration, or work areas in use
+ */
+int rtas_sim_enable(const struct rtas_sim_config *config)
+{
+	static const struct rtas_sim_config defaults;
+	struct rtas_sim_config old;
+	int rc;
+
+	if (!config)
+		config = &defaults;
+
+	if (config->delay_every &&
+	    (config->delay_status < EXTENDED_DELAY_MIN ||
+	     config->delay_status > EXTENDED_DELAY_MAX))
+		return RTAS_IO_ASSERT;
+
+	pthread_mutex_lock(&sim_lock);
+	old = sim.config;
+	sim.config = *config;
+	if (!sim.config.tokens) {
+		sim.config.tokens = sim_default_tokens;
+		sim.config.ntokens = sizeof(sim_default_tokens) /
+			sizeof(sim_default_tokens[0]);
+	}
+	if (!sim.config.rmo_pages)
+		sim.config.rmo_pages = SIM_RMO_PAGES;
+	sim.cc_pos = 0;
+	sim.cc_extents = 0;
+	sim.cc_extent_pa = 0;
+	pthread_mutex_unlock(&sim_lock);
+
+	rc = backend_set(&sim_backend);
+	if (rc) {
+		pthread_mutex_lock(&sim_lock);
+		sim.config = old;
+		pthread_mutex_unlock(&sim_lock);
+	}
+
+	dbg("(%p) = %d\n", config, rc);
+	return rc;
+}
+
+/**
+ * rtas_sim_disable
+ * @brief Go back to the kernel and firmware after rtas_sim_enable()
+ *
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Work areas are in use
+ */
+int rtas_sim_disable(void)
+{
+	return backend_set(NULL);
+}
+
+/**
+ * rtas_sim_get_stats
+ * @brief Interface to read what the simulated firmware has been asked
+ *
+ * The counters cover the system calls and chardev accesses the native
+ * backend would have made, which makes them a stand-in for the number
+ * of kernel entries per librtas call.
+ *
+ * @param stats reference to the counters
+ * @param reset non-zero to clear the counters after reading them
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_sim_get_stats(struct rtas_sim_stats *stats, int reset)
+{
+	if (!stats)
+		return RTAS_IO_ASSERT;
+
+	pthread_mutex_lock(&sim_lock);
+	*stats = sim.stats;
+	if (reset)
+		memset(&sim.stats, 0, sizeof(sim.stats));
+	pthread_mutex_unlock(&sim_lock);
+
+	return 0;
+}
@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Per-token call counters and latency histograms, and RMO buffer
+// counters, kept with relaxed atomics and read through rtas_get_stats().
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "internal.h"
+#include "librtas.h"
+
+#define STATS_SLOTS 256	/* power of two, well above the number of tokens */
+#define N_DELAYS (EXTENDED_DELAY_MAX - EXTENDED_DELAY_MIN + 1)
+
+struct token_stats {
+	uint64_t key;		/* token + 1, 0 for a free slot */
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t busy;
+	uint64_t delays[N_DELAYS];
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t latency[RTAS_STATS_LATENCY_BUCKETS];
+};
+
+static struct token_stats token_stats[STATS_SLOTS];
+static struct rtas_rmo_stats rmo_stats;
+
+static void counter_add(uint64_t *counter, uint64_t val)
+{
+	__atomic_add_fetch(counter, val, __ATOMIC_RELAXED);
+}
+
+static uint64_t counter_read(uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_get
+ * @brief Find or claim the counters for a token
+ *
+ * Slots are claimed once and never released, so lookups need no lock.
+ *
+ * @param token
+ * @return counters for the token, or NULL if the table is full
+ */
+__attribute__((visibility("hidden")))
+struct token_stats *stats_get(int token)
+{
+	uint64_t key = (uint64_t)(uint32_t)token + 1;
+	uint64_t cur;
+	unsigned int i, slot;
+
+	slot = ((uint32_t)token * 2654435761u) % STATS_SLOTS;
+	for (i = 0; i < STATS_SLOTS; i++) {
+		struct token_stats *ts = &token_stats[(slot + i) % STATS_SLOTS];
+
+		cur = __atomic_load_n(&ts->key, __ATOMIC_ACQUIRE);
+		if (cur == 0) {
+			if (__atomic_compare_exchange_n(&ts->key, &cur, key, 0,
+							__ATOMIC_ACQ_REL,
+							__ATOMIC_ACQUIRE))
+				return ts;
+		}
+		if (cur == key)
+			return ts;
+	}
+
+	return NULL;
+}
+
+/**
+ * stats_now
+ * @brief Timestamp for stats_call_done()
+ *
+ * @return monotonic time in nano-seconds
+ */
+__attribute__((visibility("hidden")))
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * stats_status
+ * @brief Count a delay status returned by firmware
+ *
+ * @param ts counters from stats_get(), may be NULL
+ * @param status rtas status of the call
+ */
+__attribute__((visibility("hidden")))
+void stats_status(struct token_stats *ts, int status)
+{
+	if (!ts)
+		return;
+
+	if (status == RC_BUSY)
+		counter_add(&ts->busy, 1);
+	else if (status >= EXTENDED_DELAY_MIN && status <= EXTENDED_DELAY_MAX)
+		counter_add(&ts->delays[status - EXTENDED_DELAY_MIN], 1);
+}
+
+/**
+ * stats_call_done
+ * @brief Account for a completed call, including its retries
+ *
+ * @param ts counters from stats_get(), may be NULL
+ * @param start stats_now() before the first attempt
+ * @param end stats_now() after the last attempt
+ * @param failed the call failed in the kernel or returned an error status
+ */
+__attribute__((visibility("hidden")))
+void stats_call_done(struct token_stats *ts, uint64_t start, uint64_t end,
+		     int failed)
+{
+	uint64_t ns, us, max;
+	unsigned int bucket = 0;
+
+	if (!ts)
+		return;
+
+	ns = end - start;
+	us = ns / 1000;
+	if (us)
+		bucket = 64 - __builtin_clzll(us);
+	if (bucket >= RTAS_STATS_LATENCY_BUCKETS)
+		bucket = RTAS_STATS_LATENCY_BUCKETS - 1;
+
+	counter_add(&ts->calls, 1);
+	if (failed)
+		counter_add(&ts->errors, 1);
+	counter_add(&ts->total_ns, ns);
+	counter_add(&ts->latency[bucket], 1);
+
+	max = counter_read(&ts->max_ns);
+	while (ns > max &&
+	       !__atomic_compare_exchange_n(&ts->max_ns, &max, ns, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * stats_rmo_alloc
+ * @brief Count an RMO buffer allocation
+ *
+ * @param n_pages pages allocated, 0 if the allocation failed
+ */
+__attribute__((visibility("hidden")))
+void stats_rmo_alloc(size_t n_pages)
+{
+	if (n_pages) {
+		counter_add(&rmo_stats.allocs, 1);
+		counter_add(&rmo_stats.pages, n_pages);
+	} else {
+		counter_add(&rmo_stats.alloc_failures, 1);
+	}
+}
+
+/**
+ * stats_rmo_free
+ * @brief Count an RMO buffer release
+ */
+__attribute__((visibility("hidden")))
+void stats_rmo_free(void)
+{
+	counter_add(&rmo_stats.frees, 1);
+}
+
+/**
+ * rtas_get_stats
+ * @brief Interface to retrieve the librtas call and RMO buffer counters
+ *
+ * Fills in the counters of up to *ncalls tokens that have been called
+ * since the library was loaded, and sets *ncalls to the number of such
+ * tokens. If that is more than the room given, call again with a
+ * bigger array.
+ *
+ * @param calls array for the per-token counters, may be NULL if *ncalls is 0
+ * @param ncalls reference to the array size, updated to the number of tokens
+ * @param rmo reference to the RMO buffer counters, may be NULL
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_get_stats(struct rtas_call_stats *calls, size_t *ncalls,
+		   struct rtas_rmo_stats *rmo)
+{
+	size_t room, n = 0;
+	unsigned int i, j;
+
+	if (!ncalls || (*ncalls && !calls))
+		return RTAS_IO_ASSERT;
+
+	room = *ncalls;
+	for (i = 0; i < STATS_SLOTS; i++) {
+		struct token_stats *ts = &token_stats[i];
+		struct rtas_call_stats *cs;
+		uint64_t key;
+
+		key = __atomic_load_n(&ts->key, __ATOMIC_ACQUIRE);
+		if (!key)
+			continue;
+
+		if (n++ >= room)
+			continue;
+
+		cs = &calls[n - 1];
+		cs->token = (int)(uint32_t)(key - 1);
+		cs->calls = counter_read(&ts->calls);
+		cs->errors = counter_read(&ts->errors);
+		cs->busy = counter_read(&ts->busy);
+		for (j = 0; j < N_DELAYS; j++)
+			cs->delays[j] = counter_read(&ts->delays[j]);
+		cs->total_ns = counter_read(&ts->total_ns);
+		cs->max_ns = counter_read(&ts->max_ns);
+		for (j = 0; j < RTAS_STATS_LATENCY_BUCKETS; j++)
+			cs->latency[j] = counter_read(&ts->latency[j]);
+	}
+	*ncalls = n;
+
+	if (rmo) {
+		rmo->allocs = counter_read(&rmo_stats.allocs);
+		rmo->pages = counter_read(&rmo_stats.pages);
+		rmo->alloc_failures = counter_read(&rmo_stats.alloc_failures);
+		rmo->frees = counter_read(&rmo_stats.frees);
+	}
+
+	return 0;
+}
+
+/**
+ * rtas_reset_stats
+ * @brief Interface to clear the librtas call and RMO buffer counters
+ *
+ * Calls in progress may still be counted after the reset.
+ *
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_reset_stats(void)
+{
+	unsigned int i;
+	size_t j;
+
+	for (i = 0; i < STATS_SLOTS; i++) {
+		uint64_t *c = &token_stats[i].calls;
+		size_t n = (sizeof(struct token_stats) -
+			    offsetof(struct token_stats, calls)) / sizeof(*c);
+
+		for (j = 0; j < n; j++)
+			__atomic_store_n(&c[j], 0, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&rmo_stats.allocs, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&rmo_stats.pages, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&rmo_stats.alloc_failures, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&rmo_stats.frees, 0, __ATOMIC_RELAXED);
+
+	return 0;
+}
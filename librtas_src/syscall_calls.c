@@ -23,77 +23,273 @@
  */
 
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <sys/syscall.h>
 #include <linux/unistd.h>
 #include <linux/types.h>
 #include "internal.h"
 #include "librtas.h"
+#include "probes.h"
 
 int dbg_lvl = 0;
 static uint64_t rtas_timeout_ms;
 
+/*
+ * Retry policy for RC_BUSY. Fields are read and written individually
+ * with atomics; a policy change racing with a retry may mix old and
+ * new fields for that one retry, which is harmless.
+ */
+#define BUSY_BACKOFF_DEFAULTS {	\
+	.spin = 16,			\
+	.yield = 16,			\
+	.min_sleep_us = 10,		\
+	.max_sleep_us = 1000,		\
+	.max_retries = 0,		\
+}
+
+static struct rtas_busy_backoff busy_policy = BUSY_BACKOFF_DEFAULTS;
+
+static struct rtas_busy_stats busy_stats;
+
+enum busy_stage {
+	BUSY_SPIN,
+	BUSY_YIELD,
+	BUSY_SLEEP,
+	BUSY_GIVE_UP,
+};
+
+/* Set once the kernel interface has been seen, cleared on failures */
+static int interface_found;
+
 /**
  * sanity_check
  * @brief validate the caller credentials and rtas interface
  *
+ * The kernel interface is probed until it is found once; later calls
+ * only check the credentials.
+ *
  * @return 0 for success, !o on failure
  */
 int sanity_check(void)
 {
-	if (geteuid() != (uid_t)0)
-		return RTAS_PERM;
+	const struct rtas_backend *be = backend_get();
+	int rc;
+
+	rc = be->check_caller();
+	if (rc)
+		return rc;
+
+	if (__atomic_load_n(&interface_found, __ATOMIC_ACQUIRE))
+		return 0;
 
-	if (!interface_exists())
+	if (!be->interface_exists())
 		return RTAS_KERNEL_INT;
 
+	__atomic_store_n(&interface_found, 1, __ATOMIC_RELEASE);
+
 	return 0;
 }
 
 /**
- * handle_delay
- * @brief sleep for the specified delay time
+ * interface_invalidate
+ * @brief Make the next sanity_check() probe the kernel interface again
+ */
+__attribute__((visibility("hidden")))
+void interface_invalidate(void)
+{
+	__atomic_store_n(&interface_found, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * rtas_reprobe_interface
+ * @brief Interface to probe for the kernel rtas interface again
  *
- * @param status
- * @param elapsed
+ * The result of the probe is cached after the first success. Callers
+ * that know the interface may have changed (e.g. after loading a
+ * module) can force a new probe.
+ *
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_reprobe_interface(void)
+{
+	interface_invalidate();
+
+	return sanity_check();
+}
+
+/**
+ * delay_for_status
+ * @brief Work out how long to wait before retrying a call
+ *
+ * RC_BUSY is not handled here, see busy_backoff().
+ *
+ * @param status rtas status of the last call
+ * @param ms reference to the delay in milli-seconds
  * @return
- *	0 		if the status isn't delay-related
- *	CALL_AGAIN	if the status is delay related
- *	RTAS_TIMEOUT if the requested timeout has been exceeded
+ *	0		if the status isn't an extended delay
+ *	CALL_AGAIN	if the status is an extended delay
  */
-__attribute__((visibility("hidden")))
-unsigned int handle_delay(int status, uint64_t * elapsed)
+static int delay_for_status(int status, unsigned int *ms)
 {
 	int order = status - EXTENDED_DELAY_MIN;
-	unsigned long ms = 0;
-	uint64_t remaining;
 
-	if (status >= EXTENDED_DELAY_MIN && status <= EXTENDED_DELAY_MAX) {
-		/* Extended Delay */
-		for (ms = 1; order > 0; order--)
-			ms = ms * 10;
-	} else if (status == RC_BUSY) {
-		/* Retry */
-		return CALL_AGAIN;
-	} else {
-		/* Not a delay return code */
+	if (status < EXTENDED_DELAY_MIN || status > EXTENDED_DELAY_MAX)
 		return 0;
+
+	for (*ms = 1; order > 0; order--)
+		*ms = *ms * 10;
+
+	return CALL_AGAIN;
+}
+
+/**
+ * busy_backoff
+ * @brief Pick the backoff stage for the next RC_BUSY retry
+ *
+ * The first busy_policy.spin retries are immediate, the next
+ * busy_policy.yield ones yield the cpu first, and later ones sleep
+ * for an exponentially growing time.
+ *
+ * @param busy reference to the number of busy retries so far
+ * @param sleep_us reference to the time to sleep for BUSY_SLEEP
+ * @return stage to apply before retrying
+ */
+static enum busy_stage busy_backoff(unsigned int *busy, unsigned int *sleep_us)
+{
+	unsigned int spin, yield, max_retries, n = (*busy)++;
+	uint64_t us, max_us;
+
+	spin = __atomic_load_n(&busy_policy.spin, __ATOMIC_RELAXED);
+	yield = __atomic_load_n(&busy_policy.yield, __ATOMIC_RELAXED);
+	max_retries = __atomic_load_n(&busy_policy.max_retries,
+				      __ATOMIC_RELAXED);
+
+	if (max_retries && n >= max_retries) {
+		PROBE3(busy, n, BUSY_GIVE_UP, 0);
+		__atomic_add_fetch(&busy_stats.exhausted, 1, __ATOMIC_RELAXED);
+		dbg("giving up after %u busy retries\n", n);
+		return BUSY_GIVE_UP;
+	}
+
+	*sleep_us = 0;
+	if (n < spin) {
+		PROBE3(busy, n, BUSY_SPIN, 0);
+		__atomic_add_fetch(&busy_stats.spins, 1, __ATOMIC_RELAXED);
+		return BUSY_SPIN;
+	}
+
+	n -= spin;
+	if (n < yield) {
+		PROBE3(busy, n + spin, BUSY_YIELD, 0);
+		__atomic_add_fetch(&busy_stats.yields, 1, __ATOMIC_RELAXED);
+		return BUSY_YIELD;
 	}
 
-	if (rtas_timeout_ms) {
-		if (*elapsed >= rtas_timeout_ms)
+	n -= yield;
+	us = __atomic_load_n(&busy_policy.min_sleep_us, __ATOMIC_RELAXED);
+	max_us = __atomic_load_n(&busy_policy.max_sleep_us, __ATOMIC_RELAXED);
+	us <<= (n < 32) ? n : 32;
+	if (us > max_us)
+		us = max_us;
+
+	*sleep_us = us;
+	PROBE3(busy, n + spin + yield, BUSY_SLEEP, *sleep_us);
+	__atomic_add_fetch(&busy_stats.sleeps, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&busy_stats.sleep_us, us, __ATOMIC_RELAXED);
+	return BUSY_SLEEP;
+}
+
+/**
+ * busy_wait
+ * @brief Wait before retrying a call that returned RC_BUSY
+ *
+ * @param sleep_us time to sleep, or 0 to just yield the cpu
+ */
+static void busy_wait(unsigned int sleep_us)
+{
+	if (sleep_us)
+		usleep(sleep_us);
+	else
+		sched_yield();
+}
+
+/**
+ * delay_sleep
+ * @brief sleep for a delay, honouring the rtas_delay_timeout() limit
+ *
+ * @param ms delay in milli-seconds
+ * @param elapsed time already spent delaying
+ * @return 0 on success, RTAS_TIMEOUT if the timeout has been exceeded
+ */
+static int delay_sleep(unsigned long ms, uint64_t *elapsed)
+{
+	uint64_t timeout_ms;
+	uint64_t remaining;
+
+	if (!ms)
+		return 0;
+
+	timeout_ms = __atomic_load_n(&rtas_timeout_ms, __ATOMIC_RELAXED);
+	if (timeout_ms) {
+		if (*elapsed >= timeout_ms)
 			return RTAS_TIMEOUT;
 
-		remaining = rtas_timeout_ms - *elapsed;
+		remaining = timeout_ms - *elapsed;
 		if (ms > remaining)
 			ms = remaining;
 	}
 	*elapsed += ms;
 
-	dbg("Return status %d, delaying for %lu ms\n", status, ms);
+	dbg("delaying for %lu ms\n", ms);
+	PROBE2(delay, ms, *elapsed);
 	usleep(ms * 1000);
+	return 0;
+}
+
+/**
+ * handle_delay
+ * @brief sleep for the specified delay time
+ *
+ * @param status
+ * @param delay delay state of the call, zeroed before the first call
+ * @return
+ *	0 		if the status isn't delay-related, or the busy
+ *			retry limit has been reached
+ *	CALL_AGAIN	if the status is delay related
+ *	RTAS_TIMEOUT if the requested timeout has been exceeded
+ */
+__attribute__((visibility("hidden")))
+unsigned int handle_delay(int status, struct delay_state *delay)
+{
+	unsigned int ms, us;
+	int rc;
+
+	if (status == RC_BUSY) {
+		switch (busy_backoff(&delay->busy, &us)) {
+		case BUSY_GIVE_UP:
+			return 0;
+		case BUSY_SPIN:
+			break;
+		default:
+			busy_wait(us);
+			break;
+		}
+		return CALL_AGAIN;
+	}
+
+	delay->busy = 0;
+	if (!delay_for_status(status, &ms))
+		return 0;
+
+	dbg("Return status %d\n", status);
+	rc = delay_sleep(ms, &delay->elapsed);
+	if (rc)
+		return rc;
+
 	return CALL_AGAIN;
 }
 
@@ -108,7 +304,7 @@ static void display_rtas_buf(struct rtas_args *args, int after)
 {
 	int i, ninputs, nret;
 
-	if (dbg_lvl < 2)
+	if (__atomic_load_n(&dbg_lvl, __ATOMIC_RELAXED) < 2)
 		return;
 
 	ninputs = be32toh(args->ninputs);
@@ -138,21 +334,108 @@ static void display_rtas_buf(struct rtas_args *args, int after)
  * When targeting any variant of powerpc we expect SYS_rtas to be
  * defined.
  */
-static int rtas_syscall(struct rtas_args *args)
+__attribute__((visibility("hidden")))
+int native_rtas_syscall(struct rtas_args *args)
 {
 	return syscall(SYS_rtas, args);
 }
 #else /* __powerpc__ || __powerpc64__ */
 /*
  * For non-powerpc targets (which we allow for the sake of build
- * coverage), always use an invalid syscall number.
+ * coverage), always use an invalid syscall number. The simulated
+ * firmware can be used to run calls there.
  */
-static int rtas_syscall(struct rtas_args *args)
+__attribute__((visibility("hidden")))
+int native_rtas_syscall(struct rtas_args *args)
 {
 	return syscall(-1, args);
 }
 #endif /* __powerpc__ || __powerpc64__ */
 
+/**
+ * do_rtas_call
+ * @brief Issue the rtas system call for a prepared argument buffer
+ *
+ * @param delay_handling retry busy and extended delay statuses
+ * @param args argument buffer, inputs already in big endian
+ * @param ninputs number of inputs
+ * @return 0 on success, !0 otherwise
+ */
+static int do_rtas_call(int delay_handling, struct rtas_args *args,
+			int ninputs)
+{
+	struct token_stats *ts = stats_get(be32toh(args->token));
+	const struct rtas_backend *be = backend_get();
+	struct delay_state delay = { 0 };
+	uint64_t end, start = stats_now();
+	int has_status = be32toh(args->nret) > 0;
+	unsigned int attempts = 0;
+	int rc, slot, status = 0;
+
+	display_rtas_buf(args, 0);
+	PROBE3(call__entry, be32toh(args->token), be32toh(args->ninputs),
+	       be32toh(args->nret));
+
+	do {
+		attempts++;
+		slot = sched_enter();
+		rc = be->syscall(args);
+		if (slot)
+			sched_exit();
+		if (rc < 0)
+			break;
+
+		if (has_status) {
+			status = be32toh(args->args[ninputs]);
+			stats_status(ts, status);
+		}
+
+		if (!delay_handling)
+			break;
+
+		rc = handle_delay(status, &delay);
+	} while (rc == CALL_AGAIN);
+
+	end = stats_now();
+	PROBE4(call__return, be32toh(args->token), status, rc, end - start);
+	trace_call(args, start, end, rc, attempts);
+
+	/* Busy returns are only a failure once they are no longer retried */
+	stats_call_done(ts, start, end, rc != 0 ||
+			(status < 0 && (delay_handling || status != RC_BUSY)));
+
+	if (rc != 0) {
+		dbg("RTAS syscall failure, errno=%d\n", errno);
+		if (rc < 0)
+			interface_invalidate();
+		return RTAS_IO_ASSERT;
+	}
+
+	display_rtas_buf(args, 1);
+
+	return 0;
+}
+
+/* How a call is made, passed through coalesce_call() */
+struct call_opts {
+	int delay_handling;
+	struct rate_limiter *rl;
+};
+
+static int limited_call(struct rtas_args *args, int ninputs, void *arg)
+{
+	const struct call_opts *opts = arg;
+	int rc;
+
+	if (opts->rl) {
+		rc = rate_limit_take(opts->rl);
+		if (rc)
+			return rc;
+	}
+
+	return do_rtas_call(opts->delay_handling, args, ninputs);
+}
+
 /**
  * rtas_call
  * @brief Perform the actual  system call for the rtas call
@@ -165,12 +448,16 @@ static int rtas_syscall(struct rtas_args *args)
  * @param nret number of return variables
  * @return 0 on success, !0 otherwise
  */
-static int _rtas_call(int delay_handling, int token, int ninputs,
-		      int nrets, va_list *ap)
+static int _rtas_call(const char *name, int delay_handling, int token,
+		      int ninputs, int nrets, va_list *ap)
 {
+	struct call_opts opts = { .delay_handling = delay_handling };
 	struct rtas_args args;
-	rtas_arg_t *rets[MAX_ARGS];
-	uint64_t elapsed = 0;
+	rtas_arg_t *rets[MAX_ARGS] = { NULL };
+	size_t keylen = ninputs * sizeof(rtas_arg_t);
+	size_t vallen = nrets * sizeof(rtas_arg_t);
+	unsigned int ttl = 0;
+	uint64_t generation = 0;
 	int i, rc;
 
 	args.token = htobe32(token);
@@ -183,23 +470,31 @@ static int _rtas_call(int delay_handling, int token, int ninputs,
 	for (i = 0; i < nrets; i++)
 		rets[i] = (rtas_arg_t *) va_arg(*ap, unsigned long);
 
-	display_rtas_buf(&args, 0);
+	if (delay_handling && nrets)
+		ttl = call_cache_ttl(name);
 
-	do {
-		rc = rtas_syscall(&args);
-		if (!delay_handling || (rc < 0))
-			break;
+	if (ttl) {
+		if (result_cache_lookup(name, args.args, keylen,
+					&args.args[ninputs], vallen))
+			goto out;
+		generation = result_cache_generation();
+	}
 
-		rc = handle_delay(be32toh(args.args[ninputs]), &elapsed);
-	} while (rc == CALL_AGAIN);
+	opts.rl = rate_limiter_get(name);
 
-	if (rc != 0) {
-		dbg("RTAS syscall failure, errno=%d\n", errno);
-		return RTAS_IO_ASSERT;
-	}
+	if (delay_handling && (coalesce_wanted(name) ||
+			       rate_limit_coalesces(opts.rl)))
+		rc = coalesce_call(&args, ninputs, limited_call, &opts);
+	else
+		rc = limited_call(&args, ninputs, &opts);
+	if (rc)
+		return rc;
 
-	display_rtas_buf(&args, 1);
+	if (ttl && be32toh(args.args[ninputs]) == 0)
+		result_cache_store(name, ttl, generation, args.args, keylen,
+				   &args.args[ninputs], vallen);
 
+out:
 	/* Assign rets */
 	if (nrets) {
 		/* All RTAS calls return a status in rets[0] */
@@ -223,7 +518,7 @@ int rtas_call_no_delay(const char *name, int ninputs, int nrets, ...)
 		return token;
 
 	va_start(ap, nrets);
-	rc = _rtas_call(0, token, ninputs, nrets, &ap);
+	rc = _rtas_call(name, 0, token, ninputs, nrets, &ap);
 	va_end(ap);
 
 	return rc;
@@ -240,12 +535,234 @@ int rtas_call(const char *name, int ninputs, int nrets, ...)
 		return token;
 
 	va_start(ap, nrets);
-	rc = _rtas_call(1, token, ninputs, nrets, &ap);
+	rc = _rtas_call(name, 1, token, ninputs, nrets, &ap);
 	va_end(ap);
 
 	return rc;
 }
 
+/*
+ * Calls that may be asked to wait by firmware (extended delay, busy)
+ * are written as a continuation: step() issues one firmware call,
+ * finish() copies out results and releases resources, and release()
+ * only releases resources, for a call that is cancelled. The blocking
+ * interfaces run a continuation to completion, sleeping as needed;
+ * the *_start() interfaces return RTAS_AGAIN and let the caller decide
+ * when to resume.
+ */
+struct rtas_continuation {
+	/* Returns <0 on error, CALL_AGAIN to call again right away */
+	int (*step)(struct rtas_continuation *cont);
+	int (*finish)(struct rtas_continuation *cont, int rc);
+	void (*release)(struct rtas_continuation *cont);
+	int status;
+	unsigned int busy;	/* busy retries so far */
+	unsigned int busy_us;	/* sleep before the next busy retry */
+	uint32_t workarea_pa;
+	void *kernbuf;
+	union {
+		struct {
+			char *workarea;		/* NULL for a handle */
+			struct rtas_workarea *wa;
+			uint32_t extent_pa;	/* passed to firmware */
+		} cfg;
+		struct {
+			int subfunc;
+			char *workarea;
+			unsigned int length;
+			unsigned int sequence;
+			unsigned int *seq_next;
+		} perf;
+		struct {
+			uint64_t dump_tag;
+			uint64_t sequence;
+			void *buffer;
+			size_t length;
+			uint64_t *seq_next;
+			uint64_t *bytes_ret;
+			uint32_t dump_tag_hi, dump_tag_lo;
+			uint32_t next_hi, next_lo;
+			uint32_t bytes_hi, bytes_lo;
+		} dump;
+		struct {
+			char *workarea;
+			int kbuf_sz;
+			int seq_num;
+			int *next_seq_num;
+			int *work_area_bytes;
+			int resp_bytes;
+		} attest;
+	} u;
+};
+
+/**
+ * cont_new
+ * @brief Allocate a continuation
+ *
+ * @param step
+ * @param finish
+ * @param release
+ * @return new continuation, or NULL if out of memory
+ */
+static struct rtas_continuation *
+cont_new(int (*step)(struct rtas_continuation *),
+	 int (*finish)(struct rtas_continuation *, int),
+	 void (*release)(struct rtas_continuation *))
+{
+	struct rtas_continuation *cont = calloc(1, sizeof(*cont));
+
+	if (cont) {
+		cont->step = step;
+		cont->finish = finish;
+		cont->release = release;
+	}
+
+	return cont;
+}
+
+/**
+ * cont_end
+ * @brief Finish a continuation and release it
+ *
+ * @param cont
+ * @param rc result of the last step
+ * @return final result of the call
+ */
+static int cont_end(struct rtas_continuation *cont, int rc)
+{
+	rc = cont->finish(cont, rc);
+	free(cont);
+
+	return rc;
+}
+
+/**
+ * cont_run
+ * @brief Drive a continuation until it completes or has to wait
+ *
+ * @param cont
+ * @param delay_ms reference to the requested delay
+ * @return RTAS_AGAIN if the caller should resume after delay_ms,
+ *	otherwise the final result of the call (cont is released)
+ */
+static int cont_run(struct rtas_continuation *cont, unsigned int *delay_ms)
+{
+	enum busy_stage stage;
+	int rc;
+
+	do {
+		rc = cont->step(cont);
+		if (rc || cont->status != RC_BUSY)
+			continue;
+
+		stage = busy_backoff(&cont->busy, &cont->busy_us);
+		if (stage == BUSY_SPIN)
+			rc = CALL_AGAIN;
+		else if (stage != BUSY_GIVE_UP) {
+			*delay_ms = (cont->busy_us + 999) / 1000;
+			return RTAS_AGAIN;
+		}
+	} while (rc == CALL_AGAIN);
+
+	cont->busy = 0;
+	if (rc == 0 && delay_for_status(cont->status, delay_ms)) {
+		dbg("Return status %d, resume in %u ms\n", cont->status,
+		    *delay_ms);
+		return RTAS_AGAIN;
+	}
+
+	return cont_end(cont, rc);
+}
+
+/**
+ * cont_start
+ * @brief Run the first step of a newly set up continuation
+ *
+ * @param cont
+ * @param contp reference to hand the continuation to the caller
+ * @param delay_ms reference to the requested delay
+ * @return RTAS_AGAIN or the final result of the call
+ */
+static int cont_start(struct rtas_continuation *cont,
+		      struct rtas_continuation **contp, unsigned int *delay_ms)
+{
+	int rc;
+
+	rc = cont_run(cont, delay_ms);
+	*contp = (rc == RTAS_AGAIN) ? cont : NULL;
+
+	return rc;
+}
+
+/**
+ * cont_wait
+ * @brief Run a continuation to completion, sleeping between steps
+ *
+ * @param cont
+ * @param rc result of cont_start()
+ * @param delay_ms delay requested by cont_start()
+ * @return final result of the call
+ */
+static int cont_wait(struct rtas_continuation *cont, int rc,
+		     unsigned int delay_ms)
+{
+	uint64_t elapsed = 0;
+
+	while (rc == RTAS_AGAIN) {
+		if (cont->status == RC_BUSY) {
+			busy_wait(cont->busy_us);
+		} else {
+			rc = delay_sleep(delay_ms, &elapsed);
+			if (rc)
+				return cont_end(cont, rc);
+		}
+
+		rc = cont_run(cont, &delay_ms);
+	}
+
+	return rc;
+}
+
+/**
+ * rtas_resume
+ * @brief Resume a call that returned RTAS_AGAIN
+ *
+ * Should be called once the delay returned with RTAS_AGAIN has
+ * passed. When the call completes the continuation is released and
+ * its final result is returned.
+ *
+ * @param cont continuation returned by a *_start() interface
+ * @param delay_ms reference to the next delay in milli-seconds
+ * @return RTAS_AGAIN if the call has to be resumed again,
+ *	otherwise the result of the call
+ */
+int rtas_resume(struct rtas_continuation *cont, unsigned int *delay_ms)
+{
+	if (!cont)
+		return RTAS_IO_ASSERT;
+
+	return cont_run(cont, delay_ms);
+}
+
+/**
+ * rtas_cancel
+ * @brief Abandon a call that returned RTAS_AGAIN
+ *
+ * Work areas are released and nothing is written to the buffers or
+ * results passed to the *_start() interface, so the caller may already
+ * have given them up. The firmware operation is left incomplete.
+ *
+ * @param cont continuation returned by a *_start() interface
+ */
+void rtas_cancel(struct rtas_continuation *cont)
+{
+	if (!cont)
+		return;
+
+	cont->release(cont);
+	free(cont);
+}
+
 /**
  * rtas_activate_firmware
  * @brief Interface for ibm,activate-firmware rtas call
@@ -266,64 +783,256 @@ int rtas_activate_firmware(void)
 	return rc ? rc : status;
 }
 
+/**
+ * rtas_call_batch
+ * @brief Perform a series of simple rtas calls back to back
+ *
+ * Each entry names the call either by name or, if name is NULL, by
+ * token. Inputs and return values are in host byte order and rets[0]
+ * receives the rtas status. On return each entry's token holds the
+ * resolved token, so the array can be resubmitted without names, and
+ * its rc holds the librtas result for that call (0, or a RTAS_*
+ * error). Busy and extended delay statuses are retried, and rate limits
+ * and coalescing applied, as for the individual call interfaces.
+ *
+ * Calls that take a work area can be batched by allocating it once
+ * with rtas_get_rmo_buffer() and passing its physical address.
+ *
+ * @param calls array of call descriptors
+ * @param ncalls number of entries in calls
+ * @return 0 if the batch was run, !0 otherwise
+ */
+int rtas_call_batch(struct rtas_batch_call *calls, size_t ncalls)
+{
+	struct call_opts opts = { .delay_handling = 1 };
+	const char *last_name = NULL;
+	struct rtas_args args;
+	int last_token = 0;
+	size_t n;
+	int i, rc;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	for (n = 0; n < ncalls; n++) {
+		struct rtas_batch_call *call = &calls[n];
+
+		if (call->ninputs < 0 || call->nrets < 1 ||
+		    call->ninputs + call->nrets > RTAS_BATCH_MAX_ARGS) {
+			call->rc = RTAS_IO_ASSERT;
+			continue;
+		}
+
+		if (call->name) {
+			if (!last_name || strcmp(call->name, last_name)) {
+				last_name = call->name;
+				last_token = rtas_token(call->name);
+			}
+			call->token = last_token;
+		}
+
+		if (call->token < 0) {
+			call->rc = RTAS_UNKNOWN_OP;
+			continue;
+		}
+
+		args.token = htobe32(call->token);
+		args.ninputs = htobe32(call->ninputs);
+		args.nret = htobe32(call->nrets);
+
+		for (i = 0; i < call->ninputs; i++)
+			args.args[i] = htobe32(call->inputs[i]);
+
+		opts.rl = call->name ? rate_limiter_get(call->name) :
+			rate_limiter_get_token(call->token);
+
+		if ((call->name && coalesce_wanted(call->name)) ||
+		    rate_limit_coalesces(opts.rl))
+			call->rc = coalesce_call(&args, call->ninputs,
+						 limited_call, &opts);
+		else
+			call->rc = limited_call(&args, call->ninputs, &opts);
+		if (call->rc)
+			continue;
+
+		for (i = 0; i < call->nrets; i++)
+			call->rets[i] = be32toh(args.args[call->ninputs + i]);
+
+		dbg("batch[%zu] token %d = %d\n", n, call->token,
+		    (int)call->rets[0]);
+	}
+
+	return 0;
+}
+
 #define CFG_RC_DONE 0
 #define CFG_RC_MEM 5
 
+static int cfg_connector_step(struct rtas_continuation *cont)
+{
+	struct rtas_workarea *wa = cont->u.cfg.wa;
+	int rc;
+
+	rc = rtas_call_no_delay("ibm,configure-connector", 2, 1,
+				htobe32(wa->pa), htobe32(cont->u.cfg.extent_pa),
+				&cont->status);
+	if (rc < 0)
+		return rc;
+
+	if ((rc == 0) && (cont->status == CFG_RC_MEM)) {
+		rc = workarea_extent(wa, &cont->u.cfg.extent_pa);
+		if (rc < 0)
+			return rc;
+
+		return CALL_AGAIN;
+	}
+
+	return rc;
+}
+
+static void cfg_connector_release(struct rtas_continuation *cont)
+{
+	/* An abandoned configuration no longer holds its extents */
+	cont->u.cfg.wa->extents_used = 0;
+
+	if (cont->u.cfg.workarea)
+		(void)rtas_workarea_free(cont->u.cfg.wa);
+}
+
+static int cfg_connector_finish(struct rtas_continuation *cont, int rc)
+{
+	struct rtas_workarea *wa = cont->u.cfg.wa;
+	char *workarea = cont->u.cfg.workarea;
+
+	/*
+	 * Firmware may use the extents until the connector is configured
+	 * or configuration fails; after that they can be handed out again.
+	 */
+	if (rc || cont->status <= CFG_RC_DONE)
+		wa->extents_used = 0;
+
+	/* New hardware brings new sensors and indicators */
+	if (rc == 0 && cont->status == CFG_RC_DONE) {
+		index_cache_invalidate();
+		result_cache_invalidate();
+	}
+
+	if (workarea) {
+		if (rc == 0)
+			memcpy(workarea, wa->buf, WORK_AREA_SIZE);
+
+		(void)rtas_workarea_free(wa);
+	} else {
+		workarea = wa->buf;
+	}
+
+	dbg("(%p) = %d\n", workarea, rc ? rc : cont->status);
+	return rc ? rc : cont->status;
+}
+
 /**
- * rtas_cfg_connector
- * @brief Interface for ibm,configure-connector rtas call
+ * rtas_cfg_connector_start
+ * @brief Non-blocking interface for ibm,configure-connector rtas call
  *
+ * Like rtas_cfg_connector(), but returns RTAS_AGAIN instead of sleeping
+ * when firmware asks for a delay; see rtas_resume().
+ *
+ * @param cont reference to the continuation for rtas_resume()
  * @param workarea buffer containg args to ibm,configure-connector
- * @return 0 on success, !0 on failure
+ * @param delay_ms reference to the requested delay in milli-seconds
+ * @return RTAS_AGAIN if the call has to be resumed,
+ *	otherwise as rtas_cfg_connector()
  */
-int rtas_cfg_connector(char *workarea)
+int rtas_cfg_connector_start(struct rtas_continuation **cont,
+			     char *workarea, unsigned int *delay_ms)
 {
-	uint32_t workarea_pa;
-	uint32_t extent_pa = 0;
-	uint64_t elapsed = 0;
-	void *kernbuf;
-	void *extent;
-	int rc, status;
+	struct rtas_continuation *c;
+	int rc;
+
+	*cont = NULL;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_get_rmo_buffer(WORK_AREA_SIZE, &kernbuf, &workarea_pa);
-	if (rc)
+	c = cont_new(cfg_connector_step, cfg_connector_finish,
+		     cfg_connector_release);
+	if (!c)
+		return RTAS_NO_MEM;
+
+	c->u.cfg.wa = malloc(sizeof(*c->u.cfg.wa));
+	if (!c->u.cfg.wa) {
+		free(c);
+		return RTAS_NO_MEM;
+	}
+
+	rc = workarea_init(c->u.cfg.wa, WORK_AREA_SIZE);
+	if (rc) {
+		free(c->u.cfg.wa);
+		free(c);
 		return rc;
+	}
 
-	memcpy(kernbuf, workarea, WORK_AREA_SIZE);
+	memcpy(c->u.cfg.wa->buf, workarea, WORK_AREA_SIZE);
+	c->u.cfg.workarea = workarea;
 
-	do {
-		rc = rtas_call_no_delay("ibm,configure-connector", 2, 1,
-					htobe32(workarea_pa),
-					htobe32(extent_pa), &status);
-		if (rc < 0)
-			break;
+	return cont_start(c, cont, delay_ms);
+}
+
+/**
+ * rtas_cfg_connector
+ * @brief Interface for ibm,configure-connector rtas call
+ *
+ * @param workarea buffer containg args to ibm,configure-connector
+ * @return 0 on success, !0 on failure
+ */
+int rtas_cfg_connector(char *workarea)
+{
+	struct rtas_continuation *cont;
+	unsigned int delay_ms;
+	int rc;
 
-		if ((rc == 0) && (status == CFG_RC_MEM)) {
-			rc = rtas_get_rmo_buffer(WORK_AREA_SIZE, &extent,
-						 &extent_pa);
-			if (rc < 0)
-				break;
+	rc = rtas_cfg_connector_start(&cont, workarea, &delay_ms);
 
-			continue;
-		}
+	return cont_wait(cont, rc, delay_ms);
+}
 
-		rc = handle_delay(status, &elapsed);
-	} while (rc == CALL_AGAIN);
+/**
+ * rtas_cfg_connector_wa
+ * @brief Interface for ibm,configure-connector on a work area handle
+ *
+ * Like rtas_cfg_connector(), but firmware works on the handle's work
+ * area in place. Memory extents firmware asks for stay with the handle
+ * until the connector is configured, and are then reused by the next
+ * configuration on the handle; rtas_workarea_free() releases them.
+ *
+ * @param wa work area of at least 4096 bytes
+ * @return 0 on success, !0 on failure
+ */
+int rtas_cfg_connector_wa(struct rtas_workarea *wa)
+{
+	struct rtas_continuation *c, *cont;
+	unsigned int delay_ms;
+	int rc;
 
-	if (rc == 0)
-		memcpy(workarea, kernbuf, WORK_AREA_SIZE);
+	rc = sanity_check();
+	if (rc)
+		return rc;
 
-	(void)rtas_free_rmo_buffer(kernbuf, workarea_pa, WORK_AREA_SIZE);
+	if (wa->size < WORK_AREA_SIZE)
+		return RTAS_IO_ASSERT;
 
-	if (extent_pa)
-		(void)rtas_free_rmo_buffer(extent, extent_pa, WORK_AREA_SIZE);
+	c = cont_new(cfg_connector_step, cfg_connector_finish,
+		     cfg_connector_release);
+	if (!c)
+		return RTAS_NO_MEM;
 
-	dbg("(%p) = %d\n", workarea, rc ? rc : status);
-	return rc ? rc : status;
+	c->u.cfg.wa = wa;
+
+	rc = cont_start(c, &cont, &delay_ms);
+
+	return cont_wait(cont, rc, delay_ms);
 }
 
 /**
@@ -341,7 +1050,7 @@ int rtas_delay_timeout(uint64_t timeout_ms)
 	if (rc)
 		return rc;
 
-	rtas_timeout_ms = timeout_ms;
+	__atomic_store_n(&rtas_timeout_ms, timeout_ms, __ATOMIC_RELAXED);
 
 	return 0;
 }
@@ -414,32 +1123,61 @@ int rtas_display_msg(char *buf)
  */
 int rtas_errinjct(int etoken, int otoken, char *workarea)
 {
-	uint32_t kernbuf_pa;
-	void *kernbuf;
+	struct rtas_workarea wa;
 	int rc, status;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_get_rmo_buffer(ERRINJCT_BUF_SIZE, &kernbuf, &kernbuf_pa);
+	rc = workarea_init(&wa, ERRINJCT_BUF_SIZE);
 	if (rc)
 		return rc;
 
-	memcpy(kernbuf, workarea, ERRINJCT_BUF_SIZE);
+	memcpy(wa.buf, workarea, ERRINJCT_BUF_SIZE);
 
 	rc = rtas_call("ibm,errinjct", 3, 1, htobe32(etoken), htobe32(otoken),
-		       htobe32(kernbuf_pa), &status);
+		       htobe32(wa.pa), &status);
 
 	if (rc == 0)
-		memcpy(workarea, kernbuf, ERRINJCT_BUF_SIZE);
+		memcpy(workarea, wa.buf, ERRINJCT_BUF_SIZE);
 
-	(void)rtas_free_rmo_buffer(kernbuf, kernbuf_pa, ERRINJCT_BUF_SIZE);
+	workarea_release(&wa);
 
 	dbg("(%d, %d, %p) = %d\n", etoken, otoken, workarea, rc ? rc : status);
 	return rc ? rc : status;
 }
 
+/**
+ * rtas_errinjct_wa
+ * @brief Interface to the ibm,errinjct rtas call on a work area handle
+ *
+ * Like rtas_errinjct(), but firmware works on the handle's work area
+ * in place.
+ *
+ * @param etoken errinjct token
+ * @param otoken errinjct open token
+ * @param wa work area of at least 1024 bytes
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_errinjct_wa(int etoken, int otoken, struct rtas_workarea *wa)
+{
+	int rc, status;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	if (wa->size < ERRINJCT_BUF_SIZE)
+		return RTAS_IO_ASSERT;
+
+	rc = rtas_call("ibm,errinjct", 3, 1, htobe32(etoken), htobe32(otoken),
+		       htobe32(wa->pa), &status);
+
+	dbg("(%d, %d, %p) = %d\n", etoken, otoken, wa->buf, rc ? rc : status);
+	return rc ? rc : status;
+}
+
 /**
  * rtas_errinjct_close
  * @brief Inerface to close the ibm,errinjct facility
@@ -492,6 +1230,58 @@ int rtas_errinjct_open(int *otoken)
 	return rc ? rc : status;
 }
 
+/**
+ * rtas_get_busy_backoff
+ * @brief Interface to retrieve the retry policy for RC_BUSY returns
+ *
+ * @param policy reference to the policy to fill in
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_get_busy_backoff(struct rtas_busy_backoff *policy)
+{
+	if (!policy)
+		return RTAS_IO_ASSERT;
+
+	policy->spin = __atomic_load_n(&busy_policy.spin, __ATOMIC_RELAXED);
+	policy->yield = __atomic_load_n(&busy_policy.yield, __ATOMIC_RELAXED);
+	policy->min_sleep_us = __atomic_load_n(&busy_policy.min_sleep_us,
+					       __ATOMIC_RELAXED);
+	policy->max_sleep_us = __atomic_load_n(&busy_policy.max_sleep_us,
+					       __ATOMIC_RELAXED);
+	policy->max_retries = __atomic_load_n(&busy_policy.max_retries,
+					      __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/**
+ * rtas_get_busy_stats
+ * @brief Interface to retrieve the RC_BUSY backoff counters
+ *
+ * @param stats reference to the counters to fill in
+ * @param reset clear the counters after reading them
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_get_busy_stats(struct rtas_busy_stats *stats, int reset)
+{
+	uint64_t *src = (uint64_t *)&busy_stats;
+	uint64_t *dst = (uint64_t *)stats;
+	size_t i;
+
+	if (!stats)
+		return RTAS_IO_ASSERT;
+
+	for (i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+		if (reset)
+			dst[i] = __atomic_exchange_n(&src[i], 0,
+						     __ATOMIC_RELAXED);
+		else
+			dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
 /**
  * rtas_get_config_addr_info2
  * @brief Interface to ibm,get-config-addr-info2 rtas call
@@ -584,27 +1374,26 @@ int rtas_get_dynamic_sensor(int sensor, void *loc_code, int *state)
 int rtas_get_indices(int is_sensor, int type, char *workarea, size_t size,
 		     int start, int *next)
 {
-	uint32_t kernbuf_pa;
+	struct rtas_workarea wa;
 	__be32 be_next;
-	void *kernbuf;
 	int rc, status;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_get_rmo_buffer(size, &kernbuf, &kernbuf_pa);
+	rc = workarea_init(&wa, size);
 	if (rc)
 		return rc;
 
 	rc = rtas_call("ibm,get-indices", 5, 2, htobe32(is_sensor),
-		       htobe32(type), htobe32(kernbuf_pa), htobe32(size),
+		       htobe32(type), htobe32(wa.pa), htobe32(size),
 		       htobe32(start), &status, &be_next);
 
 	if (rc == 0)
-		memcpy(workarea, kernbuf, size);
+		memcpy(workarea, wa.buf, size);
 
-	(void)rtas_free_rmo_buffer(kernbuf, kernbuf_pa, size);
+	workarea_release(&wa);
 
 	*next = be32toh(be_next);
 
@@ -613,6 +1402,45 @@ int rtas_get_indices(int is_sensor, int type, char *workarea, size_t size,
 	return rc ? rc : status;
 }
 
+/**
+ * rtas_get_indices_wa
+ * @brief Interface to the ibm,get-indices rtas call on a work area handle
+ *
+ * Like rtas_get_indices(), but the indices are returned in the
+ * handle's work area.
+ *
+ * @param is_sensor is this index a sensor?
+ * @param type
+ * @param wa work area of at least size bytes
+ * @param size
+ * @param start
+ * @param next
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_get_indices_wa(int is_sensor, int type, struct rtas_workarea *wa,
+			size_t size, int start, int *next)
+{
+	__be32 be_next;
+	int rc, status;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	if (wa->size < size)
+		return RTAS_IO_ASSERT;
+
+	rc = rtas_call("ibm,get-indices", 5, 2, htobe32(is_sensor),
+		       htobe32(type), htobe32(wa->pa), htobe32(size),
+		       htobe32(start), &status, &be_next);
+
+	*next = be32toh(be_next);
+
+	dbg("(%d, %d, %p, %zu, %d, %p) = %d, %d\n", is_sensor, type, wa->buf,
+	     size, start, next, rc ? rc : status, *next);
+	return rc ? rc : status;
+}
+
 /**
  * rtas_get_power_level
  * @brief Interface to the get-power-level rtas call
@@ -690,29 +1518,120 @@ int rtas_get_sensor(int sensor, int index, int *state)
  * @param nsec
  * @return 0 on success, !0 otherwise
  */
-int rtas_get_time(uint32_t *year, uint32_t *month, uint32_t *day,
-		  uint32_t *hour, uint32_t *min, uint32_t *sec, uint32_t *nsec)
+int rtas_get_time(uint32_t *year, uint32_t *month, uint32_t *day,
+		  uint32_t *hour, uint32_t *min, uint32_t *sec, uint32_t *nsec)
+{
+	int rc, status;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	rc = rtas_call("get-time-of-day", 0, 8, &status, year, month, day,
+		       hour, min, sec, nsec);
+
+	*year = be32toh(*year);
+	*month = be32toh(*month);
+	*day = be32toh(*day);
+	*hour = be32toh(*hour);
+	*min = be32toh(*min);
+	*sec = be32toh(*sec);
+	*nsec = be32toh(*nsec);
+
+	dbg("() = %d, %u, %u, %u, %u, %u, %u, %u\n", rc ? rc : status, *year,
+	    *month, *day, *hour, *min, *sec, *nsec);
+	return rc ? rc : status;
+}
+
+static int lpar_perftools_step(struct rtas_continuation *cont)
+{
+	cont->u.perf.sequence = *cont->u.perf.seq_next;
+
+	return rtas_call_no_delay("ibm,lpar-perftools", 5, 2,
+				  htobe32(cont->u.perf.subfunc), 0,
+				  htobe32(cont->workarea_pa),
+				  htobe32(cont->u.perf.length),
+				  cont->u.perf.sequence, &cont->status,
+				  cont->u.perf.seq_next);
+}
+
+static void lpar_perftools_release(struct rtas_continuation *cont)
+{
+	(void)rtas_free_rmo_buffer(cont->kernbuf, cont->workarea_pa,
+				   cont->u.perf.length);
+}
+
+static int lpar_perftools_finish(struct rtas_continuation *cont, int rc)
+{
+	unsigned int *seq_next = cont->u.perf.seq_next;
+
+	if (rc == 0)
+		memcpy(cont->u.perf.workarea, cont->kernbuf,
+		       cont->u.perf.length);
+
+	lpar_perftools_release(cont);
+
+	*seq_next = be32toh(*seq_next);
+
+	dbg("(%d, %p, %u, %u, %p) = %d, %u\n", cont->u.perf.subfunc,
+	    cont->u.perf.workarea, cont->u.perf.length,
+	    cont->u.perf.sequence, seq_next, rc ? rc : cont->status,
+	    *seq_next);
+	return rc ? rc : cont->status;
+}
+
+/**
+ * rtas_lpar_perftools_start
+ * @brief Non-blocking interface to the ibm,lpar-perftools rtas call
+ *
+ * Like rtas_lpar_perftools(), but returns RTAS_AGAIN instead of
+ * sleeping when firmware asks for a delay; see rtas_resume().
+ *
+ * @param cont reference to the continuation for rtas_resume()
+ * @param subfunc
+ * @param workarea additional args to the rtas call
+ * @param length
+ * @param sequence
+ * @param seq_next
+ * @param delay_ms reference to the requested delay in milli-seconds
+ * @return RTAS_AGAIN if the call has to be resumed,
+ *	otherwise as rtas_lpar_perftools()
+ */
+int rtas_lpar_perftools_start(struct rtas_continuation **cont, int subfunc,
+			      char *workarea, unsigned int length,
+			      unsigned int sequence, unsigned int *seq_next,
+			      unsigned int *delay_ms)
 {
-	int rc, status;
+	struct rtas_continuation *c;
+	int rc;
+
+	*cont = NULL;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_call("get-time-of-day", 0, 8, &status, year, month, day,
-		       hour, min, sec, nsec);
+	c = cont_new(lpar_perftools_step, lpar_perftools_finish,
+		     lpar_perftools_release);
+	if (!c)
+		return RTAS_NO_MEM;
 
-	*year = be32toh(*year);
-	*month = be32toh(*month);
-	*day = be32toh(*day);
-	*hour = be32toh(*hour);
-	*min = be32toh(*min);
-	*sec = be32toh(*sec);
-	*nsec = be32toh(*nsec);
+	rc = rtas_get_rmo_buffer(length, &c->kernbuf, &c->workarea_pa);
+	if (rc) {
+		free(c);
+		return rc;
+	}
 
-	dbg("() = %d, %u, %u, %u, %u, %u, %u, %u\n", rc ? rc : status, *year,
-	    *month, *day, *hour, *min, *sec, *nsec);
-	return rc ? rc : status;
+	memcpy(c->kernbuf, workarea, WORK_AREA_SIZE);
+	c->u.perf.subfunc = subfunc;
+	c->u.perf.workarea = workarea;
+	c->u.perf.length = length;
+	c->u.perf.sequence = sequence;
+	c->u.perf.seq_next = seq_next;
+
+	*seq_next = htobe32(sequence);
+
+	return cont_start(c, cont, delay_ms);
 }
 
 /**
@@ -729,118 +1648,157 @@ int rtas_get_time(uint32_t *year, uint32_t *month, uint32_t *day,
 int rtas_lpar_perftools(int subfunc, char *workarea, unsigned int length,
 			unsigned int sequence, unsigned int *seq_next)
 {
-	uint64_t elapsed = 0;
-	uint32_t kernbuf_pa;
-	void *kernbuf;
-	int rc, status;
+	struct rtas_continuation *cont;
+	unsigned int delay_ms;
+	int rc;
 
-	rc = sanity_check();
-	if (rc)
-		return rc;
+	rc = rtas_lpar_perftools_start(&cont, subfunc, workarea, length,
+				       sequence, seq_next, &delay_ms);
 
-	rc = rtas_get_rmo_buffer(length, &kernbuf, &kernbuf_pa);
-	if (rc)
+	return cont_wait(cont, rc, delay_ms);
+}
+
+static int platform_dump_step(struct rtas_continuation *cont)
+{
+	int rc;
+
+	rc = rtas_call_no_delay("ibm,platform-dump", 6, 5,
+				cont->u.dump.dump_tag_hi,
+				cont->u.dump.dump_tag_lo,
+				cont->u.dump.next_hi, cont->u.dump.next_lo,
+				htobe32(cont->workarea_pa),
+				htobe32(cont->u.dump.length), &cont->status,
+				&cont->u.dump.next_hi, &cont->u.dump.next_lo,
+				&cont->u.dump.bytes_hi, &cont->u.dump.bytes_lo);
+	if (rc < 0)
 		return rc;
 
-	memcpy(kernbuf, workarea, WORK_AREA_SIZE);
+	cont->u.dump.sequence = BITS64(be32toh(cont->u.dump.next_hi),
+				       be32toh(cont->u.dump.next_lo));
+	dbg("%s: seq_next = 0x%" PRIx64 "\n", __FUNCTION__,
+	    cont->u.dump.sequence);
 
-	*seq_next = htobe32(sequence);
-	do {
-		sequence = *seq_next;
-		rc = rtas_call_no_delay("ibm,lpar-perftools", 5, 2,
-					htobe32(subfunc), 0,
-					htobe32(kernbuf_pa), htobe32(length),
-					sequence, &status, seq_next);
-		if (rc < 0)
-			break;
+	return rc;
+}
 
-		rc = handle_delay(status, &elapsed);
-	} while (rc == CALL_AGAIN);
+static void platform_dump_release(struct rtas_continuation *cont)
+{
+	if (cont->kernbuf)
+		(void)rtas_free_rmo_buffer(cont->kernbuf, cont->workarea_pa,
+					   cont->u.dump.length);
+}
 
-	if (rc == 0)
-		memcpy(workarea, kernbuf, length);
+static int platform_dump_finish(struct rtas_continuation *cont, int rc)
+{
+	uint64_t *seq_next = cont->u.dump.seq_next;
+	uint64_t *bytes_ret = cont->u.dump.bytes_ret;
+	uint32_t bytes_hi, bytes_lo;
 
-	(void)rtas_free_rmo_buffer(kernbuf, kernbuf_pa, length);
+	if (cont->u.dump.buffer && (rc == 0))
+		memcpy(cont->u.dump.buffer, cont->kernbuf, cont->u.dump.length);
 
-	*seq_next = be32toh(*seq_next);
+	platform_dump_release(cont);
 
-	dbg("(%d, %p, %u, %u, %p) = %d, %u\n", subfunc, workarea,
-	    length, sequence, seq_next, rc ? rc : status, *seq_next);
-	return rc ? rc : status;
+	*seq_next = cont->u.dump.sequence;
+	bytes_hi = be32toh(cont->u.dump.bytes_hi);
+	bytes_lo = be32toh(cont->u.dump.bytes_lo);
+	*bytes_ret = BITS64(bytes_hi, bytes_lo);
+
+	dbg("(0x%"PRIx64", 0x%"PRIx64", %p, %zu, %p, %p) = %d, 0x%"PRIx64", 0x%"PRIx64"\n",
+	     cont->u.dump.dump_tag, cont->u.dump.sequence,
+	     cont->u.dump.buffer, cont->u.dump.length, seq_next, bytes_ret,
+	     rc ? rc : cont->status, *seq_next, *bytes_ret);
+	return rc ? rc : cont->status;
 }
+
 /**
- * rtas_platform_dump
- * Interface to the ibm,platform-dump rtas call
+ * rtas_platform_dump_start
+ * Non-blocking interface to the ibm,platform-dump rtas call
  *
+ * Like rtas_platform_dump(), but returns RTAS_AGAIN instead of
+ * sleeping when firmware asks for a delay; see rtas_resume().
+ *
+ * @param cont reference to the continuation for rtas_resume()
  * @param dump_tag
  * @param sequence
  * @param buffer buffer to write dump to
  * @param length buffer length
- * @param next_seq
+ * @param seq_next
  * @param bytes_ret
- * @return 0 on success, !0 othwerwise
+ * @param delay_ms reference to the requested delay in milli-seconds
+ * @return RTAS_AGAIN if the call has to be resumed,
+ *	otherwise as rtas_platform_dump()
  */
-int rtas_platform_dump(uint64_t dump_tag, uint64_t sequence, void *buffer,
-		       size_t length, uint64_t *seq_next, uint64_t *bytes_ret)
+int rtas_platform_dump_start(struct rtas_continuation **cont,
+			     uint64_t dump_tag, uint64_t sequence,
+			     void *buffer, size_t length, uint64_t *seq_next,
+			     uint64_t *bytes_ret, unsigned int *delay_ms)
 {
-	uint64_t elapsed = 0;
-	uint32_t kernbuf_pa = 0;
-	uint32_t next_hi, next_lo;
-	uint32_t bytes_hi, bytes_lo;
-	uint32_t dump_tag_hi, dump_tag_lo;
-	void *kernbuf = NULL;
-	int rc, status;
+	struct rtas_continuation *c;
+	int rc;
+
+	*cont = NULL;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
+	c = cont_new(platform_dump_step, platform_dump_finish,
+		     platform_dump_release);
+	if (!c)
+		return RTAS_NO_MEM;
+
 	if (buffer) {
-		rc = rtas_get_rmo_buffer(length, &kernbuf, &kernbuf_pa);
-		if (rc)
+		rc = rtas_get_rmo_buffer(length, &c->kernbuf, &c->workarea_pa);
+		if (rc) {
+			free(c);
 			return rc;
+		}
 	}
 
+	c->u.dump.dump_tag = dump_tag;
+	c->u.dump.sequence = sequence;
+	c->u.dump.buffer = buffer;
+	c->u.dump.length = length;
+	c->u.dump.seq_next = seq_next;
+	c->u.dump.bytes_ret = bytes_ret;
+
 	/* Converting a 64bit host value to 32bit BE, _hi and _lo
 	 * pair is tricky: we should convert the _hi and _lo 32bits
 	 * of the 64bit host value.
 	 */
-	dump_tag_hi = htobe32(BITS32_HI(dump_tag));
-	dump_tag_lo = htobe32(BITS32_LO(dump_tag));
-
-	next_hi = htobe32(BITS32_HI(sequence));
-	next_lo = htobe32(BITS32_LO(sequence));
-
-	do {
-		rc = rtas_call_no_delay("ibm,platform-dump", 6, 5, dump_tag_hi,
-					dump_tag_lo, next_hi, next_lo,
-					htobe32(kernbuf_pa), htobe32(length),
-					&status, &next_hi, &next_lo,
-					&bytes_hi, &bytes_lo);
-		if (rc < 0)
-			break;
+	c->u.dump.dump_tag_hi = htobe32(BITS32_HI(dump_tag));
+	c->u.dump.dump_tag_lo = htobe32(BITS32_LO(dump_tag));
 
-		sequence = BITS64(be32toh(next_hi), be32toh(next_lo));
-		dbg("%s: seq_next = 0x%" PRIx64 "\n", __FUNCTION__, sequence);
-
-		rc = handle_delay(status, &elapsed);
-	} while (rc == CALL_AGAIN);
+	c->u.dump.next_hi = htobe32(BITS32_HI(sequence));
+	c->u.dump.next_lo = htobe32(BITS32_LO(sequence));
 
-	if (buffer && (rc == 0))
-		memcpy(buffer, kernbuf, length);
+	return cont_start(c, cont, delay_ms);
+}
 
-	if (kernbuf)
-		(void)rtas_free_rmo_buffer(kernbuf, kernbuf_pa, length);
+/**
+ * rtas_platform_dump
+ * Interface to the ibm,platform-dump rtas call
+ *
+ * @param dump_tag
+ * @param sequence
+ * @param buffer buffer to write dump to
+ * @param length buffer length
+ * @param next_seq
+ * @param bytes_ret
+ * @return 0 on success, !0 othwerwise
+ */
+int rtas_platform_dump(uint64_t dump_tag, uint64_t sequence, void *buffer,
+		       size_t length, uint64_t *seq_next, uint64_t *bytes_ret)
+{
+	struct rtas_continuation *cont;
+	unsigned int delay_ms;
+	int rc;
 
-	*seq_next = sequence;
-	bytes_hi = be32toh(bytes_hi);
-	bytes_lo = be32toh(bytes_lo);
-	*bytes_ret = BITS64(bytes_hi, bytes_lo);
+	rc = rtas_platform_dump_start(&cont, dump_tag, sequence, buffer,
+				      length, seq_next, bytes_ret, &delay_ms);
 
-	dbg("(0x%"PRIx64", 0x%"PRIx64", %p, %zu, %p, %p) = %d, 0x%"PRIx64", 0x%"PRIx64"\n",
-	     dump_tag, sequence, buffer, length, seq_next, bytes_ret,
-	     rc ? rc : status, *seq_next, *bytes_ret);
-	return rc ? rc : status;
+	return cont_wait(cont, rc, delay_ms);
 }
 
 /**
@@ -884,31 +1842,94 @@ int rtas_read_slot_reset(uint32_t cfg_addr, uint64_t phbid, int *state,
  */
 int rtas_scan_log_dump(void *buffer, size_t length)
 {
-	uint32_t kernbuf_pa;
-	void *kernbuf;
+	struct rtas_workarea wa;
 	int rc, status;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_get_rmo_buffer(length, &kernbuf, &kernbuf_pa);
+	rc = workarea_init(&wa, length);
 	if (rc)
 		return rc;
 
-	memcpy(kernbuf, buffer, length);
-	rc = rtas_call("ibm,scan-log-dump", 2, 1, htobe32(kernbuf_pa),
+	memcpy(wa.buf, buffer, length);
+	rc = rtas_call("ibm,scan-log-dump", 2, 1, htobe32(wa.pa),
 		       htobe32(length), &status);
 
 	if (rc == 0)
-		memcpy(buffer, kernbuf, length);
+		memcpy(buffer, wa.buf, length);
 
-	(void)rtas_free_rmo_buffer(kernbuf, kernbuf_pa, length);
+	workarea_release(&wa);
 
 	dbg("(%p, %zu) = %d\n", buffer, length, rc ? rc : status);
 	return rc ? rc : status;
 }
 
+/**
+ * rtas_scan_log_dump_wa
+ * @brief Interface to the ibm,scan-log-dump rtas call on a work area handle
+ *
+ * Like rtas_scan_log_dump(), but the dump is returned in the handle's
+ * work area.
+ *
+ * @param wa work area of at least length bytes
+ * @param length size of the scan log dump
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_scan_log_dump_wa(struct rtas_workarea *wa, size_t length)
+{
+	int rc, status;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	if (wa->size < length)
+		return RTAS_IO_ASSERT;
+
+	rc = rtas_call("ibm,scan-log-dump", 2, 1, htobe32(wa->pa),
+		       htobe32(length), &status);
+
+	dbg("(%p, %zu) = %d\n", wa->buf, length, rc ? rc : status);
+	return rc ? rc : status;
+}
+
+/**
+ * rtas_set_busy_backoff
+ * @brief Interface to set the retry policy for RC_BUSY returns
+ *
+ * Calls that get RC_BUSY from firmware are retried right away
+ * policy->spin times, then policy->yield times after yielding the
+ * cpu, and then after sleeping for min_sleep_us, doubled on every
+ * retry up to max_sleep_us. With a non-zero max_retries the call
+ * gives up after that many retries and returns RC_BUSY.
+ *
+ * @param policy new policy, or NULL to restore the defaults
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_set_busy_backoff(const struct rtas_busy_backoff *policy)
+{
+	static const struct rtas_busy_backoff defaults = BUSY_BACKOFF_DEFAULTS;
+
+	if (!policy)
+		policy = &defaults;
+
+	if (!policy->min_sleep_us || policy->min_sleep_us > policy->max_sleep_us)
+		return RTAS_IO_ASSERT;
+
+	__atomic_store_n(&busy_policy.spin, policy->spin, __ATOMIC_RELAXED);
+	__atomic_store_n(&busy_policy.yield, policy->yield, __ATOMIC_RELAXED);
+	__atomic_store_n(&busy_policy.min_sleep_us, policy->min_sleep_us,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&busy_policy.max_sleep_us, policy->max_sleep_us,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&busy_policy.max_retries, policy->max_retries,
+			 __ATOMIC_RELAXED);
+
+	return 0;
+}
+
 /**
  * rtas_set_debug
  * @brief Interface to set librtas debug level
@@ -918,7 +1939,7 @@ int rtas_scan_log_dump(void *buffer, size_t length)
  */
 int rtas_set_debug(int level)
 {
-	dbg_lvl = level;
+	__atomic_store_n(&dbg_lvl, level, __ATOMIC_RELAXED);
 	return 0;
 }
 
@@ -981,6 +2002,9 @@ int rtas_set_eeh_option(uint32_t cfg_addr, uint64_t phbid, int function)
 		       htobe32(BITS32_HI(phbid)), htobe32(BITS32_LO(phbid)),
 		       htobe32(function), &status);
 
+	/* The slot state and config addresses may change with it */
+	result_cache_invalidate();
+
 	dbg("(0x%x, 0x%"PRIx64", %d) = %d\n", cfg_addr, phbid, function,
 	     rc ? rc : status);
 	return rc ? rc : status;
@@ -1032,6 +2056,8 @@ int rtas_set_power_level(int powerdomain, int level, int *setlevel)
 	rc = rtas_call("set-power-level", 2, 2, htobe32(powerdomain),
 		       htobe32(level), &status, &be_setlevel);
 
+	result_cache_invalidate();
+
 	*setlevel = be32toh(be_setlevel);
 
 	dbg("(%d, %d, %p) = %d, %d\n", powerdomain, level, setlevel,
@@ -1115,10 +2141,36 @@ int rtas_suspend_me(uint64_t streamid)
 	rc = rtas_call("ibm,suspend-me", 2, 1, htobe32(BITS32_HI(streamid)),
 		       htobe32(BITS32_LO(streamid)), &status);
 
+	/* The partition may have resumed on a different firmware level */
+	if (rc == 0 && status == 0)
+		token_cache_invalidate();
+
 	dbg("() = %d\n", rc ? rc : status);
 	return rc ? rc : status;
 }
 
+/**
+ * update_call
+ * @brief Run ibm,update-nodes or ibm,update-properties on a work area
+ *
+ * @param name call name
+ * @param wa
+ * @param scope of call
+ * @param status reference to the rtas status
+ * @return 0 on success, !0 otherwise
+ */
+static int update_call(const char *name, struct rtas_workarea *wa,
+		       unsigned int scope, int *status)
+{
+	int rc;
+
+	rc = rtas_call(name, 2, 1, htobe32(wa->pa), htobe32(scope), status);
+	if (rc == 0)
+		token_cache_invalidate();
+
+	return rc;
+}
+
 /**
  * rtas_update_nodes
  * @brief Interface for ibm,update-nodes rtas call
@@ -1129,32 +2181,57 @@ int rtas_suspend_me(uint64_t streamid)
  */
 int rtas_update_nodes(char *workarea, unsigned int scope)
 {
-	uint32_t workarea_pa;
-	void *kernbuf;
+	struct rtas_workarea wa;
 	int rc, status;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_get_rmo_buffer(WORK_AREA_SIZE, &kernbuf, &workarea_pa);
+	rc = workarea_init(&wa, WORK_AREA_SIZE);
 	if (rc)
 		return rc;
 
-	memcpy(kernbuf, workarea, WORK_AREA_SIZE);
-
-	rc = rtas_call("ibm,update-nodes", 2, 1, htobe32(workarea_pa),
-		       htobe32(scope), &status);
+	memcpy(wa.buf, workarea, WORK_AREA_SIZE);
 
+	rc = update_call("ibm,update-nodes", &wa, scope, &status);
 	if (rc == 0)
-		memcpy(workarea, kernbuf, WORK_AREA_SIZE);
+		memcpy(workarea, wa.buf, WORK_AREA_SIZE);
 
-	(void)rtas_free_rmo_buffer(kernbuf, workarea_pa, WORK_AREA_SIZE);
+	workarea_release(&wa);
 
 	dbg("(%p) %u = %d\n", workarea, scope, rc ? rc : status);
 	return rc ? rc : status;
 }
 
+/**
+ * rtas_update_nodes_wa
+ * @brief Interface for ibm,update-nodes rtas call on a work area handle
+ *
+ * Like rtas_update_nodes(), but firmware works on the handle's work area
+ * in place.
+ *
+ * @param wa work area of at least 4096 bytes
+ * @param scope of call
+ * @return 0 on success, !0 on failure
+ */
+int rtas_update_nodes_wa(struct rtas_workarea *wa, unsigned int scope)
+{
+	int rc, status;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	if (wa->size < WORK_AREA_SIZE)
+		return RTAS_IO_ASSERT;
+
+	rc = update_call("ibm,update-nodes", wa, scope, &status);
+
+	dbg("(%p) %u = %d\n", wa->buf, scope, rc ? rc : status);
+	return rc ? rc : status;
+}
+
  /**
  * rtas_update_properties
  * @brief Interface for ibm,update-properties rtas call
@@ -1165,91 +2242,175 @@ int rtas_update_nodes(char *workarea, unsigned int scope)
  */
 int rtas_update_properties(char *workarea, unsigned int scope)
 {
-	uint32_t workarea_pa;
-	void *kernbuf;
+	struct rtas_workarea wa;
 	int rc, status;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	rc = rtas_get_rmo_buffer(WORK_AREA_SIZE, &kernbuf, &workarea_pa);
+	rc = workarea_init(&wa, WORK_AREA_SIZE);
 	if (rc)
 		return rc;
 
-	memcpy(kernbuf, workarea, WORK_AREA_SIZE);
-
-	rc = rtas_call("ibm,update-properties", 2, 1, htobe32(workarea_pa),
-		       htobe32(scope), &status);
+	memcpy(wa.buf, workarea, WORK_AREA_SIZE);
 
+	rc = update_call("ibm,update-properties", &wa, scope, &status);
 	if (rc == 0)
-		memcpy(workarea, kernbuf, WORK_AREA_SIZE);
+		memcpy(workarea, wa.buf, WORK_AREA_SIZE);
 
-	(void)rtas_free_rmo_buffer(kernbuf, workarea_pa, WORK_AREA_SIZE);
+	workarea_release(&wa);
 
 	dbg("(%p) %u = %d\n", workarea, scope, rc ? rc : status);
 	return rc ? rc : status;
 }
 
 /**
- * rtas_physical_attestation
- * @brief Interface for ibm,physical-attestation rtas call.
+ * rtas_update_properties_wa
+ * @brief Interface for ibm,update-properties rtas call on a work area handle
  *
- * @param workarea input/output work area for rtas call
- * @param seq_num sequence number of the rtas call
- * @param next_seq_num next sequence number
- * @param work_area_bytes size of work area
+ * Like rtas_update_properties(), but firmware works on the handle's work area
+ * in place.
+ *
+ * @param wa work area of at least 4096 bytes
+ * @param scope of call
  * @return 0 on success, !0 on failure
  */
-int rtas_physical_attestation(char *workarea, int seq_num, int *next_seq_num,
-			      int *work_area_bytes)
+int rtas_update_properties_wa(struct rtas_workarea *wa, unsigned int scope)
 {
-	uint32_t workarea_pa;
-	uint64_t elapsed = 0;
-	void *kernbuf;
-	int kbuf_sz = WORK_AREA_SIZE;
 	int rc, status;
-	int resp_bytes = *work_area_bytes;
 
 	rc = sanity_check();
 	if (rc)
 		return rc;
 
-	/* Caller provided more data than FW can handle */
-	if (*work_area_bytes == 0 ||
-	    *work_area_bytes > kbuf_sz)
+	if (wa->size < WORK_AREA_SIZE)
 		return RTAS_IO_ASSERT;
 
-	rc = rtas_get_rmo_buffer(kbuf_sz, &kernbuf, &workarea_pa);
-	if (rc)
-		return rc;
-	memcpy(kernbuf, workarea, *work_area_bytes);
+	rc = update_call("ibm,update-properties", wa, scope, &status);
 
-	do {
-		rc = rtas_call("ibm,physical-attestation", 3, 3,
-			       htobe32(workarea_pa), htobe32(kbuf_sz),
-			       htobe32(seq_num),
-			       &status, next_seq_num, &resp_bytes);
-		if (rc < 0)
-			break;
+	dbg("(%p) %u = %d\n", wa->buf, scope, rc ? rc : status);
+	return rc ? rc : status;
+}
 
-		rc = handle_delay(status, &elapsed);
-	} while (rc == CALL_AGAIN);
+static int physical_attestation_step(struct rtas_continuation *cont)
+{
+	return rtas_call_no_delay("ibm,physical-attestation", 3, 3,
+				  htobe32(cont->workarea_pa),
+				  htobe32(cont->u.attest.kbuf_sz),
+				  htobe32(cont->u.attest.seq_num),
+				  &cont->status, cont->u.attest.next_seq_num,
+				  &cont->u.attest.resp_bytes);
+}
+
+static void physical_attestation_release(struct rtas_continuation *cont)
+{
+	(void)rtas_free_rmo_buffer(cont->kernbuf, cont->workarea_pa,
+				   cont->u.attest.kbuf_sz);
+}
+
+static int physical_attestation_finish(struct rtas_continuation *cont, int rc)
+{
+	int *work_area_bytes = cont->u.attest.work_area_bytes;
+	int resp_bytes = cont->u.attest.resp_bytes;
 
-	*next_seq_num = be32toh(*next_seq_num);
+	*cont->u.attest.next_seq_num = be32toh(*cont->u.attest.next_seq_num);
 
 	/* FW returned more data than we can handle */
 	if (be32toh(resp_bytes) > (unsigned int)*work_area_bytes) {
-		(void)rtas_free_rmo_buffer(kernbuf, workarea_pa, kbuf_sz);
+		physical_attestation_release(cont);
 		return RTAS_IO_ASSERT;
 	}
 
 	*work_area_bytes = be32toh(resp_bytes);
 
 	if (rc == 0)
-		memcpy(workarea, kernbuf, *work_area_bytes);
+		memcpy(cont->u.attest.workarea, cont->kernbuf,
+		       *work_area_bytes);
 
-	(void)rtas_free_rmo_buffer(kernbuf, workarea_pa, kbuf_sz);
+	physical_attestation_release(cont);
 
-	return rc ? rc : status;
+	return rc ? rc : cont->status;
+}
+
+/**
+ * rtas_physical_attestation_start
+ * @brief Non-blocking interface for ibm,physical-attestation rtas call.
+ *
+ * Like rtas_physical_attestation(), but returns RTAS_AGAIN instead of
+ * sleeping when firmware asks for a delay; see rtas_resume().
+ *
+ * @param cont reference to the continuation for rtas_resume()
+ * @param workarea input/output work area for rtas call
+ * @param seq_num sequence number of the rtas call
+ * @param next_seq_num next sequence number
+ * @param work_area_bytes size of work area
+ * @param delay_ms reference to the requested delay in milli-seconds
+ * @return RTAS_AGAIN if the call has to be resumed,
+ *	otherwise as rtas_physical_attestation()
+ */
+int rtas_physical_attestation_start(struct rtas_continuation **cont,
+				    char *workarea, int seq_num,
+				    int *next_seq_num, int *work_area_bytes,
+				    unsigned int *delay_ms)
+{
+	struct rtas_continuation *c;
+	int kbuf_sz = WORK_AREA_SIZE;
+	int rc;
+
+	*cont = NULL;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	/* Caller provided more data than FW can handle */
+	if (*work_area_bytes == 0 ||
+	    *work_area_bytes > kbuf_sz)
+		return RTAS_IO_ASSERT;
+
+	c = cont_new(physical_attestation_step, physical_attestation_finish,
+		     physical_attestation_release);
+	if (!c)
+		return RTAS_NO_MEM;
+
+	rc = rtas_get_rmo_buffer(kbuf_sz, &c->kernbuf, &c->workarea_pa);
+	if (rc) {
+		free(c);
+		return rc;
+	}
+	memcpy(c->kernbuf, workarea, *work_area_bytes);
+
+	c->u.attest.workarea = workarea;
+	c->u.attest.kbuf_sz = kbuf_sz;
+	c->u.attest.seq_num = seq_num;
+	c->u.attest.next_seq_num = next_seq_num;
+	c->u.attest.work_area_bytes = work_area_bytes;
+	c->u.attest.resp_bytes = *work_area_bytes;
+
+	return cont_start(c, cont, delay_ms);
+}
+
+/**
+ * rtas_physical_attestation
+ * @brief Interface for ibm,physical-attestation rtas call.
+ *
+ * @param workarea input/output work area for rtas call
+ * @param seq_num sequence number of the rtas call
+ * @param next_seq_num next sequence number
+ * @param work_area_bytes size of work area
+ * @return 0 on success, !0 on failure
+ */
+int rtas_physical_attestation(char *workarea, int seq_num, int *next_seq_num,
+			      int *work_area_bytes)
+{
+	struct rtas_continuation *cont;
+	unsigned int delay_ms;
+	int rc;
+
+	rc = rtas_physical_attestation_start(&cont, workarea, seq_num,
+					     next_seq_num, work_area_bytes,
+					     &delay_ms);
+
+	return cont_wait(cont, rc, delay_ms);
 }
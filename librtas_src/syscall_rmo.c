@@ -22,33 +22,118 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <inttypes.h>
+#include <linux/futex.h>
 #include "internal.h"
 #include "librtas.h"
+#include "probes.h"
 
-#define MAX_PAGES 64
+#define MAX_PAGES 4096
 #define MAX_PATH_LEN 80
 
+#define BITS_PER_WORD 64
+#define BITS_TO_WORDS(_n) (((_n) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+
+#define SHM_RMO_MAGIC 0x524d4f31	/* "RMO1" */
+#define SHM_RMO_RETRY_MS 10
+
+/*
+ * How long to wait for other threads to release work areas when every
+ * busy page belongs to this process. A caller that leaked them all
+ * itself gets an error instead of hanging.
+ */
+#define WA_LOCAL_WAIT_MS 1000
+
+/*
+ * Page map shared by all processes that opted in to the shared
+ * allocator. It is protected by a robust process-shared mutex; waiters
+ * for free pages sleep on the free_seq futex word.
+ */
+struct shm_rmo_area {
+	uint32_t magic;
+	uint32_t n_pages;
+	uint64_t region_addr;
+	pthread_mutex_t lock;
+	uint32_t free_seq;
+	uint32_t waiters;
+	uint64_t pages_map[BITS_TO_WORDS(MAX_PAGES)];
+	pid_t owner[MAX_PAGES];
+};
+
+/*
+ * Recently freed single work areas are parked in a per-thread slot and
+ * handed back to the same thread without taking any lock. The pages
+ * stay allocated while they are parked, so a reaper thread returns any
+ * page parked for longer than WA_CACHE_PARK_MS. When the region runs
+ * short, all parked pages are returned at once.
+ *
+ * Pages are never parked when other processes could be waiting for
+ * them: not on the lockfile path, whose waiters cannot be seen, and not
+ * while the shared page map has waiters.
+ */
+#define WA_CACHE_EMPTY SIZE_MAX
+#define WA_CACHE_PARK_MS 5
+
+struct wa_thread_cache {
+	size_t page;			/* accessed atomically */
+	uint64_t parked_ns;		/* accessed atomically */
+	struct wa_thread_cache *next;
+	struct wa_thread_cache **pprev;
+};
+
+/*
+ * wa_lock protects initialization, the process-local pages_map and the
+ * list of thread caches. The shared page map has its own lock.
+ */
 struct workarea_config {
 	int init_done;
 	int lockfile_fd;
+	int use_shm;
+	const struct rtas_backend *backend;	/* that mapped the region */
 	struct region kern_region;
-	uint64_t pages_map;
+	void *kern_map;
+	struct shm_rmo_area *shm;
+	size_t n_pages;
+	uint64_t pages_map[BITS_TO_WORDS(MAX_PAGES)];
+	uint64_t cached_map[BITS_TO_WORDS(MAX_PAGES)];
+	struct wa_thread_cache *caches;
 };
 
 static const char *rmo_filename = "rmo_buffer";
 static const char *devmem_path = "/dev/mem";
 static const char *lockfile_path = "/var/lock/LCK..librtas";
+static const char *shm_rmo_name = "/librtas-rmo";
 
 static struct workarea_config wa_config = {
 	.lockfile_fd = -1,
 	.init_done = 0,
-	.pages_map = 0ll,
+	.use_shm = 0,
+	.kern_map = NULL,
+	.shm = NULL,
+	.n_pages = 0,
+	.caches = NULL,
 };
 
+static pthread_mutex_t wa_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wa_released = PTHREAD_COND_INITIALIZER;
+static pthread_key_t wa_cache_key;
+static pthread_once_t wa_cache_key_once = PTHREAD_ONCE_INIT;
+static __thread struct wa_thread_cache *wa_cache;
+static int wa_reaper_started;		/* protected by wa_lock */
+static uint32_t wa_reaper_seq;		/* futex word, bumped on park */
+static uint32_t wa_reaper_idle;
+
 /**
  * open_proc_rtas_file
  * @brief Open the proc rtas file
@@ -79,13 +164,14 @@ static int open_proc_rtas_file(const char *name, int mode)
 }
 
 /**
- * read_kregion_bounds
+ * native_rmo_bounds
  * @brief Read the kernel region bounds for RMO memory
  *
  * @param kregion
  * @return 0 on success, !0 otherwise
  */
-static int read_kregion_bounds(struct region *kregion)
+__attribute__((visibility("hidden")))
+int native_rmo_bounds(struct region *kregion)
 {
 	char *buf;
 	int fd;
@@ -94,6 +180,7 @@ static int read_kregion_bounds(struct region *kregion)
 	fd = open_proc_rtas_file(rmo_filename, O_RDONLY);
 	if (fd < 0) {
 		dbg("Could not open workarea file\n");
+		interface_invalidate();
 		return RTAS_IO_ASSERT;
 	}
 
@@ -107,48 +194,152 @@ static int read_kregion_bounds(struct region *kregion)
 	sscanf(buf, "%" SCNx64 " %x", &kregion->addr, &kregion->size);
 	free(buf);
 
-	if (!(kregion->size && kregion->addr) ||
-	    (kregion->size > (WORK_AREA_SIZE * MAX_PAGES))) {
-		dbg("Unexpected kregion bounds\n");
-		return RTAS_IO_ASSERT;
-	}
-
 	return 0;
 }
 
 /**
- * get_bits
+ * word_mask
+ * @brief Mask of the bits in [lobit, hibit) that fall into word @word
  *
+ * @param word
  * @param lobit
  * @param hibit
- * @param mask
- * @return 0 on success, !0 otherwise
+ * @return bit mask
+ */
+static uint64_t word_mask(size_t word, size_t lobit, size_t hibit)
+{
+	size_t first = word * BITS_PER_WORD;
+	uint64_t mask = ~0ull;
+
+	if (lobit > first)
+		mask &= ~0ull << (lobit - first);
+	if (hibit < first + BITS_PER_WORD)
+		mask &= ~0ull >> (first + BITS_PER_WORD - hibit);
+
+	return mask;
+}
+
+/**
+ * load_word
+ * @brief Read a bitmap word, inverted when looking for clear bits
+ *
+ * @param map
+ * @param word
+ * @param value
+ * @return word contents
+ */
+static uint64_t load_word(const uint64_t *map, size_t word, int value)
+{
+	uint64_t bits = __atomic_load_n(&map[word], __ATOMIC_RELAXED);
+
+	return value ? bits : ~bits;
+}
+
+/**
+ * find_bit
+ * @brief Find the first bit at or after @start that equals @value
+ *
+ * Whole words are skipped at a time, the position inside a word is
+ * found with a count-trailing-zeros.
+ *
+ * @param map
+ * @param nbits number of valid bits in map
+ * @param start
+ * @param value 0 to look for a clear bit, 1 for a set bit
+ * @return bit number, or nbits if there is none
  */
-static uint64_t get_bits(short lobit, short hibit, uint64_t mask)
+static size_t find_bit(const uint64_t *map, size_t nbits, size_t start,
+		       int value)
 {
-	short num_bits = hibit - lobit + 1;
-	uint64_t ones_mask = (1ll << (num_bits)) - 1;
+	size_t i = start / BITS_PER_WORD;
+	uint64_t word;
 
-	return ((mask >> lobit) & ones_mask);
+	if (start >= nbits)
+		return nbits;
+
+	word = load_word(map, i, value) & word_mask(i, start, nbits);
+	while (!word) {
+		if (++i >= BITS_TO_WORDS(nbits))
+			return nbits;
+		word = load_word(map, i, value) & word_mask(i, 0, nbits);
+	}
+
+	return i * BITS_PER_WORD + __builtin_ctzll(word);
 }
 
 /**
  * set_bits
+ * @brief Set or clear the bits in [lobit, hibit)
  *
+ * @param map
  * @param lobit
  * @param hibit
  * @param value
- * @param mask
- * @return 0 on success, !0 otherwise
  */
-static void set_bits(short lobit, short hibit, uint64_t value,
-			    uint64_t *mask)
+static void set_bits(uint64_t *map, size_t lobit, size_t hibit, int value)
+{
+	size_t i;
+
+	/*
+	 * Writers hold a lock, but the work area cache peeks at bits
+	 * without one, so update the words atomically.
+	 */
+	for (i = lobit / BITS_PER_WORD; i < BITS_TO_WORDS(hibit); i++) {
+		if (value)
+			__atomic_fetch_or(&map[i], word_mask(i, lobit, hibit),
+					  __ATOMIC_RELAXED);
+		else
+			__atomic_fetch_and(&map[i], ~word_mask(i, lobit, hibit),
+					   __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * bits_all_set
+ * @brief Check whether every bit in [lobit, hibit) is set
+ *
+ * @param map
+ * @param lobit
+ * @param hibit
+ * @return 1 if all bits are set, 0 otherwise
+ */
+static int bits_all_set(const uint64_t *map, size_t lobit, size_t hibit)
+{
+	size_t i;
+
+	for (i = lobit / BITS_PER_WORD; i < BITS_TO_WORDS(hibit); i++) {
+		uint64_t mask = word_mask(i, lobit, hibit);
+
+		if ((load_word(map, i, 1) & mask) != mask)
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * find_free_run
+ * @brief First-fit search for @n clear bits in a row
+ *
+ * @param map
+ * @param nbits number of valid bits in map
+ * @param start
+ * @param n
+ * @return first bit of the run, or nbits if there is none
+ */
+static size_t find_free_run(const uint64_t *map, size_t nbits, size_t start,
+			    size_t n)
 {
-	short num_bits = hibit - lobit + 1;
-	uint64_t ones_mask = (1ll << (num_bits)) - 1;
+	size_t lo, hi;
 
-	*mask &= ~(ones_mask << lobit);
-	*mask |= value << lobit;
+	for (lo = find_bit(map, nbits, start, 0); lo < nbits;
+	     lo = find_bit(map, nbits, hi, 0)) {
+		hi = find_bit(map, nbits, lo, 1);
+		if (hi - lo >= n)
+			return lo;
+	}
+
+	return nbits;
 }
 
 /**
@@ -156,22 +347,17 @@ static void set_bits(short lobit, short hibit, uint64_t value,
  *
  * @param start
  * @param size
+ * @param wait block until the range is available
  * @return 0 on success, !0 otherwise
  */
-static int acquire_file_lock(off_t start, size_t size)
+static int acquire_file_lock(off_t start, size_t size, int wait)
 {
 	struct flock flock;
 	int rc;
 
-	/* Lazily open lock file */
-	if (wa_config.lockfile_fd < 0) {
-		wa_config.lockfile_fd = open(lockfile_path, O_CREAT | O_RDWR,
-					     S_IRUSR | S_IWUSR);
-		if (wa_config.lockfile_fd < 0) {
-			dbg("could not open lockfile %s\n", lockfile_path);
-			return RTAS_IO_ASSERT;
-		}
-	}
+	/* Nobody else can see a private region */
+	if (wa_config.backend->rmo_private)
+		return 0;
 
 	flock.l_start = start;
 	flock.l_type = F_WRLCK;
@@ -179,7 +365,7 @@ static int acquire_file_lock(off_t start, size_t size)
 	flock.l_len = size;
 	flock.l_pid = getpid();
 
-	rc = fcntl(wa_config.lockfile_fd, F_SETLKW, &flock);
+	rc = fcntl(wa_config.lockfile_fd, wait ? F_SETLKW : F_SETLK, &flock);
 	if (rc < 0) {
 		/* Expected to fail for regions used by other processes */
 		dbg("fcntl failed for [0x%llx, 0x%zx]\n", (unsigned long long)start, size);
@@ -201,6 +387,9 @@ static int release_file_lock(off_t start, size_t size)
 	struct flock flock;
 	int rc;
 
+	if (wa_config.backend->rmo_private)
+		return 0;
+
 	flock.l_start = start;
 	flock.l_type = F_UNLCK;
 	flock.l_whence = SEEK_SET;
@@ -217,279 +406,1410 @@ static int release_file_lock(off_t start, size_t size)
 }
 
 /**
- * get_phys_region
+ * next_unlocked_page
+ * @brief Find where to continue after a lock held by another process
  *
+ * @param start
  * @param size
- * @param phys_addr
- * @return 0 on success, !0 otherwise
+ * @return page to resume the search at
  */
-static int get_phys_region(size_t size, uint32_t * phys_addr)
+static size_t next_unlocked_page(off_t start, size_t size)
 {
-	struct region *kregion = &wa_config.kern_region;
-	const size_t n_pages = size / WORK_AREA_SIZE;
-	uint32_t addr = 0;
-	uint64_t bits;
-
-	if (size > kregion->size) {
-		dbg("Invalid buffer size 0x%zx requested\n", size);
-		return RTAS_IO_ASSERT;
-	}
+	struct flock flock;
 
-	for (size_t i = 0; i < MAX_PAGES; i++) {
-		if ((i * WORK_AREA_SIZE) >= kregion->size)
-			break;
+	flock.l_start = start;
+	flock.l_type = F_WRLCK;
+	flock.l_whence = SEEK_SET;
+	flock.l_len = size;
+	flock.l_pid = 0;
 
-		bits = get_bits(i, i + n_pages - 1, wa_config.pages_map);
-		if (bits == 0ll) {
-			if (acquire_file_lock(i, n_pages) == 0) {
-				set_bits(i, i + n_pages - 1,
-					 (1 << n_pages) - 1,
-					 &wa_config.pages_map);
-				addr = kregion->addr + (i * WORK_AREA_SIZE);
-				break;
-			}
-		}
-	}
+	if (fcntl(wa_config.lockfile_fd, F_GETLK, &flock) < 0 ||
+	    flock.l_type == F_UNLCK)
+		return start + 1;
 
-	if (!addr) {
-		dbg("Could not find available workarea space\n");
-		return RTAS_IO_ASSERT;
-	}
+	/* A lock to the end of the file covers every remaining page */
+	if (flock.l_len == 0)
+		return wa_config.n_pages;
 
-	*phys_addr = addr;
-	return 0;
+	return flock.l_start + flock.l_len;
 }
 
 /**
- * release_phys_region
+ * elapsed_ms
+ * @brief Milliseconds since @start on the monotonic clock
  *
- * @param phys_addr
- * @param size
- * @return 0 on success, !0 otherwise
+ * @param start
+ * @return elapsed time
  */
-static int release_phys_region(uint32_t phys_addr, size_t size)
+static uint64_t elapsed_ms(const struct timespec *start)
 {
-	struct region *kregion = &wa_config.kern_region;
-	const size_t n_pages = size / WORK_AREA_SIZE;
-	int first_page;
-	uint64_t bits;
-	int rc;
-
-	if (size > kregion->size) {
-		dbg("Invalid buffer size 0x%zx requested\n", size);
-		return RTAS_IO_ASSERT;
-	}
-
-	first_page = (phys_addr - kregion->addr) / WORK_AREA_SIZE;
+	struct timespec now;
 
-	bits = get_bits(first_page, first_page + n_pages - 1,
-			wa_config.pages_map);
-	if (bits != ((1UL << n_pages) - 1)) {
-		dbg("Invalid region [0x%x, 0x%zx]\n", phys_addr, size);
-		return RTAS_IO_ASSERT;
-	}
-
-	set_bits(first_page, first_page + n_pages - 1, 0, &wa_config.pages_map);
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	rc = release_file_lock(first_page, n_pages);
-
-	return rc;
+	return (now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000;
 }
 
 /**
- * init_workarea_config
+ * shm_rmo_lock
+ * @brief Take the shared page map lock, recovering it if its holder died
  *
+ * @param area
  * @return 0 on success, !0 otherwise
  */
-static int init_workarea_config(void)
+static int shm_rmo_lock(struct shm_rmo_area *area)
 {
 	int rc;
 
-	/* Read bounds of reserved kernel region */
-	rc = read_kregion_bounds(&wa_config.kern_region);
-	if (rc)
-		return rc;
+	rc = pthread_mutex_lock(&area->lock);
+	if (rc == EOWNERDEAD) {
+		/*
+		 * Owners are recorded before pages are marked busy and
+		 * cleared after, so a holder that died mid-update leaves
+		 * at most pages owned by a dead process behind. Those
+		 * are reclaimed lazily by shm_rmo_reclaim().
+		 */
+		dbg("Recovering shared RMO map from dead holder\n");
+		rc = pthread_mutex_consistent(&area->lock);
+	}
 
-	wa_config.init_done = 1;
+	if (rc) {
+		dbg("Could not lock shared RMO map, rc=%d\n", rc);
+		return RTAS_IO_ASSERT;
+	}
 
 	return 0;
 }
 
 /**
- * mmap_dev_mem
+ * shm_rmo_reclaim
+ * @brief Release pages still owned by processes that no longer exist
  *
- * @param phys_addr
- * @param size
- * @param buf
- * @return 0 on success, !0 otherwise
+ * Must be called with the shared page map locked.
+ *
+ * @param area
+ * @return number of pages reclaimed
  */
-static int mmap_dev_mem(uint32_t phys_addr, size_t size, void **buf)
+static size_t shm_rmo_reclaim(struct shm_rmo_area *area)
 {
-	void *newbuf;
-	int fd;
-
-	fd = open(devmem_path, O_RDWR);
-	if (fd < 0) {
-		dbg("Failed to open %s\n", devmem_path);
-		return RTAS_IO_ASSERT;
+	size_t reclaimed = 0;
+	size_t i;
+
+	for (i = find_bit(area->pages_map, area->n_pages, 0, 1);
+	     i < area->n_pages;
+	     i = find_bit(area->pages_map, area->n_pages, i + 1, 1)) {
+		if (area->owner[i] > 0 &&
+		    (kill(area->owner[i], 0) == 0 || errno != ESRCH))
+			continue;
+
+		dbg("Reclaiming page %zu of dead process %d\n", i,
+		    (int)area->owner[i]);
+		set_bits(area->pages_map, i, i + 1, 0);
+		area->owner[i] = 0;
+		reclaimed++;
 	}
 
-	newbuf = mmap((void *)0, size, PROT_READ | PROT_WRITE,
-		      MAP_SHARED, fd, phys_addr);
-	close(fd);
+	return reclaimed;
+}
 
-	if (newbuf == MAP_FAILED) {
-		dbg("mmap failed\n");
-		return RTAS_IO_ASSERT;
+/**
+ * shm_rmo_foreign
+ * @brief Check whether another process owns pages in the shared map
+ *
+ * Must be called with the shared page map locked.
+ *
+ * @param area
+ * @return 1 if another process owns pages, 0 otherwise
+ */
+static int shm_rmo_foreign(struct shm_rmo_area *area)
+{
+	pid_t pid = getpid();
+	size_t i;
+
+	for (i = find_bit(area->pages_map, area->n_pages, 0, 1);
+	     i < area->n_pages;
+	     i = find_bit(area->pages_map, area->n_pages, i + 1, 1)) {
+		if (area->owner[i] != pid)
+			return 1;
 	}
 
-	*buf = newbuf;
 	return 0;
 }
 
 /**
- * munmap_dev_mem
+ * shm_rmo_wake
+ * @brief Wake processes waiting for pages in the shared map
+ *
+ * @param area
+ */
+static void shm_rmo_wake(struct shm_rmo_area *area)
+{
+	__atomic_add_fetch(&area->free_seq, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&area->waiters, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &area->free_seq, FUTEX_WAKE, INT_MAX,
+			NULL, NULL, 0);
+}
+
+/**
+ * shm_rmo_attach
+ * @brief Map (and create if needed) the shared page map
+ *
+ * The segment is initialized under an exclusive flock() so that
+ * concurrent first users agree on its contents. A segment owned by
+ * another user, or open to others, is refused and the caller falls
+ * back to the lock file.
  *
- * @param buf
- * @param size
  * @return 0 on success, !0 otherwise
  */
-static int munmap_dev_mem(void *buf, size_t size)
+static int shm_rmo_attach(void)
 {
-	int rc;
+	struct shm_rmo_area *area;
+	pthread_mutexattr_t attr;
+	struct stat statbuf;
+	int rc = RTAS_IO_ASSERT;
 	int fd;
 
-	fd = open(devmem_path, O_RDWR);
+	fd = shm_open(shm_rmo_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
 	if (fd < 0) {
-		dbg("Failed to open %s\n", devmem_path);
+		dbg("Failed to open shared memory %s\n", shm_rmo_name);
 		return RTAS_IO_ASSERT;
 	}
 
-	rc = munmap(buf, size);
-	close(fd);
-	if (rc < 0) {
-		dbg("munmap failed\n");
-		return RTAS_IO_ASSERT;
+	/*
+	 * Another user could have created the segment first and would
+	 * then control our page map and lock. Only trust a segment that
+	 * we own and that nobody else can open, and check before taking
+	 * the flock() a foreign owner could hold forever.
+	 */
+	if (fstat(fd, &statbuf))
+		goto out_close;
+
+	if (statbuf.st_uid != geteuid() || (statbuf.st_mode & 077)) {
+		dbg("Shared memory %s not private to uid %u\n", shm_rmo_name,
+		    (unsigned int)geteuid());
+		goto out_close;
 	}
 
-	return 0;
+	if (flock(fd, LOCK_EX))
+		goto out_close;
+
+	if (fstat(fd, &statbuf))
+		goto out_unlock;
+
+	if ((size_t)statbuf.st_size < sizeof(*area) &&
+	    ftruncate(fd, sizeof(*area)))
+		goto out_unlock;
+
+	area = mmap(NULL, sizeof(*area), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	if (area == MAP_FAILED) {
+		dbg("mmap of shared RMO map failed\n");
+		goto out_unlock;
+	}
+
+	if (area->magic != SHM_RMO_MAGIC) {
+		memset(area, 0, sizeof(*area));
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&area->lock, &attr);
+		pthread_mutexattr_destroy(&attr);
+		area->region_addr = wa_config.kern_region.addr;
+		area->n_pages = wa_config.n_pages;
+		area->magic = SHM_RMO_MAGIC;
+	}
+
+	if (area->region_addr != wa_config.kern_region.addr ||
+	    area->n_pages != wa_config.n_pages) {
+		dbg("Shared RMO map describes a different region\n");
+		munmap(area, sizeof(*area));
+		goto out_unlock;
+	}
+
+	wa_config.shm = area;
+	rc = 0;
+
+out_unlock:
+	flock(fd, LOCK_UN);
+out_close:
+	close(fd);
+	return rc;
 }
 
 /**
- * interface_exists
+ * shm_get_phys_region
+ * @brief Allocate pages through the shared page map
  *
+ * Processes using the shared map still lock their pages in the lock
+ * file, so librtas versions that only know the lock file keep working
+ * alongside. The common case is one non-blocking fcntl() per
+ * allocation.
+ *
+ * @param n_pages
+ * @param first_page
+ * @param wait block until pages are available
  * @return 0 on success, !0 otherwise
+ *	RTAS_NO_LOWMEM - No pages available and wait is not set
  */
-int interface_exists(void)
+static int shm_get_phys_region(size_t n_pages, size_t *first_page, int wait)
 {
-	int fd = open_proc_rtas_file(rmo_filename, O_RDONLY);
-	int exists;
+	struct shm_rmo_area *area = wa_config.shm;
+	const size_t nbits = area->n_pages;
+	struct timespec timeout;
+	struct timespec start;
+	int foreign;
+	uint32_t seq;
+	size_t i;
+	int rc;
 
-	exists = (fd >= 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	if (exists)
-		close(fd);
+	for (;;) {
+		rc = shm_rmo_lock(area);
+		if (rc)
+			return rc;
 
-	return exists;
+		foreign = 0;
+		for (i = find_free_run(area->pages_map, nbits, 0, n_pages);
+		     i < nbits;
+		     i = find_free_run(area->pages_map, nbits, i, n_pages)) {
+			if (acquire_file_lock(i, n_pages, 0) == 0)
+				break;
+
+			/* Locked by a process not using the shared map */
+			foreign = 1;
+			i = next_unlocked_page(i, n_pages);
+		}
+
+		if (i < nbits) {
+			pid_t pid = getpid();
+			size_t j;
+
+			for (j = i; j < i + n_pages; j++)
+				area->owner[j] = pid;
+			set_bits(area->pages_map, i, i + n_pages, 1);
+			pthread_mutex_unlock(&area->lock);
+
+			*first_page = i;
+			return 0;
+		}
+
+		if (shm_rmo_reclaim(area)) {
+			pthread_mutex_unlock(&area->lock);
+			continue;
+		}
+
+		if (!wait) {
+			pthread_mutex_unlock(&area->lock);
+			return RTAS_NO_LOWMEM;
+		}
+
+		if (!foreign && !shm_rmo_foreign(area) &&
+		    elapsed_ms(&start) >= WA_LOCAL_WAIT_MS) {
+			pthread_mutex_unlock(&area->lock);
+			dbg("Could not find available workarea space\n");
+			return RTAS_IO_ASSERT;
+		}
+
+		/*
+		 * Wait for a release. Releases by lock file users do not
+		 * wake the futex, so poll periodically as well.
+		 */
+		seq = __atomic_load_n(&area->free_seq, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&area->waiters, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&area->lock);
+
+		timeout.tv_sec = 0;
+		timeout.tv_nsec = SHM_RMO_RETRY_MS * 1000000L;
+		syscall(SYS_futex, &area->free_seq, FUTEX_WAIT, seq, &timeout,
+			NULL, 0);
+		__atomic_sub_fetch(&area->waiters, 1, __ATOMIC_SEQ_CST);
+	}
 }
 
 /**
- * rtas_free_rmo_buffer
- * @brief free the rmo buffer used by librtas
+ * shm_release_phys_region
+ * @brief Return pages to the shared page map
  *
- * @param buf virtual address of mmap()'ed buffer
- * @param phys_addr physical address of low mem buffer
- * @param size size of buffer
+ * @param first_page
+ * @param n_pages
  * @return 0 on success, !0 otherwise
- *	RTAS_FREE_ERR - Free called before get
- * 	RTAS_IO_ASSERT - Unexpected I/O Error
  */
-int rtas_free_rmo_buffer(void *buf, uint32_t phys_addr, size_t size)
+static int shm_release_phys_region(size_t first_page, size_t n_pages)
 {
-	int n_pages;
+	struct shm_rmo_area *area = wa_config.shm;
+	pid_t pid = getpid();
+	size_t i;
 	int rc;
 
-	rc = sanity_check();
+	rc = shm_rmo_lock(area);
 	if (rc)
 		return rc;
 
-	n_pages = size / WORK_AREA_SIZE;
-
-	/* Check for multiple of page size */
-	if (size % WORK_AREA_SIZE) {
-		/* Round up to multiple of WORK_AREA_SIZE */
-		n_pages++;
-		size = n_pages * WORK_AREA_SIZE;
+	for (i = first_page; i < first_page + n_pages; i++) {
+		if (area->owner[i] != pid)
+			break;
 	}
 
-	if (!wa_config.init_done) {
-		dbg("Attempting to free before calling get()\n");
-		return RTAS_FREE_ERR;
+	if (i < first_page + n_pages ||
+	    !bits_all_set(area->pages_map, first_page, first_page + n_pages)) {
+		pthread_mutex_unlock(&area->lock);
+		dbg("Invalid shared region [%zu, %zu]\n", first_page, n_pages);
+		return RTAS_IO_ASSERT;
 	}
 
-	rc = munmap_dev_mem(buf, size);
-	if (rc) {
-		(void) release_phys_region(phys_addr, size);
-		return rc;
-	}
+	rc = release_file_lock(first_page, n_pages);
+	set_bits(area->pages_map, first_page, first_page + n_pages, 0);
+	for (i = first_page; i < first_page + n_pages; i++)
+		area->owner[i] = 0;
+	pthread_mutex_unlock(&area->lock);
 
-	rc = release_phys_region(phys_addr, size);
+	shm_rmo_wake(area);
 
 	return rc;
 }
 
 /**
- * rtas_get_rmo_buffer
- * @brief Retrive the RMO buffer used by librtas
+ * get_phys_region
  *
- * On successful completion the buf parameter will reference an allocated
- * area of RMO memory and the phys_addr parameter will refernce the
- * physical address of the RMO buffer.
+ * Pages used by this process are tracked in pages_map, pages used by
+ * other processes are covered by their locks on the lock file. The
+ * first run that is free in both is taken. If wait is set and every
+ * locally free run is locked elsewhere, wait for the first one to be
+ * released; if there is no locally free run, wait for other threads
+ * for up to WA_LOCAL_WAIT_MS.
  *
- * @param size Size of requested region.  Must be a multiple of 4096.
- * @param buf Assigned to mmap'ed buffer of acquired region
- * @param phys_addr  Assigned to physical address of acquired region
+ * Must be called with wa_lock held, which is dropped while waiting.
+ *
+ * @param n_pages
+ * @param first_page
+ * @param wait
  * @return 0 on success, !0 otherwise
- * 	RTAS_NO_MEM - Out of heap memory
- * 	RTAS_NO_LOWMEM - Out of rmo memory
- * 	RTAS_IO_ASSERT - Unexpected I/O Error
+ *	RTAS_NO_LOWMEM - No pages available and wait is not set
  */
-int rtas_get_rmo_buffer(size_t size, void **buf, uint32_t * phys_addr)
+static int get_phys_region(size_t n_pages, size_t *first_page, int wait)
 {
-	uint32_t addr;
-	int n_pages;
+	const size_t nbits = wa_config.n_pages;
+	struct timespec deadline;
+	size_t first_free;
+	size_t i;
 	int rc;
 
-	rc = sanity_check();
-	if (rc)
-		return rc;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += WA_LOCAL_WAIT_MS / 1000;
+	deadline.tv_nsec += (WA_LOCAL_WAIT_MS % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
 
-	dbg("RMO buffer request, size: %zu\n", size);
+	for (;;) {
+		first_free = find_free_run(wa_config.pages_map, nbits, 0,
+					   n_pages);
 
-	n_pages = size / WORK_AREA_SIZE;
+		for (i = first_free; i < nbits;
+		     i = find_free_run(wa_config.pages_map, nbits, i, n_pages)) {
+			if (acquire_file_lock(i, n_pages, 0) == 0) {
+				set_bits(wa_config.pages_map, i, i + n_pages, 1);
+				*first_page = i;
+				return 0;
+			}
 
-	if (size % WORK_AREA_SIZE) {
-		/* Round up to multiple of WORK_AREA_SIZE */
-		n_pages++;
-		size = n_pages * WORK_AREA_SIZE;
-	}
+			i = next_unlocked_page(i, n_pages);
+		}
 
-	if (!wa_config.init_done) {
-		rc = init_workarea_config();
-		if (rc)
-			return rc;
+		if (!wait)
+			return RTAS_NO_LOWMEM;
+
+		if (first_free < nbits)
+			break;
+
+		/* Every free run is in use by other threads of ours */
+		if (pthread_cond_timedwait(&wa_released, &wa_lock, &deadline)) {
+			dbg("Could not find available workarea space\n");
+			return RTAS_IO_ASSERT;
+		}
 	}
 
-	rc = get_phys_region(size, &addr);
-	if (rc)
-		return rc;
+	/* Reserve the run so other threads skip it while we wait */
+	set_bits(wa_config.pages_map, first_free, first_free + n_pages, 1);
+	pthread_mutex_unlock(&wa_lock);
+	rc = acquire_file_lock(first_free, n_pages, 1);
+	pthread_mutex_lock(&wa_lock);
 
-	rc = mmap_dev_mem(addr, size, buf);
 	if (rc) {
-		(void) release_phys_region(addr, size);
+		set_bits(wa_config.pages_map, first_free, first_free + n_pages, 0);
+		pthread_cond_broadcast(&wa_released);
+		dbg("Could not find available workarea space\n");
+		return RTAS_IO_ASSERT;
+	}
+
+	*first_page = first_free;
+	return 0;
+}
+
+/**
+ * release_phys_region
+ *
+ * Must be called with wa_lock held.
+ *
+ * @param first_page
+ * @param n_pages
+ * @return 0 on success, !0 otherwise
+ */
+static int release_phys_region(size_t first_page, size_t n_pages)
+{
+	if (!bits_all_set(wa_config.pages_map, first_page,
+			  first_page + n_pages)) {
+		dbg("Invalid region [%zu, %zu]\n", first_page, n_pages);
+		return RTAS_IO_ASSERT;
+	}
+
+	set_bits(wa_config.pages_map, first_page, first_page + n_pages, 0);
+	pthread_cond_broadcast(&wa_released);
+
+	return release_file_lock(first_page, n_pages);
+}
+
+/**
+ * alloc_pages
+ * @brief Allocate pages from the shared or the process-local page map
+ *
+ * @param n_pages
+ * @param first_page
+ * @param wait
+ * @return 0 on success, !0 otherwise
+ */
+static int alloc_pages(size_t n_pages, size_t *first_page, int wait)
+{
+	int rc;
+
+	if (wa_config.shm)
+		return shm_get_phys_region(n_pages, first_page, wait);
+
+	pthread_mutex_lock(&wa_lock);
+	rc = get_phys_region(n_pages, first_page, wait);
+	pthread_mutex_unlock(&wa_lock);
+
+	return rc;
+}
+
+/**
+ * free_pages
+ * @brief Return pages to the shared or the process-local page map
+ *
+ * Must be called with wa_lock held.
+ *
+ * @param first_page
+ * @param n_pages
+ * @return 0 on success, !0 otherwise
+ */
+static int free_pages(size_t first_page, size_t n_pages)
+{
+	size_t end = first_page + n_pages;
+
+	if (find_bit(wa_config.cached_map, end, first_page, 1) < end) {
+		dbg("Invalid region [%zu, %zu]\n", first_page, n_pages);
+		return RTAS_IO_ASSERT;
+	}
+
+	if (wa_config.shm)
+		return shm_release_phys_region(first_page, n_pages);
+
+	return release_phys_region(first_page, n_pages);
+}
+
+/**
+ * page_is_ours
+ * @brief Lock-free check that a page is allocated to this process
+ *
+ * @param page
+ * @return 1 if the page is allocated, 0 otherwise
+ */
+static int page_is_ours(size_t page)
+{
+	const uint64_t bit = 1ull << (page % BITS_PER_WORD);
+	const uint64_t *map = wa_config.shm ?
+		wa_config.shm->pages_map : wa_config.pages_map;
+
+	if (!(__atomic_load_n(&map[page / BITS_PER_WORD], __ATOMIC_RELAXED) & bit))
+		return 0;
+
+	if (wa_config.shm &&
+	    __atomic_load_n(&wa_config.shm->owner[page], __ATOMIC_RELAXED) != getpid())
+		return 0;
+
+	return 1;
+}
+
+/**
+ * wa_cache_destroy
+ * @brief Thread exit handler returning a thread's parked page
+ *
+ * @param arg thread cache
+ */
+static void wa_cache_destroy(void *arg)
+{
+	struct wa_thread_cache *cache = arg;
+	size_t page;
+
+	pthread_mutex_lock(&wa_lock);
+
+	*cache->pprev = cache->next;
+	if (cache->next)
+		cache->next->pprev = cache->pprev;
+
+	page = __atomic_exchange_n(&cache->page, WA_CACHE_EMPTY,
+				   __ATOMIC_ACQUIRE);
+	if (page != WA_CACHE_EMPTY) {
+		set_bits(wa_config.cached_map, page, page + 1, 0);
+		(void)free_pages(page, 1);
+	}
+
+	pthread_mutex_unlock(&wa_lock);
+
+	wa_cache = NULL;
+	free(cache);
+}
+
+/**
+ * wa_reaper
+ * @brief Return pages parked for longer than WA_CACHE_PARK_MS
+ *
+ * Sleeps on wa_reaper_seq until the next parked page is due, or until
+ * a page is parked while nothing else is.
+ *
+ * @param arg unused
+ * @return never returns
+ */
+static void *wa_reaper(void *arg)
+{
+	struct wa_thread_cache *cache;
+	struct timespec timeout, *tp;
+	uint64_t now, due, next;
+	uint32_t seq;
+	sigset_t set;
+	size_t page;
+
+	(void)arg;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (;;) {
+		seq = __atomic_load_n(&wa_reaper_seq, __ATOMIC_SEQ_CST);
+		next = 0;
+
+		pthread_mutex_lock(&wa_lock);
+		now = stats_now();
+		for (cache = wa_config.caches; cache; cache = cache->next) {
+			if (__atomic_load_n(&cache->page, __ATOMIC_SEQ_CST) ==
+			    WA_CACHE_EMPTY)
+				continue;
+
+			due = __atomic_load_n(&cache->parked_ns,
+					      __ATOMIC_RELAXED) +
+			      WA_CACHE_PARK_MS * 1000000ull;
+			if (due > now) {
+				if (!next || due < next)
+					next = due;
+				continue;
+			}
+
+			page = __atomic_exchange_n(&cache->page, WA_CACHE_EMPTY,
+						   __ATOMIC_ACQUIRE);
+			if (page == WA_CACHE_EMPTY)
+				continue;
+
+			set_bits(wa_config.cached_map, page, page + 1, 0);
+			(void)free_pages(page, 1);
+		}
+		pthread_mutex_unlock(&wa_lock);
+
+		if (next) {
+			timeout.tv_sec = (next - now) / 1000000000ull;
+			timeout.tv_nsec = (next - now) % 1000000000ull;
+			tp = &timeout;
+		} else {
+			__atomic_store_n(&wa_reaper_idle, 1, __ATOMIC_SEQ_CST);
+			tp = NULL;
+		}
+
+		syscall(SYS_futex, &wa_reaper_seq, FUTEX_WAIT_PRIVATE, seq, tp,
+			NULL, 0);
+		__atomic_store_n(&wa_reaper_idle, 0, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+/**
+ * wa_reaper_kick
+ * @brief Tell the reaper that a page was parked
+ */
+static void wa_reaper_kick(void)
+{
+	__atomic_fetch_add(&wa_reaper_seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&wa_reaper_idle, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &wa_reaper_seq, FUTEX_WAKE_PRIVATE, 1,
+			NULL, NULL, 0);
+}
+
+static void wa_atfork_prepare(void)
+{
+	pthread_mutex_lock(&wa_lock);
+}
+
+static void wa_atfork_parent(void)
+{
+	pthread_mutex_unlock(&wa_lock);
+}
+
+/**
+ * wa_atfork_child
+ * @brief Forget the parent's parked pages in a forked child
+ *
+ * The child inherits the thread caches but not the parent's file locks,
+ * and the parent's reaper is not running in it. The parked pages are
+ * left marked busy so the child never hands them out.
+ */
+static void wa_atfork_child(void)
+{
+	wa_config.caches = NULL;
+	memset(wa_config.cached_map, 0, sizeof(wa_config.cached_map));
+
+	if (wa_cache) {
+		pthread_setspecific(wa_cache_key, NULL);
+		free(wa_cache);
+		wa_cache = NULL;
+	}
+
+	wa_reaper_started = 0;
+	wa_reaper_idle = 0;
+
+	pthread_mutex_unlock(&wa_lock);
+}
+
+static void wa_cache_key_init(void)
+{
+	if (pthread_key_create(&wa_cache_key, wa_cache_destroy))
+		dbg("Could not create work area cache key\n");
+	if (pthread_atfork(wa_atfork_prepare, wa_atfork_parent,
+			   wa_atfork_child))
+		dbg("Could not register work area fork handlers\n");
+}
+
+/**
+ * wa_cache_create
+ * @brief Set up the calling thread's work area cache
+ *
+ * @return the cache, or NULL if it could not be created
+ */
+static struct wa_thread_cache *wa_cache_create(void)
+{
+	struct wa_thread_cache *cache;
+	pthread_t reaper;
+
+	pthread_once(&wa_cache_key_once, wa_cache_key_init);
+
+	cache = malloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->page = WA_CACHE_EMPTY;
+	cache->parked_ns = 0;
+
+	if (pthread_setspecific(wa_cache_key, cache)) {
+		free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&wa_lock);
+	if (!wa_reaper_started) {
+		if (pthread_create(&reaper, NULL, wa_reaper, NULL)) {
+			pthread_mutex_unlock(&wa_lock);
+			pthread_setspecific(wa_cache_key, NULL);
+			free(cache);
+			return NULL;
+		}
+		pthread_detach(reaper);
+		wa_reaper_started = 1;
+	}
+
+	cache->next = wa_config.caches;
+	cache->pprev = &wa_config.caches;
+	if (cache->next)
+		cache->next->pprev = &cache->next;
+	wa_config.caches = cache;
+	pthread_mutex_unlock(&wa_lock);
+
+	wa_cache = cache;
+	return cache;
+}
+
+/**
+ * wa_cache_get
+ * @brief Take the calling thread's parked page, if any
+ *
+ * @param page
+ * @return 1 if a page was returned, 0 otherwise
+ */
+static int wa_cache_get(size_t *page)
+{
+	struct wa_thread_cache *cache = wa_cache;
+	size_t cached;
+
+	if (!cache)
+		return 0;
+
+	cached = __atomic_exchange_n(&cache->page, WA_CACHE_EMPTY,
+				     __ATOMIC_ACQUIRE);
+	if (cached == WA_CACHE_EMPTY)
+		return 0;
+
+	set_bits(wa_config.cached_map, cached, cached + 1, 0);
+	*page = cached;
+	return 1;
+}
+
+/**
+ * wa_cache_put
+ * @brief Park a freed page in the calling thread's cache
+ *
+ * @param page
+ * @return 0 if the page was parked, RTAS_NO_MEM if the cache is
+ *	unavailable or full or other processes may want the page,
+ *	RTAS_IO_ASSERT if the page is not allocated
+ */
+static int wa_cache_put(size_t page)
+{
+	struct wa_thread_cache *cache = wa_cache;
+	size_t empty = WA_CACHE_EMPTY;
+	const uint64_t bit = 1ull << (page % BITS_PER_WORD);
+	uint64_t old;
+
+	if (!wa_config.backend->rmo_private &&
+	    (!wa_config.shm ||
+	     __atomic_load_n(&wa_config.shm->waiters, __ATOMIC_RELAXED)))
+		return RTAS_NO_MEM;
+
+	if (!cache) {
+		cache = wa_cache_create();
+		if (!cache)
+			return RTAS_NO_MEM;
+	}
+
+	if (!page_is_ours(page)) {
+		dbg("Invalid region [%zu, 1]\n", page);
+		return RTAS_IO_ASSERT;
+	}
+
+	old = __atomic_fetch_or(&wa_config.cached_map[page / BITS_PER_WORD],
+				bit, __ATOMIC_RELAXED);
+	if (old & bit) {
+		dbg("Page %zu freed twice\n", page);
+		return RTAS_IO_ASSERT;
+	}
+
+	__atomic_store_n(&cache->parked_ns, stats_now(), __ATOMIC_RELAXED);
+	if (__atomic_compare_exchange_n(&cache->page, &empty, page, 0,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		wa_reaper_kick();
+		return 0;
+	}
+
+	set_bits(wa_config.cached_map, page, page + 1, 0);
+	return RTAS_NO_MEM;
+}
+
+/**
+ * wa_cache_drain
+ * @brief Return the pages parked by all threads
+ *
+ * @return number of pages returned
+ */
+static size_t wa_cache_drain(void)
+{
+	struct wa_thread_cache *cache;
+	size_t drained = 0;
+	size_t page;
+
+	pthread_mutex_lock(&wa_lock);
+
+	for (cache = wa_config.caches; cache; cache = cache->next) {
+		page = __atomic_exchange_n(&cache->page, WA_CACHE_EMPTY,
+					   __ATOMIC_ACQUIRE);
+		if (page == WA_CACHE_EMPTY)
+			continue;
+
+		set_bits(wa_config.cached_map, page, page + 1, 0);
+		if (free_pages(page, 1) == 0)
+			drained++;
+	}
+
+	pthread_mutex_unlock(&wa_lock);
+
+	return drained;
+}
+
+/**
+ * native_rmo_map
+ * @brief Map the whole kernel RMO region into the process
+ *
+ * The mapping is kept until the backend changes; work areas handed
+ * out by rtas_get_rmo_buffer() are slices of it.
+ *
+ * @param kregion
+ * @param buf
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int native_rmo_map(struct region *kregion, void **buf)
+{
+	void *newbuf;
+	int fd;
+
+	fd = open(devmem_path, O_RDWR);
+	if (fd < 0) {
+		dbg("Failed to open %s\n", devmem_path);
+		return RTAS_IO_ASSERT;
+	}
+
+	newbuf = mmap((void *)0, kregion->size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, fd, kregion->addr);
+	close(fd);
+
+	if (newbuf == MAP_FAILED) {
+		dbg("mmap failed\n");
+		return RTAS_IO_ASSERT;
+	}
+
+	*buf = newbuf;
+	return 0;
+}
+
+/**
+ * native_rmo_unmap
+ * @brief Undo native_rmo_map()
+ *
+ * @param kregion
+ * @param buf
+ */
+__attribute__((visibility("hidden")))
+void native_rmo_unmap(struct region *kregion, void *buf)
+{
+	munmap(buf, kregion->size);
+}
+
+/**
+ * init_workarea_config
+ *
+ * @return 0 on success, !0 otherwise
+ */
+static int init_workarea_config(void)
+{
+	const struct rtas_backend *be = backend_get();
+	int rc = 0;
+
+	pthread_mutex_lock(&wa_lock);
+
+	if (wa_config.init_done)
+		goto out;
+
+	if (!be->rmo_private && wa_config.lockfile_fd < 0) {
+		wa_config.lockfile_fd = open(lockfile_path, O_CREAT | O_RDWR,
+					     S_IRUSR | S_IWUSR);
+		if (wa_config.lockfile_fd < 0) {
+			dbg("could not open lockfile %s\n", lockfile_path);
+			rc = RTAS_IO_ASSERT;
+			goto out;
+		}
+	}
+
+	/* Read bounds of reserved kernel region */
+	rc = be->rmo_bounds(&wa_config.kern_region);
+	if (rc)
+		goto out;
+
+	if (!(wa_config.kern_region.size && wa_config.kern_region.addr) ||
+	    (wa_config.kern_region.size > (WORK_AREA_SIZE * MAX_PAGES))) {
+		dbg("Unexpected kregion bounds\n");
+		rc = RTAS_IO_ASSERT;
+		goto out;
+	}
+
+	rc = be->rmo_map(&wa_config.kern_region, &wa_config.kern_map);
+	if (rc)
+		goto out;
+
+	wa_config.backend = be;
+	wa_config.n_pages = wa_config.kern_region.size / WORK_AREA_SIZE;
+
+	/* Fall back to the lock file alone if the segment is unusable */
+	if (wa_config.use_shm && !be->rmo_private && shm_rmo_attach())
+		dbg("Shared RMO allocator unavailable, using lock file\n");
+
+	__atomic_store_n(&wa_config.init_done, 1, __ATOMIC_RELEASE);
+
+out:
+	pthread_mutex_unlock(&wa_lock);
+	return rc;
+}
+
+/**
+ * rmo_warm_up
+ * @brief Map the RMO region ahead of the first work area
+ *
+ * @param n_pages set to the number of pages in the region
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int rmo_warm_up(size_t *n_pages)
+{
+	int rc;
+
+	rc = init_workarea_config();
+	if (rc == 0)
+		*n_pages = wa_config.n_pages;
+
+	return rc;
+}
+
+/**
+ * shm_rmo_ours
+ * @brief Check whether this process owns pages in the shared map
+ *
+ * @param area
+ * @return 1 if this process owns pages, 0 otherwise
+ */
+static int shm_rmo_ours(struct shm_rmo_area *area)
+{
+	pid_t pid = getpid();
+	int ours = 0;
+	size_t i;
+
+	if (shm_rmo_lock(area))
+		return 1;
+
+	for (i = find_bit(area->pages_map, area->n_pages, 0, 1);
+	     i < area->n_pages;
+	     i = find_bit(area->pages_map, area->n_pages, i + 1, 1)) {
+		if (area->owner[i] == pid) {
+			ours = 1;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&area->lock);
+
+	return ours;
+}
+
+/**
+ * rmo_reset
+ * @brief Unmap the RMO region so that the next allocation maps it again
+ *
+ * Used when the backend changes. Pages parked in thread caches are
+ * returned first; any other work area still allocated makes it fail.
+ *
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Work areas are still in use
+ */
+__attribute__((visibility("hidden")))
+int rmo_reset(void)
+{
+	int rc = 0;
+
+	if (!__atomic_load_n(&wa_config.init_done, __ATOMIC_ACQUIRE))
+		return 0;
+
+	(void)wa_cache_drain();
+
+	pthread_mutex_lock(&wa_lock);
+
+	if (!wa_config.init_done)
+		goto out;
+
+	if (find_bit(wa_config.pages_map, wa_config.n_pages, 0, 1) <
+	    wa_config.n_pages ||
+	    (wa_config.shm && shm_rmo_ours(wa_config.shm))) {
+		dbg("Work areas still in use\n");
+		rc = RTAS_IO_ASSERT;
+		goto out;
+	}
+
+	if (wa_config.shm) {
+		munmap(wa_config.shm, sizeof(*wa_config.shm));
+		wa_config.shm = NULL;
+	}
+
+	wa_config.backend->rmo_unmap(&wa_config.kern_region,
+				     wa_config.kern_map);
+	wa_config.kern_map = NULL;
+	wa_config.n_pages = 0;
+	__atomic_store_n(&wa_config.init_done, 0, __ATOMIC_RELEASE);
+
+out:
+	pthread_mutex_unlock(&wa_lock);
+	return rc;
+}
+
+/**
+ * native_interface_exists
+ *
+ * @return 1 if the kernel interface exists, 0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int native_interface_exists(void)
+{
+	int fd = open_proc_rtas_file(rmo_filename, O_RDONLY);
+	int exists;
+
+	exists = (fd >= 0);
+
+	if (exists)
+		close(fd);
+
+	return exists;
+}
+
+/**
+ * interface_exists
+ *
+ * Exported since before the backends were split out, so it stays,
+ * asking whichever backend is in use.
+ *
+ * @return 1 if the interface exists, 0 otherwise
+ */
+int interface_exists(void)
+{
+	return backend_get()->interface_exists();
+}
+
+/**
+ * rtas_free_rmo_buffer
+ * @brief free the rmo buffer used by librtas
+ *
+ * @param buf virtual address returned by rtas_get_rmo_buffer()
+ * @param phys_addr physical address of low mem buffer
+ * @param size size of buffer
+ * @return 0 on success, !0 otherwise
+ *	RTAS_FREE_ERR - Free called before get
+ * 	RTAS_IO_ASSERT - Unexpected I/O Error
+ */
+int rtas_free_rmo_buffer(void *buf, uint32_t phys_addr, size_t size)
+{
+	struct region *kregion = &wa_config.kern_region;
+	size_t first_page;
+	size_t n_pages;
+	int rc;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	n_pages = size / WORK_AREA_SIZE;
+
+	/* Check for multiple of page size */
+	if (size % WORK_AREA_SIZE || n_pages == 0) {
+		/* Round up to multiple of WORK_AREA_SIZE */
+		n_pages++;
+		size = n_pages * WORK_AREA_SIZE;
+	}
+
+	if (!__atomic_load_n(&wa_config.init_done, __ATOMIC_ACQUIRE)) {
+		dbg("Attempting to free before calling get()\n");
+		return RTAS_FREE_ERR;
+	}
+
+	if (phys_addr < kregion->addr ||
+	    buf != (char *)wa_config.kern_map + (phys_addr - kregion->addr)) {
+		dbg("Buffer %p does not match region 0x%x\n", buf, phys_addr);
+		return RTAS_FREE_ERR;
+	}
+
+	first_page = (phys_addr - kregion->addr) / WORK_AREA_SIZE;
+	if (first_page + n_pages > wa_config.n_pages) {
+		dbg("Invalid region [0x%x, 0x%zx]\n", phys_addr, size);
+		return RTAS_IO_ASSERT;
+	}
+
+	if (n_pages == 1) {
+		rc = wa_cache_put(first_page);
+		if (rc != RTAS_NO_MEM)
+			goto out;
+	}
+
+	pthread_mutex_lock(&wa_lock);
+	rc = free_pages(first_page, n_pages);
+	pthread_mutex_unlock(&wa_lock);
+
+out:
+	if (rc == 0)
+		stats_rmo_free();
+	PROBE3(rmo__free, size, phys_addr, rc);
+	return rc;
+}
+
+/**
+ * rtas_get_rmo_buffer
+ * @brief Retrive the RMO buffer used by librtas
+ *
+ * On successful completion the buf parameter will reference an allocated
+ * area of RMO memory and the phys_addr parameter will refernce the
+ * physical address of the RMO buffer.
+ *
+ * @param size Size of requested region.  Must be a multiple of 4096.
+ * @param buf Assigned to the mapping of the acquired region
+ * @param phys_addr  Assigned to physical address of acquired region
+ * @return 0 on success, !0 otherwise
+ * 	RTAS_NO_MEM - Out of heap memory
+ * 	RTAS_NO_LOWMEM - Out of rmo memory
+ * 	RTAS_IO_ASSERT - Unexpected I/O Error
+ */
+int rtas_get_rmo_buffer(size_t size, void **buf, uint32_t * phys_addr)
+{
+	size_t first_page;
+	size_t n_pages;
+	int rc;
+
+	rc = sanity_check();
+	if (rc)
+		return rc;
+
+	dbg("RMO buffer request, size: %zu\n", size);
+
+	n_pages = size / WORK_AREA_SIZE;
+
+	if (size % WORK_AREA_SIZE || n_pages == 0) {
+		/* Round up to multiple of WORK_AREA_SIZE */
+		n_pages++;
+		size = n_pages * WORK_AREA_SIZE;
+	}
+
+	if (!__atomic_load_n(&wa_config.init_done, __ATOMIC_ACQUIRE)) {
+		rc = init_workarea_config();
+		if (rc)
+			goto fail;
+	}
+
+	if (n_pages > wa_config.n_pages) {
+		dbg("Invalid buffer size 0x%zx requested\n", size);
+		rc = RTAS_IO_ASSERT;
+		goto fail;
+	}
+
+	if (n_pages == 1 && wa_cache_get(&first_page))
+		goto out;
+
+	rc = alloc_pages(n_pages, &first_page, 0);
+	if (rc == RTAS_NO_LOWMEM) {
+		/* Reclaim pages parked by other threads before waiting */
+		(void)wa_cache_drain();
+		rc = alloc_pages(n_pages, &first_page, 1);
+	}
+
+	if (rc)
+		goto fail;
+
+out:
+	stats_rmo_alloc(n_pages);
+	*buf = (char *)wa_config.kern_map + (first_page * WORK_AREA_SIZE);
+	*phys_addr = wa_config.kern_region.addr + (first_page * WORK_AREA_SIZE);
+	PROBE3(rmo__alloc, size, *phys_addr, 0);
+	return 0;
+
+fail:
+	stats_rmo_alloc(0);
+	PROBE3(rmo__alloc, size, 0, rc);
+	return rc;
+}
+
+/**
+ * workarea_init
+ * @brief Back a work area handle with an RMO buffer
+ *
+ * @param wa
+ * @param size
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int workarea_init(struct rtas_workarea *wa, size_t size)
+{
+	memset(wa, 0, sizeof(*wa));
+	wa->size = size;
+
+	return rtas_get_rmo_buffer(size, &wa->buf, &wa->pa);
+}
+
+/**
+ * workarea_extent
+ * @brief Get a memory extent for ibm,configure-connector
+ *
+ * Extents stay with the handle. Ones left over from an earlier
+ * configuration are reused before new pages are allocated.
+ *
+ * @param wa
+ * @param pa reference to the physical address of the extent
+ * @return 0 on success, !0 otherwise
+ */
+__attribute__((visibility("hidden")))
+int workarea_extent(struct rtas_workarea *wa, uint32_t *pa)
+{
+	struct wa_extent *extents, *e;
+	int rc;
+
+	if (wa->extents_used == wa->nextents) {
+		extents = realloc(wa->extents,
+				  (wa->nextents + 1) * sizeof(*extents));
+		if (!extents)
+			return RTAS_NO_MEM;
+		wa->extents = extents;
+
+		e = &extents[wa->nextents];
+		rc = rtas_get_rmo_buffer(WORK_AREA_SIZE, &e->buf, &e->pa);
+		if (rc)
+			return rc;
+		wa->nextents++;
+	}
+
+	e = &wa->extents[wa->extents_used++];
+	memset(e->buf, 0, WORK_AREA_SIZE);
+	*pa = e->pa;
+
+	return 0;
+}
+
+/**
+ * workarea_release
+ * @brief Free the RMO buffers behind a work area handle
+ *
+ * @param wa
+ */
+__attribute__((visibility("hidden")))
+void workarea_release(struct rtas_workarea *wa)
+{
+	unsigned int i;
+
+	(void)rtas_free_rmo_buffer(wa->buf, wa->pa, wa->size);
+
+	for (i = 0; i < wa->nextents; i++)
+		(void)rtas_free_rmo_buffer(wa->extents[i].buf,
+					   wa->extents[i].pa, WORK_AREA_SIZE);
+	free(wa->extents);
+}
+
+/**
+ * rtas_workarea_alloc
+ * @brief Allocate a long-lived work area in the RMO buffer
+ *
+ * The work area calls that take a handle (rtas_cfg_connector_wa() and
+ * friends) pass it to firmware as it is: requests are built directly
+ * in rtas_workarea_buf() and results are read from there, with no
+ * copies and no RMO allocation per call. The handle can be reused for
+ * any number of calls, but only by one thread at a time.
+ *
+ * The pages stay allocated until rtas_workarea_free().
+ *
+ * @param size size of the work area
+ * @param wap reference to the new handle
+ * @return 0 on success, !0 otherwise
+ *	as rtas_get_rmo_buffer()
+ */
+int rtas_workarea_alloc(size_t size, struct rtas_workarea **wap)
+{
+	struct rtas_workarea *wa;
+	int rc;
+
+	*wap = NULL;
+
+	wa = malloc(sizeof(*wa));
+	if (!wa)
+		return RTAS_NO_MEM;
+
+	rc = workarea_init(wa, size);
+	if (rc) {
+		free(wa);
 		return rc;
 	}
 
-	*phys_addr = addr;
+	memset(wa->buf, 0, size);
+	*wap = wa;
+	return 0;
+}
+
+/**
+ * rtas_workarea_free
+ * @brief Free a work area from rtas_workarea_alloc()
+ *
+ * @param wa handle, may be NULL
+ * @return 0
+ */
+int rtas_workarea_free(struct rtas_workarea *wa)
+{
+	if (!wa)
+		return 0;
+
+	workarea_release(wa);
+	free(wa);
 	return 0;
 }
+
+/**
+ * rtas_workarea_buf
+ * @brief Address of a work area in this process
+ *
+ * @param wa
+ * @return mapping of the work area
+ */
+void *rtas_workarea_buf(const struct rtas_workarea *wa)
+{
+	return wa->buf;
+}
+
+/**
+ * rtas_workarea_size
+ * @brief Size of a work area
+ *
+ * @param wa
+ * @return size given to rtas_workarea_alloc()
+ */
+size_t rtas_workarea_size(const struct rtas_workarea *wa)
+{
+	return wa->size;
+}
+
+/**
+ * rtas_use_shared_rmo_allocator
+ * @brief Opt in to the shared memory RMO allocator
+ *
+ * Processes that opt in coordinate work area allocation through a page
+ * map in shared memory instead of scanning the lock file page by page.
+ * They still hold lock file locks on their pages, so they can run
+ * alongside processes that use the lock file alone.
+ *
+ * Must be called before the first work area is allocated.
+ *
+ * @param enable non-zero to use the shared allocator
+ * @return 0 on success, !0 otherwise
+ *	RTAS_IO_ASSERT - Work areas have already been allocated
+ */
+int rtas_use_shared_rmo_allocator(int enable)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&wa_lock);
+
+	if (wa_config.init_done) {
+		dbg("RMO allocator already initialized\n");
+		rc = RTAS_IO_ASSERT;
+	} else {
+		wa_config.use_shm = !!enable;
+	}
+
+	pthread_mutex_unlock(&wa_lock);
+
+	return rc;
+}
@@ -4,11 +4,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
 #include "internal.h"
 #include "librtas.h"
 #include "papr-sysparm.h"
+#include "probes.h"
 
 static const char sysparm_devpath[] = "/dev/papr-sysparm";
 
@@ -98,22 +97,6 @@ set_sysparm_syscall_fallback(unsigned int parameter, char *data)
 	return rc ? rc : status;
 }
 
-static bool sysparm_can_use_chardev(void)
-{
-	struct stat statbuf;
-
-	if (stat(sysparm_devpath, &statbuf))
-		return false;
-
-	if (!S_ISCHR(statbuf.st_mode))
-		return false;
-
-	if (close(open(sysparm_devpath, O_RDONLY)))
-		return false;
-
-	return true;
-}
-
 /*
  * Only to be used when converting an actual error from a syscall.
  */
@@ -140,7 +123,8 @@ static int chardev_backconvert_errno(int saved_errno)
 
 static int get_sysparm_chardev(unsigned int parameter, unsigned int length, char *data)
 {
-	const int fd = open(sysparm_devpath, O_RDWR);
+	const struct rtas_backend *be = backend_get();
+	const int fd = be->chardev_open(sysparm_devpath, O_RDWR);
 	struct papr_sysparm_io_block buf = {
 		.parameter = parameter,
 	};
@@ -162,8 +146,13 @@ static int get_sysparm_chardev(unsigned int parameter, unsigned int length, char
 	 * pass to PAPR_SYSPARM_IOC_GET.
 	 */
 
-	const int res = ioctl(fd, PAPR_SYSPARM_IOC_GET, &buf);
+	PROBE1(sysparm__get__entry, parameter);
+	const int slot = sched_enter();
+	const int res = be->chardev_ioctl(fd, PAPR_SYSPARM_IOC_GET, &buf);
 	const int saved_errno = errno;
+	if (slot)
+		sched_exit();
+	PROBE2(sysparm__get__return, parameter, res ? -saved_errno : 0);
 	(void)close(fd);
 
 	if (res != 0)
@@ -185,7 +174,8 @@ static int get_sysparm_chardev(unsigned int parameter, unsigned int length, char
 
 static int set_sysparm_chardev(unsigned int parameter, char *data)
 {
-	const int fd = open(sysparm_devpath, O_RDWR);
+	const struct rtas_backend *be = backend_get();
+	const int fd = be->chardev_open(sysparm_devpath, O_RDWR);
 	struct papr_sysparm_io_block buf = {
 		.parameter = parameter,
 		.length = (((unsigned char)data[0] << 8) | (unsigned char)data[1]),
@@ -193,8 +183,13 @@ static int set_sysparm_chardev(unsigned int parameter, char *data)
 
 	memcpy(buf.data, data + 2, buf.length);
 
-	const int res = ioctl(fd, PAPR_SYSPARM_IOC_SET, &buf);
+	PROBE2(sysparm__set__entry, parameter, buf.length);
+	const int slot = sched_enter();
+	const int res = be->chardev_ioctl(fd, PAPR_SYSPARM_IOC_SET, &buf);
 	const int saved_errno = errno;
+	if (slot)
+		sched_exit();
+	PROBE2(sysparm__set__return, parameter, res ? -saved_errno : 0);
 	(void)close(fd);
 
 	return res == 0 ? 0 : chardev_backconvert_errno(saved_errno);
@@ -203,26 +198,77 @@ static int set_sysparm_chardev(unsigned int parameter, char *data)
 static int (*get_sysparm_fn)(unsigned int parameter, unsigned int length, char *data);
 static int (*set_sysparm_fn)(unsigned int parameter, char *data);
 
+/* Backend generation the functions were chosen for */
+static unsigned int sysparm_fn_gen;
+
 static void sysparm_fn_setup(void)
 {
-	const bool use_chardev = sysparm_can_use_chardev();
+	const unsigned int gen = backend_generation();
+	bool use_chardev;
+
+	if (__atomic_load_n(&sysparm_fn_gen, __ATOMIC_ACQUIRE) == gen)
+		return;
 
-	get_sysparm_fn = use_chardev ?
-		get_sysparm_chardev : get_sysparm_syscall_fallback;
-	set_sysparm_fn = use_chardev ?
-		set_sysparm_chardev : set_sysparm_syscall_fallback;
+	use_chardev = backend_get()->chardev_exists(sysparm_devpath);
+
+	__atomic_store_n(&get_sysparm_fn, use_chardev ?
+			 get_sysparm_chardev : get_sysparm_syscall_fallback,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&set_sysparm_fn, use_chardev ?
+			 set_sysparm_chardev : set_sysparm_syscall_fallback,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&sysparm_fn_gen, gen, __ATOMIC_RELEASE);
 }
 
-static pthread_once_t sysparm_fn_setup_once = PTHREAD_ONCE_INIT;
+/**
+ * sysparm_fn_warm_up
+ * @brief Choose between the chardev and the system call for the backend
+ *
+ * @return non-zero if system parameters go through the chardev
+ */
+__attribute__((visibility("hidden")))
+int sysparm_fn_warm_up(void)
+{
+	sysparm_fn_setup();
+
+	return __atomic_load_n(&get_sysparm_fn, __ATOMIC_RELAXED) ==
+		get_sysparm_chardev;
+}
 
 int rtas_get_sysparm(unsigned int parameter, unsigned int length, char *data)
 {
-	pthread_once(&sysparm_fn_setup_once, sysparm_fn_setup);
-	return get_sysparm_fn(parameter, length, data);
+	static const char name[] = "ibm,get-system-parameter";
+	const unsigned int ttl = sysparm_cache_ttl();
+	const uint32_t key[2] = { parameter, length };
+	uint64_t generation = 0;
+	int rc;
+
+	if (ttl) {
+		if (result_cache_lookup(name, key, sizeof(key), data, length))
+			return 0;
+		generation = result_cache_generation();
+	}
+
+	sysparm_fn_setup();
+	rc = __atomic_load_n(&get_sysparm_fn, __ATOMIC_RELAXED)(parameter,
+								length, data);
+
+	if (ttl && rc == 0)
+		result_cache_store(name, ttl, generation, key, sizeof(key),
+				   data, length);
+
+	return rc;
 }
 
 int rtas_set_sysparm(unsigned int parameter, char *data)
 {
-	pthread_once(&sysparm_fn_setup_once, sysparm_fn_setup);
-	return set_sysparm_fn(parameter, data);
+	int rc;
+
+	sysparm_fn_setup();
+	rc = __atomic_load_n(&set_sysparm_fn, __ATOMIC_RELAXED)(parameter,
+								data);
+
+	result_cache_invalidate();
+
+	return rc;
 }
@@ -0,0 +1,429 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Binary trace of RTAS calls. Each thread appends fixed size records
+// to its own ring, so recording a call takes no lock. The rings are
+// kept on a list that is only ever pushed to, which lets
+// rtas_trace_dump() walk it from a signal handler.
+
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "internal.h"
+#include "librtas.h"
+
+#define TRACE_MAGIC "RTASTRC1"
+#define TRACE_MAX_RECORDS (1u << 20)
+#define TRACE_DUMP_BATCH 32
+
+/* One call, as written to the dump */
+struct trace_record {
+	uint64_t seq;		/* index + 1 once written, 0 while being written */
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint32_t tid;
+	int32_t token;
+	int32_t status;
+	int32_t rc;		/* librtas result of the system call */
+	uint16_t ninputs;
+	uint16_t nrets;
+	uint32_t attempts;	/* system calls, including delay retries */
+	uint32_t args[MAX_ARGS];	/* inputs then outputs, host order */
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t reserved;
+};
+
+struct trace_ring {
+	struct trace_ring *next;
+	int in_use;
+	uint32_t tid;
+	uint32_t size;		/* power of two */
+	uint64_t head;		/* records written so far */
+	struct trace_record rec[];
+};
+
+/* Ring size for new rings, 0 when tracing is off */
+static unsigned int trace_size;
+static struct trace_ring *trace_rings;
+
+static __thread struct trace_ring *my_ring;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+
+static int crash_fd = -1;
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+static struct sigaction crash_old[sizeof(crash_signals) / sizeof(int)];
+
+static void trace_ring_release(void *arg)
+{
+	struct trace_ring *ring = arg;
+
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+	my_ring = NULL;
+}
+
+static void trace_key_init(void)
+{
+	if (pthread_key_create(&trace_key, trace_ring_release))
+		dbg("Could not create trace key\n");
+}
+
+/**
+ * trace_ring_get
+ * @brief Find the calling thread's ring, claiming one if needed
+ *
+ * Rings of exited threads are reused, keeping their old records until
+ * they are overwritten.
+ *
+ * @param size ring size to use
+ * @return the ring, or NULL if none could be set up
+ */
+static struct trace_ring *trace_ring_get(unsigned int size)
+{
+	struct trace_ring *ring = my_ring;
+	int unused = 0;
+
+	if (ring && ring->size == size)
+		return ring;
+
+	pthread_once(&trace_key_once, trace_key_init);
+
+	if (ring) {
+		/* The size changed, hand the old ring back */
+		__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+		my_ring = NULL;
+	}
+
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring;
+	     ring = ring->next) {
+		if (ring->size != size)
+			continue;
+		unused = 0;
+		if (__atomic_compare_exchange_n(&ring->in_use, &unused, 1, 0,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_RELAXED))
+			break;
+	}
+
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring) + size * sizeof(ring->rec[0]));
+		if (!ring)
+			return NULL;
+
+		ring->in_use = 1;
+		ring->size = size;
+		ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&trace_rings, &ring->next,
+						    ring, 1, __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+	}
+
+	ring->tid = syscall(SYS_gettid);
+	if (pthread_setspecific(trace_key, ring)) {
+		__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+		return NULL;
+	}
+
+	my_ring = ring;
+	return ring;
+}
+
+/**
+ * trace_call
+ * @brief Record a call in the calling thread's trace ring
+ *
+ * @param args argument buffer after the call, in big endian
+ * @param start stats_now() before the first attempt
+ * @param end stats_now() after the last attempt
+ * @param rc result of the system call
+ * @param attempts number of system calls made
+ */
+__attribute__((visibility("hidden")))
+void trace_call(const struct rtas_args *args, uint64_t start, uint64_t end,
+		int rc, unsigned int attempts)
+{
+	unsigned int size = __atomic_load_n(&trace_size, __ATOMIC_RELAXED);
+	struct trace_ring *ring;
+	struct trace_record *r;
+	unsigned int i, nargs;
+	uint64_t idx;
+
+	if (!size)
+		return;
+
+	ring = trace_ring_get(size);
+	if (!ring)
+		return;
+
+	idx = ring->head;
+	r = &ring->rec[idx & (size - 1)];
+
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	r->start_ns = start;
+	r->end_ns = end;
+	r->tid = ring->tid;
+	r->token = be32toh(args->token);
+	r->ninputs = be32toh(args->ninputs);
+	r->nrets = be32toh(args->nret);
+	r->rc = rc;
+	r->attempts = attempts;
+	r->status = (r->nrets && r->ninputs < MAX_ARGS) ?
+		(int32_t)be32toh(args->args[r->ninputs]) : 0;
+
+	nargs = r->ninputs + r->nrets;
+	if (nargs > MAX_ARGS)
+		nargs = MAX_ARGS;
+	for (i = 0; i < nargs; i++)
+		r->args[i] = be32toh(args->args[i]);
+	for (; i < MAX_ARGS; i++)
+		r->args[i] = 0;
+
+	__atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * rtas_set_trace
+ * @brief Interface to turn the per-thread call trace on or off
+ *
+ * Each thread that makes RTAS calls gets a ring of nrecords entries,
+ * and the oldest entries are overwritten once it is full. Turning
+ * tracing off keeps the recorded calls for rtas_trace_dump().
+ *
+ * @param nrecords ring size, rounded up to a power of two, 0 to disable
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_set_trace(unsigned int nrecords)
+{
+	unsigned int size = 1;
+
+	if (nrecords > TRACE_MAX_RECORDS)
+		return RTAS_IO_ASSERT;
+
+	if (nrecords)
+		while (size < nrecords)
+			size <<= 1;
+	else
+		size = 0;
+
+	__atomic_store_n(&trace_size, size, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return RTAS_IO_ASSERT;
+
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * rtas_trace_dump
+ * @brief Interface to write the recorded calls of all threads to a file
+ *
+ * The dump is binary, see rtas_trace_decode(). Calls being recorded
+ * while the dump runs may be left out. Only async-signal-safe
+ * functions are used, so this can be called from a signal handler.
+ *
+ * @param fd file descriptor to write to
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_trace_dump(int fd)
+{
+	struct trace_record batch[TRACE_DUMP_BATCH];
+	struct trace_header hdr = { .record_size = sizeof(batch[0]) };
+	struct trace_ring *ring;
+	unsigned int n = 0;
+	int rc;
+
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	rc = write_all(fd, &hdr, sizeof(hdr));
+	if (rc)
+		return rc;
+
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring;
+	     ring = ring->next) {
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t idx = head > ring->size ? head - ring->size : 0;
+
+		for (; idx < head; idx++) {
+			struct trace_record *r = &ring->rec[idx & (ring->size - 1)];
+			uint64_t seq;
+
+			seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+			if (seq != idx + 1)
+				continue;
+
+			memcpy(&batch[n], r, sizeof(*r));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq)
+				continue;
+
+			if (++n == TRACE_DUMP_BATCH) {
+				rc = write_all(fd, batch, sizeof(batch));
+				if (rc)
+					return rc;
+				n = 0;
+			}
+		}
+	}
+
+	return write_all(fd, batch, n * sizeof(batch[0]));
+}
+
+static void trace_crash_handler(int sig)
+{
+	unsigned int i;
+
+	(void)rtas_trace_dump(crash_fd);
+
+	/* Let the previous handler, or the default action, take over */
+	for (i = 0; i < sizeof(crash_signals) / sizeof(int); i++)
+		if (crash_signals[i] == sig)
+			sigaction(sig, &crash_old[i], NULL);
+	raise(sig);
+}
+
+/**
+ * rtas_trace_dump_on_crash
+ * @brief Interface to dump the call trace when the process crashes
+ *
+ * Installs handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT
+ * that call rtas_trace_dump() and then restore the previous handlers
+ * and raise the signal again.
+ *
+ * @param fd file descriptor to dump to, or -1 to remove the handlers
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_trace_dump_on_crash(int fd)
+{
+	struct sigaction sa;
+	unsigned int i;
+	int installed = crash_fd >= 0;
+
+	if (fd < 0) {
+		if (installed)
+			for (i = 0; i < sizeof(crash_signals) / sizeof(int); i++)
+				sigaction(crash_signals[i], &crash_old[i], NULL);
+		crash_fd = -1;
+		return 0;
+	}
+
+	crash_fd = fd;
+	if (installed)
+		return 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_crash_handler;
+	sigemptyset(&sa.sa_mask);
+
+	for (i = 0; i < sizeof(crash_signals) / sizeof(int); i++) {
+		if (sigaction(crash_signals[i], &sa, &crash_old[i])) {
+			while (i--)
+				sigaction(crash_signals[i], &crash_old[i], NULL);
+			crash_fd = -1;
+			return RTAS_IO_ASSERT;
+		}
+	}
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return RTAS_IO_ASSERT;
+		if (n == 0)
+			return p == buf ? 1 : RTAS_IO_ASSERT;
+
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * rtas_trace_decode
+ * @brief Interface to print a dump from rtas_trace_dump() as text
+ *
+ * Prints one line per call: thread id, start time, token, inputs,
+ * outputs, status, librtas result, number of attempts and duration.
+ *
+ * @param fd file descriptor to read the dump from
+ * @param out stream to print to
+ * @return 0 on success, !0 otherwise
+ */
+int rtas_trace_decode(int fd, FILE *out)
+{
+	struct trace_header hdr;
+	struct trace_record r;
+	unsigned int i, ninputs, nargs;
+	int rc;
+
+	if (!out)
+		return RTAS_IO_ASSERT;
+
+	rc = read_all(fd, &hdr, sizeof(hdr));
+	if (rc)
+		return RTAS_IO_ASSERT;
+
+	if (memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.record_size != sizeof(r)) {
+		dbg("Not a librtas trace dump\n");
+		return RTAS_IO_ASSERT;
+	}
+
+	while ((rc = read_all(fd, &r, sizeof(r))) == 0) {
+		ninputs = r.ninputs < MAX_ARGS ? r.ninputs : MAX_ARGS;
+		nargs = r.ninputs + r.nrets;
+		if (nargs > MAX_ARGS)
+			nargs = MAX_ARGS;
+
+		fprintf(out, "%u %" PRIu64 ".%09" PRIu64 " token %d in:",
+			r.tid, r.start_ns / 1000000000, r.start_ns % 1000000000,
+			r.token);
+		for (i = 0; i < ninputs; i++)
+			fprintf(out, " 0x%x", r.args[i]);
+		fprintf(out, " out:");
+		for (; i < nargs; i++)
+			fprintf(out, " 0x%x", r.args[i]);
+		fprintf(out, " status %d rc %d attempts %u time %" PRIu64 " ns\n",
+			r.status, r.rc, r.attempts, r.end_ns - r.start_ns);
+	}
+
+	return rc < 0 ? rc : 0;
+}
@@ -16,13 +16,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
-#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
 #include "internal.h"
 #include "librtas.h"
 #include "papr-vpd.h"
+#include "probes.h"
 
 static int
 get_vpd_syscall_fallback(const char *loc_code, char *workarea, size_t size,
@@ -32,7 +32,7 @@ get_vpd_syscall_fallback(const char *loc_code, char *workarea, size_t size,
 	uint32_t kernbuf_pa;
 	uint32_t loc_pa = 0;
 	uint32_t rmo_pa = 0;
-	uint64_t elapsed = 0;
+	struct delay_state delay = { 0 };
 	void *kernbuf;
 	void *rmobuf;
 	void *locbuf;
@@ -64,7 +64,7 @@ get_vpd_syscall_fallback(const char *loc_code, char *workarea, size_t size,
 		if (rc < 0)
 			break;
 
-		rc = handle_delay(status, &elapsed);
+		rc = handle_delay(status, &delay);
 	} while (rc == CALL_AGAIN);
 
 	if (rc == 0)
@@ -80,29 +80,14 @@ get_vpd_syscall_fallback(const char *loc_code, char *workarea, size_t size,
 	return rc ? rc : status;
 }
 
-static bool get_vpd_can_use_chardev(void)
-{
-	struct stat statbuf;
-
-	if (stat("/dev/papr-vpd", &statbuf))
-		return false;
-
-	if (!S_ISCHR(statbuf.st_mode))
-		return false;
-
-	if (close(open("/dev/papr-vpd", O_RDONLY)))
-		return false;
-
-	return true;
-}
-
 #define DEVPATH "/dev/papr-vpd"
 
 static int vpd_fd_new(const char *loc_code)
 {
-	const int devfd = open(DEVPATH, O_WRONLY);
+	const struct rtas_backend *be = backend_get();
+	const int devfd = be->chardev_open(DEVPATH, O_WRONLY);
 	struct papr_location_code lc = {};
-	int fd = -1;
+	int fd = -1, slot, saved_errno;
 
 	if (devfd < 0)
 		return -1;
@@ -114,7 +99,14 @@ static int vpd_fd_new(const char *loc_code)
 		goto close_devfd;
 
 	strncpy(lc.str, loc_code, sizeof(lc.str));
-	fd = ioctl(devfd, PAPR_VPD_IOC_CREATE_HANDLE, &lc);
+	PROBE1(vpd__handle__entry, loc_code);
+	slot = sched_enter();
+	fd = be->chardev_ioctl(devfd, PAPR_VPD_IOC_CREATE_HANDLE, &lc);
+	saved_errno = errno;
+	if (slot)
+		sched_exit();
+	PROBE2(vpd__handle__return, fd, fd < 0 ? -saved_errno : 0);
+	errno = saved_errno;
 close_devfd:
 	close(devfd);
 	return fd;
@@ -140,7 +132,9 @@ get_vpd_chardev(const char *loc_code, char *workarea, size_t size,
 		return -3; /* Synthesize ibm,get-vpd "parameter error" */
 
 	int rtas_status = 0;
+	PROBE3(vpd__read__entry, fd, sequence, size);
 	ssize_t res = read(fd, workarea, size);
+	PROBE2(vpd__read__return, fd, res < 0 ? -errno : res);
 	if (res < 0) {
 		rtas_status = -1; /* Synthesize ibm,get-vpd "hardware error" */
 		close(fd);
@@ -169,10 +163,33 @@ static int (*get_vpd_fn)(const char *loc_code,
 			 unsigned int *seq_next,
 			 unsigned int *bytes_ret);
 
-static void get_vpd_fn_setup(void)
+/* Backend generation get_vpd_fn was chosen for */
+static unsigned int get_vpd_fn_gen;
+
+static void get_vpd_fn_setup(unsigned int gen)
 {
-	get_vpd_fn = get_vpd_can_use_chardev() ?
-		get_vpd_chardev : get_vpd_syscall_fallback;
+	__atomic_store_n(&get_vpd_fn, backend_get()->chardev_exists(DEVPATH) ?
+			 get_vpd_chardev : get_vpd_syscall_fallback,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&get_vpd_fn_gen, gen, __ATOMIC_RELEASE);
+}
+
+/**
+ * vpd_fn_warm_up
+ * @brief Choose between the chardev and the system call for the backend
+ *
+ * @return non-zero if ibm,get-vpd goes through the chardev
+ */
+__attribute__((visibility("hidden")))
+int vpd_fn_warm_up(void)
+{
+	const unsigned int gen = backend_generation();
+
+	if (__atomic_load_n(&get_vpd_fn_gen, __ATOMIC_ACQUIRE) != gen)
+		get_vpd_fn_setup(gen);
+
+	return __atomic_load_n(&get_vpd_fn, __ATOMIC_RELAXED) ==
+		get_vpd_chardev;
 }
 
 /**
@@ -191,10 +208,8 @@ int rtas_get_vpd(char *loc_code, char *workarea, size_t size,
 		 unsigned int sequence, unsigned int *seq_next,
 		 unsigned int *bytes_ret)
 {
-	static pthread_once_t get_vpd_fn_once = PTHREAD_ONCE_INIT;
-
-	pthread_once(&get_vpd_fn_once, get_vpd_fn_setup);
+	(void)vpd_fn_warm_up();
 
-	return get_vpd_fn(loc_code, workarea, size, sequence,
-			  seq_next, bytes_ret);
+	return __atomic_load_n(&get_vpd_fn, __ATOMIC_RELAXED)(loc_code,
+			workarea, size, sequence, seq_next, bytes_ret);
 }
@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+// Micro-benchmarks for the librtas call path, run against the
+// simulated firmware so that they work on any host. Each benchmark
+// reports the time per call and the kernel entries per call the
+// native backend would have made, first on one thread and then with
+// several threads calling at once.
+//
+// Usage: bench_librtas [-n iterations] [-t threads] [-l latency_us]
+//                      [benchmark...]
+
+#include <librtas.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "internal.h"
+#include "rtas_sim.h"
+
+#define SENSOR_TOKEN 3		/* get-sensor-state in the default table */
+#define BATCH_SIZE 16
+
+struct bench {
+	const char *name;
+	int chardevs;			/* simulator setting for the run */
+	int (*setup)(void);		/* once per thread, may be NULL */
+	int (*op)(void);		/* one call, returns non-zero on error */
+	unsigned int calls_per_op;	/* librtas calls made by op */
+};
+
+struct bench_thread {
+	const struct bench *bench;
+	unsigned long iterations;
+	pthread_barrier_t *barrier;
+	uint64_t ns;
+	int failed;
+	pthread_t tid;
+};
+
+static char vpd_data[256];
+static const struct rtas_sim_sysparm sysparms[] = {
+	{ .parameter = 20, .data = "benchmark", .length = 9 },
+};
+
+static __thread struct rtas_batch_call batch[BATCH_SIZE];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int op_sanity_check(void)
+{
+	return sanity_check();
+}
+
+static int op_rtas_token(void)
+{
+	return rtas_token("get-sensor-state") < 0;
+}
+
+static int op_get_sensor(void)
+{
+	int state;
+
+	return rtas_get_sensor(9001, 0, &state);
+}
+
+static int batch_setup(void)
+{
+	int i;
+
+	for (i = 0; i < BATCH_SIZE; i++) {
+		batch[i].name = NULL;
+		batch[i].token = SENSOR_TOKEN;
+		batch[i].ninputs = 2;
+		batch[i].nrets = 2;
+		batch[i].inputs[0] = 9001;
+		batch[i].inputs[1] = 0;
+	}
+
+	return 0;
+}
+
+static int run_batch(size_t n)
+{
+	size_t i;
+
+	if (rtas_call_batch(batch, n))
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		if (batch[i].rc)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int op_batch_1(void)
+{
+	return run_batch(1);
+}
+
+static int op_batch_16(void)
+{
+	return run_batch(BATCH_SIZE);
+}
+
+static int rmo_cycle(size_t size)
+{
+	uint32_t pa;
+	void *buf;
+
+	if (rtas_get_rmo_buffer(size, &buf, &pa))
+		return 1;
+
+	return rtas_free_rmo_buffer(buf, pa, size);
+}
+
+static int op_rmo_1page(void)
+{
+	return rmo_cycle(WORK_AREA_SIZE);
+}
+
+static int op_rmo_4pages(void)
+{
+	return rmo_cycle(4 * WORK_AREA_SIZE);
+}
+
+static int op_get_vpd(void)
+{
+	char buf[sizeof(vpd_data) * 2];
+	unsigned int seq_next, bytes;
+
+	return rtas_get_vpd(NULL, buf, sizeof(buf), 1, &seq_next, &bytes);
+}
+
+static int op_get_sysparm(void)
+{
+	char buf[64];
+
+	return rtas_get_sysparm(20, sizeof(buf), buf);
+}
+
+static const struct bench benches[] = {
+	{ "sanity_check", 0, NULL, op_sanity_check, 1 },
+	{ "rtas_token", 0, NULL, op_rtas_token, 1 },
+	{ "get_sensor", 0, NULL, op_get_sensor, 1 },
+	{ "call_batch_1", 0, batch_setup, op_batch_1, 1 },
+	{ "call_batch_16", 0, batch_setup, op_batch_16, BATCH_SIZE },
+	{ "rmo_1page", 0, NULL, op_rmo_1page, 1 },
+	{ "rmo_4pages", 0, NULL, op_rmo_4pages, 1 },
+	{ "vpd_syscall", 0, NULL, op_get_vpd, 1 },
+	{ "vpd_chardev", 1, NULL, op_get_vpd, 1 },
+	{ "sysparm_syscall", 0, NULL, op_get_sysparm, 1 },
+	{ "sysparm_chardev", 1, NULL, op_get_sysparm, 1 },
+};
+
+static void *bench_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	const struct bench *b = t->bench;
+	unsigned long i;
+	uint64_t start;
+
+	if (b->setup && b->setup())
+		t->failed = 1;
+
+	pthread_barrier_wait(t->barrier);
+
+	start = now_ns();
+	for (i = 0; i < t->iterations && !t->failed; i++)
+		t->failed = b->op() != 0;
+	t->ns = now_ns() - start;
+
+	return NULL;
+}
+
+static int run_bench(const struct bench *b, struct rtas_sim_config *config,
+		     unsigned int nthreads, unsigned long iterations)
+{
+	struct bench_thread *threads;
+	struct rtas_sim_stats stats;
+	pthread_barrier_t barrier;
+	uint64_t ns = 0, entries, calls;
+	unsigned int i;
+	int failed = 0;
+
+	config->chardevs = b->chardevs;
+	if (rtas_sim_enable(config)) {
+		fprintf(stderr, "%s: could not enable the simulator\n",
+			b->name);
+		return 1;
+	}
+
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!threads)
+		return 1;
+
+	/* Warm up caches and lazy initialization outside the timing */
+	for (i = 0; i < 16; i++) {
+		if (b->setup)
+			(void)b->setup();
+		(void)b->op();
+	}
+
+	pthread_barrier_init(&barrier, NULL, nthreads);
+	rtas_sim_get_stats(&stats, 1);
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i].bench = b;
+		threads[i].iterations = iterations;
+		threads[i].barrier = &barrier;
+		pthread_create(&threads[i].tid, NULL, bench_thread, &threads[i]);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		ns += threads[i].ns;
+		failed |= threads[i].failed;
+	}
+
+	rtas_sim_get_stats(&stats, 1);
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+
+	if (failed) {
+		fprintf(stderr, "%s: call failed\n", b->name);
+		return 1;
+	}
+
+	calls = (uint64_t)iterations * nthreads * b->calls_per_op;
+	entries = stats.syscalls + stats.opens + stats.ioctls;
+	printf("%-16s %7u %12.1f %14.2f\n", b->name, nthreads,
+	       (double)ns / calls, (double)entries / calls);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-t threads] "
+		"[-l latency_us] [benchmark...]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct rtas_sim_config config = {
+		.vpd = vpd_data,
+		.vpd_length = sizeof(vpd_data),
+		.sysparms = sysparms,
+		.nsysparms = sizeof(sysparms) / sizeof(sysparms[0]),
+		.rmo_pages = 256,
+	};
+	unsigned long iterations = 100000;
+	unsigned int nthreads = 4;
+	size_t i;
+	int rc = 0;
+	int c, j;
+
+	while ((c = getopt(argc, argv, "n:t:l:h")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			config.latency_us = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!iterations || !nthreads) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%-16s %7s %12s %14s\n", "benchmark", "threads", "ns/call",
+	       "syscalls/call");
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		const struct bench *b = &benches[i];
+
+		if (optind < argc) {
+			for (j = optind; j < argc; j++) {
+				if (!strcmp(argv[j], b->name))
+					break;
+			}
+			if (j == argc)
+				continue;
+		}
+
+		rc |= run_bench(b, &config, 1, iterations);
+		if (nthreads > 1)
+			rc |= run_bench(b, &config, nthreads, iterations);
+	}
+
+	rtas_sim_disable();
+
+	return rc;
+}
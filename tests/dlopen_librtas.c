@@ -35,39 +35,100 @@ static void test_dlsym(void **state, const char *symbol)
 	}
 
 define_test_fn(rtas_activate_firmware)
+define_test_fn(rtas_call_batch)
+define_test_fn(rtas_cancel)
 define_test_fn(rtas_cfg_connector)
+define_test_fn(rtas_cfg_connector_parse)
+define_test_fn(rtas_cfg_connector_start)
+define_test_fn(rtas_cfg_connector_tree)
+define_test_fn(rtas_cfg_connector_tree_free)
+define_test_fn(rtas_cfg_connector_wa)
+define_test_fn(rtas_context_free)
+define_test_fn(rtas_context_info)
+define_test_fn(rtas_context_init)
 define_test_fn(rtas_delay_timeout)
 define_test_fn(rtas_display_char)
 define_test_fn(rtas_display_msg)
+define_test_fn(rtas_dump_codec_available)
+define_test_fn(rtas_dump_decompress)
 define_test_fn(rtas_errinjct)
 define_test_fn(rtas_errinjct_close)
 define_test_fn(rtas_errinjct_open)
+define_test_fn(rtas_errinjct_wa)
+define_test_fn(rtas_flush_index_cache)
+define_test_fn(rtas_flush_result_cache)
+define_test_fn(rtas_flush_token_cache)
 define_test_fn(rtas_free_rmo_buffer)
+define_test_fn(rtas_get_busy_backoff)
+define_test_fn(rtas_get_busy_stats)
 define_test_fn(rtas_get_config_addr_info2)
 define_test_fn(rtas_get_dynamic_sensor)
+define_test_fn(rtas_get_index_table)
 define_test_fn(rtas_get_indices)
+define_test_fn(rtas_get_indices_wa)
 define_test_fn(rtas_get_power_level)
+define_test_fn(rtas_get_rate_limit_stats)
 define_test_fn(rtas_get_rmo_buffer)
 define_test_fn(rtas_get_sensor)
+define_test_fn(rtas_get_stats)
 define_test_fn(rtas_get_sysparm)
 define_test_fn(rtas_get_time)
 define_test_fn(rtas_get_vpd)
 define_test_fn(rtas_lpar_perftools)
+define_test_fn(rtas_lpar_perftools_start)
+define_test_fn(rtas_monitor_add)
+define_test_fn(rtas_monitor_add_type)
+define_test_fn(rtas_monitor_changes)
+define_test_fn(rtas_monitor_create)
+define_test_fn(rtas_monitor_destroy)
+define_test_fn(rtas_monitor_fd)
+define_test_fn(rtas_monitor_read)
 define_test_fn(rtas_platform_dump)
+define_test_fn(rtas_platform_dump_compress)
+define_test_fn(rtas_platform_dump_start)
+define_test_fn(rtas_platform_dump_to_fd)
+define_test_fn(rtas_put_index_table)
 define_test_fn(rtas_read_slot_reset)
+define_test_fn(rtas_reprobe_interface)
+define_test_fn(rtas_reset_stats)
+define_test_fn(rtas_resume)
 define_test_fn(rtas_scan_log_dump)
+define_test_fn(rtas_scan_log_dump_compress)
+define_test_fn(rtas_scan_log_dump_wa)
+define_test_fn(rtas_sched_get_stats)
+define_test_fn(rtas_sched_set_class)
+define_test_fn(rtas_sched_start)
+define_test_fn(rtas_sched_stop)
+define_test_fn(rtas_sched_submit)
+define_test_fn(rtas_set_busy_backoff)
+define_test_fn(rtas_set_cache_ttl)
+define_test_fn(rtas_set_coalescing)
 define_test_fn(rtas_set_debug)
 define_test_fn(rtas_set_dynamic_indicator)
 define_test_fn(rtas_set_eeh_option)
+define_test_fn(rtas_set_idempotent)
 define_test_fn(rtas_set_indicator)
 define_test_fn(rtas_set_power_level)
 define_test_fn(rtas_set_poweron_time)
+define_test_fn(rtas_set_rate_limit)
 define_test_fn(rtas_set_sysparm)
 define_test_fn(rtas_set_time)
+define_test_fn(rtas_set_trace)
 define_test_fn(rtas_suspend_me)
+define_test_fn(rtas_trace_decode)
+define_test_fn(rtas_trace_dump)
+define_test_fn(rtas_trace_dump_on_crash)
 define_test_fn(rtas_update_nodes)
+define_test_fn(rtas_update_nodes_wa)
 define_test_fn(rtas_update_properties)
+define_test_fn(rtas_update_properties_wa)
+define_test_fn(rtas_use_shared_rmo_allocator)
+define_test_fn(rtas_workarea_alloc)
+define_test_fn(rtas_workarea_buf)
+define_test_fn(rtas_workarea_free)
+define_test_fn(rtas_workarea_size)
 define_test_fn(rtas_physical_attestation)
+define_test_fn(rtas_physical_attestation_start)
 
 static int setup(void **state)
 {
@@ -115,39 +176,100 @@ int main(void) {
 #define T(str_) TT(test_fn_name(str_))
 	const struct CMUnitTest tests[] = {
 		T(rtas_activate_firmware),
+		T(rtas_call_batch),
+		T(rtas_cancel),
 		T(rtas_cfg_connector),
+		T(rtas_cfg_connector_parse),
+		T(rtas_cfg_connector_start),
+		T(rtas_cfg_connector_tree),
+		T(rtas_cfg_connector_tree_free),
+		T(rtas_cfg_connector_wa),
+		T(rtas_context_free),
+		T(rtas_context_info),
+		T(rtas_context_init),
 		T(rtas_delay_timeout),
 		T(rtas_display_char),
 		T(rtas_display_msg),
+		T(rtas_dump_codec_available),
+		T(rtas_dump_decompress),
 		T(rtas_errinjct),
 		T(rtas_errinjct_close),
 		T(rtas_errinjct_open),
+		T(rtas_errinjct_wa),
+		T(rtas_flush_index_cache),
+		T(rtas_flush_result_cache),
+		T(rtas_flush_token_cache),
 		T(rtas_free_rmo_buffer),
+		T(rtas_get_busy_backoff),
+		T(rtas_get_busy_stats),
 		T(rtas_get_config_addr_info2),
 		T(rtas_get_dynamic_sensor),
+		T(rtas_get_index_table),
 		T(rtas_get_indices),
+		T(rtas_get_indices_wa),
 		T(rtas_get_power_level),
+		T(rtas_get_rate_limit_stats),
 		T(rtas_get_rmo_buffer),
 		T(rtas_get_sensor),
+		T(rtas_get_stats),
 		T(rtas_get_sysparm),
 		T(rtas_get_time),
 		T(rtas_get_vpd),
 		T(rtas_lpar_perftools),
+		T(rtas_lpar_perftools_start),
+		T(rtas_monitor_add),
+		T(rtas_monitor_add_type),
+		T(rtas_monitor_changes),
+		T(rtas_monitor_create),
+		T(rtas_monitor_destroy),
+		T(rtas_monitor_fd),
+		T(rtas_monitor_read),
 		T(rtas_platform_dump),
+		T(rtas_platform_dump_compress),
+		T(rtas_platform_dump_start),
+		T(rtas_platform_dump_to_fd),
+		T(rtas_put_index_table),
 		T(rtas_read_slot_reset),
+		T(rtas_reprobe_interface),
+		T(rtas_reset_stats),
+		T(rtas_resume),
 		T(rtas_scan_log_dump),
+		T(rtas_scan_log_dump_compress),
+		T(rtas_scan_log_dump_wa),
+		T(rtas_sched_get_stats),
+		T(rtas_sched_set_class),
+		T(rtas_sched_start),
+		T(rtas_sched_stop),
+		T(rtas_sched_submit),
+		T(rtas_set_busy_backoff),
+		T(rtas_set_cache_ttl),
+		T(rtas_set_coalescing),
 		T(rtas_set_debug),
 		T(rtas_set_dynamic_indicator),
 		T(rtas_set_eeh_option),
+		T(rtas_set_idempotent),
 		T(rtas_set_indicator),
 		T(rtas_set_power_level),
 		T(rtas_set_poweron_time),
+		T(rtas_set_rate_limit),
 		T(rtas_set_sysparm),
 		T(rtas_set_time),
+		T(rtas_set_trace),
 		T(rtas_suspend_me),
+		T(rtas_trace_decode),
+		T(rtas_trace_dump),
+		T(rtas_trace_dump_on_crash),
 		T(rtas_update_nodes),
+		T(rtas_update_nodes_wa),
 		T(rtas_update_properties),
+		T(rtas_update_properties_wa),
+		T(rtas_use_shared_rmo_allocator),
+		T(rtas_workarea_alloc),
+		T(rtas_workarea_buf),
+		T(rtas_workarea_free),
+		T(rtas_workarea_size),
 		T(rtas_physical_attestation),
+		T(rtas_physical_attestation_start),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
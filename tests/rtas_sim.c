@@ -0,0 +1,1046 @@
+#include <endian.h>
+#include <librtas.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <cmocka.h>
+#include "rtas_sim.h"
+
+static char vpd[10000];
+static char dump[9000];
+
+static const struct rtas_sim_sysparm sysparms[] = {
+	{ .parameter = 42, .data = "hello", .length = 5 },
+};
+
+static struct rtas_sim_config config = {
+	.vpd = vpd,
+	.vpd_length = sizeof(vpd),
+	.sysparms = sysparms,
+	.nsysparms = 1,
+	.dump = dump,
+	.dump_length = sizeof(dump),
+};
+
+static int setup(void **state)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(vpd); i++)
+		vpd[i] = (char)i;
+	memset(dump, 0x5a, sizeof(dump));
+
+	return rtas_sim_enable(&config);
+}
+
+static int teardown(void **state)
+{
+	return rtas_sim_disable();
+}
+
+static void test_simple_call(void **state)
+{
+	int sensor_state = -1;
+
+	assert_int_equal(rtas_get_sensor(3, 0, &sensor_state), 0);
+	assert_int_equal(sensor_state, 0);
+}
+
+static void read_vpd(void)
+{
+	char buf[4096], all[sizeof(vpd)];
+	unsigned int seq = 1, next, bytes;
+	size_t total = 0;
+	int rc;
+
+	do {
+		rc = rtas_get_vpd("U78DA.ND1.1234567", buf, sizeof(buf), seq,
+				  &next, &bytes);
+		assert_in_range(rc, 0, 1);
+		assert_in_range(bytes, 0, sizeof(all) - total);
+		memcpy(all + total, buf, bytes);
+		total += bytes;
+		seq = next;
+	} while (rc == 1);
+
+	assert_int_equal(total, sizeof(vpd));
+	assert_memory_equal(all, vpd, sizeof(vpd));
+}
+
+static void test_vpd(void **state)
+{
+	read_vpd();
+}
+
+static void test_vpd_chardev(void **state)
+{
+	config.chardevs = 1;
+	assert_int_equal(rtas_sim_enable(&config), 0);
+	read_vpd();
+	config.chardevs = 0;
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void test_sysparm(void **state)
+{
+	char buf[64];
+
+	assert_int_equal(rtas_get_sysparm(42, sizeof(buf), buf), 0);
+	assert_int_equal(buf[0], 0);
+	assert_int_equal(buf[1], 5);
+	assert_memory_equal(buf + 2, "hello", 5);
+
+	assert_int_equal(rtas_get_sysparm(43, sizeof(buf), buf), -3);
+}
+
+static void test_platform_dump_with_delays(void **state)
+{
+	struct rtas_sim_config delaying = config;
+	uint64_t seq = 0, next, bytes, total = 0;
+	char buf[4096];
+	int rc;
+
+	delaying.busy_every = 2;
+	delaying.delay_every = 3;
+	delaying.delay_status = EXTENDED_DELAY_MIN;
+	assert_int_equal(rtas_sim_enable(&delaying), 0);
+
+	do {
+		rc = rtas_platform_dump(1, seq, buf, sizeof(buf), &next,
+					&bytes);
+		assert_in_range(rc, 0, 1);
+		assert_memory_equal(buf, dump, bytes);
+		total += bytes;
+		seq = next;
+	} while (rc == 1);
+
+	assert_int_equal(total, sizeof(dump));
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void test_platform_dump_cancel(void **state)
+{
+	struct rtas_sim_config delaying = config;
+	struct rtas_continuation *cont;
+	uint64_t next = 0x1234, bytes = 0x5678;
+	unsigned int delay_ms;
+	char buf[4096];
+
+	delaying.busy_every = 1;
+	assert_int_equal(rtas_sim_enable(&delaying), 0);
+
+	memset(buf, 0xa5, sizeof(buf));
+	assert_int_equal(rtas_platform_dump_start(&cont, 1, 0, buf,
+						  sizeof(buf), &next, &bytes,
+						  &delay_ms), RTAS_AGAIN);
+	rtas_cancel(cont);
+
+	/* Nothing is written back for a cancelled call */
+	assert_int_equal(next, 0x1234);
+	assert_int_equal(bytes, 0x5678);
+	assert_int_equal((unsigned char)buf[0], 0xa5);
+
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static int count_chunks(const struct rtas_dump_progress *progress, void *arg)
+{
+	(*(int *)arg)++;
+	return 0;
+}
+
+static void test_platform_dump_to_fd(void **state)
+{
+	struct rtas_dump_progress result;
+	char buf[sizeof(dump)];
+	int calls = 0;
+	FILE *out;
+
+	out = tmpfile();
+	assert_non_null(out);
+
+	assert_int_equal(rtas_platform_dump_to_fd(1, fileno(out), 4096,
+						  count_chunks, &calls,
+						  &result), 0);
+	assert_int_equal(result.bytes_written, sizeof(dump));
+	assert_int_equal(result.chunks, 3);
+	assert_int_equal(calls, 3);
+
+	rewind(out);
+	assert_int_equal(fread(buf, 1, sizeof(buf), out), sizeof(dump));
+	assert_memory_equal(buf, dump, sizeof(dump));
+	fclose(out);
+}
+
+static void check_container(FILE *in, size_t length)
+{
+	char buf[sizeof(dump)];
+	FILE *out;
+
+	out = tmpfile();
+	assert_non_null(out);
+
+	assert_int_equal(rtas_dump_decompress(fileno(in), fileno(out)), 0);
+
+	rewind(out);
+	assert_int_equal(fread(buf, 1, sizeof(buf), out), length);
+	assert_memory_equal(buf, dump, length);
+	fclose(out);
+}
+
+static void test_platform_dump_compress(void **state)
+{
+	static const int codecs[] = {
+		RTAS_DUMP_STORE, RTAS_DUMP_ZLIB, RTAS_DUMP_ZSTD,
+	};
+	struct rtas_dump_progress result;
+	size_t i;
+	FILE *in;
+
+	for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		in = tmpfile();
+		assert_non_null(in);
+
+		/* Codecs that are not built in are stored */
+		assert_int_equal(rtas_platform_dump_compress(1, fileno(in),
+							     codecs[i], 4096,
+							     NULL, NULL,
+							     &result), 0);
+		assert_int_equal(result.bytes_read, sizeof(dump));
+		assert_int_equal(result.chunks, 3);
+		if (rtas_dump_codec_available(codecs[i]) &&
+		    codecs[i] != RTAS_DUMP_STORE)
+			assert_true(result.bytes_written < sizeof(dump));
+
+		check_container(in, sizeof(dump));
+		fclose(in);
+	}
+}
+
+static void test_dump_decompress_corrupt(void **state)
+{
+	struct rtas_dump_progress result;
+	uint64_t trailer[2];
+	off_t end;
+	FILE *in, *out;
+
+	in = tmpfile();
+	out = tmpfile();
+	assert_non_null(in);
+	assert_non_null(out);
+	assert_int_equal(rtas_platform_dump_compress(1, fileno(in),
+						     RTAS_DUMP_STORE, 4096,
+						     NULL, NULL, &result), 0);
+
+	/* A chunk count whose index size wraps to one entry */
+	end = lseek(fileno(in), 0, SEEK_END);
+	assert_int_equal(pread(fileno(in), trailer, sizeof(trailer),
+			       end - 32), sizeof(trailer));
+	trailer[0] = htobe64(be64toh(trailer[0]) + 2 * 16);
+	trailer[1] = htobe64((1ull << 60) + 1);
+	assert_int_equal(pwrite(fileno(in), trailer, sizeof(trailer),
+				end - 32), sizeof(trailer));
+	assert_int_equal(rtas_dump_decompress(fileno(in), fileno(out)),
+			 RTAS_IO_ASSERT);
+
+	/* An index past the end of the container */
+	trailer[0] = htobe64(end);
+	trailer[1] = htobe64(0);
+	assert_int_equal(pwrite(fileno(in), trailer, sizeof(trailer),
+				end - 32), sizeof(trailer));
+	assert_int_equal(rtas_dump_decompress(fileno(in), fileno(out)),
+			 RTAS_IO_ASSERT);
+
+	fclose(in);
+	fclose(out);
+}
+
+static void test_scan_log_dump_compress(void **state)
+{
+	struct rtas_dump_progress result;
+	FILE *in;
+
+	in = tmpfile();
+	assert_non_null(in);
+
+	assert_int_equal(rtas_scan_log_dump_compress(fileno(in), 8192,
+						     RTAS_DUMP_ZLIB, &result),
+			 0);
+	assert_int_equal(result.bytes_read, 8192);
+
+	check_container(in, 8192);
+	fclose(in);
+}
+
+static void test_workarea(void **state)
+{
+	struct rtas_rmo_stats before, after;
+	struct rtas_workarea *wa;
+	size_t ncalls;
+	int i;
+
+	assert_int_equal(rtas_workarea_alloc(8192, &wa), 0);
+	assert_int_equal(rtas_workarea_size(wa), 8192);
+
+	assert_int_equal(rtas_scan_log_dump_wa(wa, 8192), 0);
+	assert_memory_equal(rtas_workarea_buf(wa), dump, 8192);
+	assert_int_equal(rtas_scan_log_dump_wa(wa, 8193), RTAS_IO_ASSERT);
+
+	/* Calls on a handle do not touch the allocator */
+	ncalls = 0;
+	assert_int_equal(rtas_get_stats(NULL, &ncalls, &before), 0);
+	for (i = 0; i < 100; i++)
+		assert_int_equal(rtas_cfg_connector_wa(wa), 0);
+	assert_int_equal(rtas_update_nodes_wa(wa, 1), 0);
+	ncalls = 0;
+	assert_int_equal(rtas_get_stats(NULL, &ncalls, &after), 0);
+	assert_int_equal(after.allocs, before.allocs);
+
+	assert_int_equal(rtas_workarea_free(wa), 0);
+}
+
+static const uint32_t reg = 0x12345678;
+
+/* A node with a child, then a sibling */
+static const struct rtas_sim_cc_entry connector[] = {
+	{ RTAS_CC_NEXT_CHILD, "pci@800000020000001" },
+	{ RTAS_CC_NEXT_PROPERTY, "name", "pci", 4 },
+	{ RTAS_CC_NEXT_PROPERTY, "reg", &reg, sizeof(reg) },
+	{ RTAS_CC_NEXT_CHILD, "ethernet@0" },
+	{ RTAS_CC_NEXT_PROPERTY, "name", "ethernet", 9 },
+	{ RTAS_CC_PREV_PARENT },
+	{ RTAS_CC_NEXT_SIBLING, "pci@800000020000002" },
+	{ RTAS_CC_PREV_PARENT },
+};
+
+static void test_cfg_connector_tree(void **state)
+{
+	struct rtas_sim_config cc = config;
+	struct rtas_rmo_stats rmo;
+	struct rtas_cc_node *tree;
+	size_t ncalls = 0;
+
+	cc.connector = connector;
+	cc.nconnector = sizeof(connector) / sizeof(connector[0]);
+	cc.connector_extents = 3;
+	cc.busy_every = 5;
+	assert_int_equal(rtas_sim_enable(&cc), 0);
+
+	assert_int_equal(rtas_cfg_connector_tree(NULL, 0x21010001, &tree), 0);
+
+	assert_string_equal(tree->name, "pci@800000020000001");
+	assert_string_equal(tree->properties->name, "name");
+	assert_string_equal(tree->properties->value, "pci");
+	assert_string_equal(tree->properties->next->name, "reg");
+	assert_memory_equal(tree->properties->next->value, &reg, sizeof(reg));
+	assert_null(tree->properties->next->next);
+	assert_string_equal(tree->child->name, "ethernet@0");
+	assert_ptr_equal(tree->child->parent, tree);
+	assert_null(tree->child->child);
+	assert_string_equal(tree->child->properties->value, "ethernet");
+	assert_string_equal(tree->sibling->name, "pci@800000020000002");
+	assert_null(tree->sibling->parent);
+	assert_null(tree->sibling->sibling);
+	rtas_cfg_connector_tree_free(tree);
+
+	/* Every extent is freed with the temporary work area */
+	assert_int_equal(rtas_get_stats(NULL, &ncalls, &rmo), 0);
+	assert_int_equal(rmo.allocs, rmo.frees);
+
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void test_index_table(void **state)
+{
+	static struct rtas_sim_index sensors[1000];
+	static char locs[1000][32];
+	const struct rtas_index_table *table, *again;
+	struct rtas_sim_config cfg = config;
+	struct rtas_sim_stats stats;
+	size_t i;
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(locs[i], sizeof(locs[i]), "U78DA.ND1.1234567-P1-C%zu",
+			 i);
+		sensors[i].is_sensor = 1;
+		sensors[i].type = 9001;
+		sensors[i].index = i * 2;
+		sensors[i].loc_code = locs[i];
+	}
+
+	cfg.indices = sensors;
+	cfg.nindices = 1000;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+
+	/* 1000 entries take several pages */
+	assert_int_equal(rtas_get_index_table(1, 9001, &table), 0);
+	assert_int_equal(table->count, 1000);
+	for (i = 0; i < 1000; i++) {
+		assert_int_equal(table->indices[i], i * 2);
+		assert_string_equal(table->loc_codes[i], locs[i]);
+	}
+
+	rtas_sim_get_stats(&stats, 1);
+	assert_int_equal(rtas_get_index_table(1, 9001, &again), 0);
+	assert_ptr_equal(again, table);
+	rtas_put_index_table(again);
+	rtas_sim_get_stats(&stats, 1);
+	assert_int_equal(stats.syscalls, 0);
+
+	/* A flush walks again, and the old table stays usable */
+	assert_int_equal(rtas_flush_index_cache(), 0);
+	assert_int_equal(rtas_get_index_table(1, 9001, &again), 0);
+	assert_true(again != table);
+	assert_int_equal(again->count, 1000);
+	assert_string_equal(table->loc_codes[999], locs[999]);
+	rtas_put_index_table(again);
+	rtas_put_index_table(table);
+
+	assert_int_equal(rtas_get_index_table(0, 9001, &table), -3);
+	assert_null(table);
+
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void count_change(const struct rtas_sensor_reading *reading,
+			 void *arg)
+{
+	__atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void wait_changes(struct rtas_monitor *mon,
+			 struct rtas_sensor_reading *readings, size_t *n,
+			 size_t want)
+{
+	struct pollfd pfd = { .fd = rtas_monitor_fd(mon), .events = POLLIN };
+	size_t got = 0, room;
+
+	while (got < want) {
+		assert_int_equal(poll(&pfd, 1, 5000), 1);
+		room = *n - got;
+		assert_int_equal(rtas_monitor_changes(mon, readings + got,
+						      &room), 0);
+		got += room;
+	}
+
+	*n = got;
+}
+
+static void test_monitor(void **state)
+{
+	struct rtas_sim_sensor sensors[4] = {
+		{ 3, 0, 10 }, { 3, 1, 11 }, { 3, 2, 12 }, { 3, 3, 13 },
+	};
+	struct rtas_sim_sensor changed[4];
+	struct rtas_sensor_spec specs[4];
+	struct rtas_sensor_reading readings[8];
+	struct rtas_sim_config cfg = config;
+	struct rtas_monitor_config mcfg = { 0 };
+	struct rtas_monitor *mon;
+	int notified = 0;
+	size_t i, n;
+
+	cfg.sensors = sensors;
+	cfg.nsensors = 4;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+
+	mcfg.workers = 2;
+	mcfg.notify = count_change;
+	mcfg.arg = &notified;
+	assert_int_equal(rtas_monitor_create(&mcfg, &mon), 0);
+
+	for (i = 0; i < 4; i++) {
+		memset(&specs[i], 0, sizeof(specs[i]));
+		specs[i].sensor = 3;
+		specs[i].index = i;
+		specs[i].interval_ms = 5;
+	}
+	assert_int_equal(rtas_monitor_add(mon, specs, 4), 0);
+
+	/* The first reads are reported */
+	n = 8;
+	wait_changes(mon, readings, &n, 4);
+	assert_int_equal(n, 4);
+	for (i = 0; i < n; i++)
+		assert_int_equal(readings[i].state, 10 + readings[i].index);
+
+	/* Then only the sensor that changed */
+	memcpy(changed, sensors, sizeof(changed));
+	changed[2].state = 42;
+	cfg.sensors = changed;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+	n = 8;
+	wait_changes(mon, readings, &n, 1);
+	assert_int_equal(n, 1);
+	assert_int_equal(readings[0].index, 2);
+	assert_int_equal(readings[0].state, 42);
+	assert_int_equal(readings[0].changes, 2);
+
+	n = 8;
+	assert_int_equal(rtas_monitor_read(mon, readings, &n), 0);
+	assert_int_equal(n, 4);
+	assert_true(readings[0].reads > 1);
+	assert_int_equal(readings[2].state, 42);
+
+	assert_int_equal(rtas_monitor_destroy(mon), 0);
+	assert_int_equal(notified, 5);
+
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+struct coalesce_arg {
+	pthread_barrier_t *barrier;
+	int failures;
+};
+
+static void *coalesce_thread(void *arg)
+{
+	struct coalesce_arg *ca = arg;
+	int i, state;
+
+	pthread_barrier_wait(ca->barrier);
+	for (i = 0; i < 20; i++) {
+		if (rtas_get_sensor(3, 1, &state) != 0 || state != 11)
+			ca->failures++;
+	}
+
+	return NULL;
+}
+
+static void test_coalescing(void **state)
+{
+	struct rtas_sim_sensor sensors[2] = { { 3, 0, 10 }, { 3, 1, 11 } };
+	struct rtas_sim_config cfg = config;
+	struct coalesce_arg args[8];
+	struct rtas_sim_stats stats;
+	pthread_barrier_t barrier;
+	pthread_t threads[8];
+	int i, value;
+
+	cfg.sensors = sensors;
+	cfg.nsensors = 2;
+	cfg.latency_us = 500;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+	assert_int_equal(rtas_set_coalescing(1), 0);
+	assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+
+	pthread_barrier_init(&barrier, NULL, 8);
+	for (i = 0; i < 8; i++) {
+		args[i].barrier = &barrier;
+		args[i].failures = 0;
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						coalesce_thread, &args[i]), 0);
+	}
+	for (i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_equal(args[i].failures, 0);
+	}
+	pthread_barrier_destroy(&barrier);
+
+	/* Threads waiting on an identical call shared its result */
+	assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+	assert_true(stats.syscalls < 8 * 20);
+
+	/* Different inputs are never shared */
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(value, 10);
+
+	assert_int_equal(rtas_set_idempotent("get-sensor-state", 0), 0);
+	assert_int_equal(rtas_get_sensor(3, 1, &value), 0);
+	assert_int_equal(value, 11);
+	assert_int_equal(rtas_set_idempotent("get-sensor-state", 1), 0);
+
+	assert_int_equal(rtas_set_coalescing(0), 0);
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void test_result_cache(void **state)
+{
+	struct rtas_sim_sensor sensors[1] = { { 3, 0, 10 } };
+	struct rtas_sim_config cfg = config;
+	struct rtas_sim_stats stats;
+	char data[16];
+	int value;
+
+	cfg.sensors = sensors;
+	cfg.nsensors = 1;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+	assert_int_equal(rtas_set_cache_ttl("ibm,get-vpd", 1000),
+			 RTAS_IO_ASSERT);
+	assert_int_equal(rtas_set_cache_ttl("get-sensor-state", 60000), 0);
+	assert_int_equal(rtas_set_cache_ttl("ibm,get-system-parameter",
+					    60000), 0);
+	assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(value, 10);
+	sensors[0].state = 20;
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(value, 10);
+
+	assert_int_equal(rtas_get_sysparm(42, sizeof(data), data), 0);
+	assert_int_equal(rtas_get_sysparm(42, sizeof(data), data), 0);
+	assert_memory_equal(data + 2, "hello", 5);
+
+	assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+	assert_int_equal(stats.syscalls + stats.ioctls, 2);
+
+	/* Invalidation brings in the new value */
+	assert_int_equal(rtas_flush_result_cache(), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(value, 20);
+
+	/* So does a backend change */
+	sensors[0].state = 30;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(value, 30);
+
+	assert_int_equal(rtas_set_cache_ttl("get-sensor-state", 0), 0);
+	assert_int_equal(rtas_set_cache_ttl("ibm,get-system-parameter", 0), 0);
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void test_context(void **state)
+{
+	struct rtas_context_info info;
+	struct rtas_context *ctx, *ctx2;
+	char data[16];
+	int value;
+
+	assert_int_equal(rtas_context_init(0, &ctx), 0);
+	assert_int_equal(rtas_context_init(RTAS_CONTEXT_NO_RMO, &ctx2), 0);
+
+	assert_int_equal(rtas_context_info(ctx, &info), 0);
+	assert_true(info.tokens > 0);
+	assert_true(info.rmo_pages > 0);
+
+	assert_int_equal(rtas_context_info(ctx2, &info), 0);
+	assert_true(info.tokens > 0);
+	assert_int_equal(info.rmo_pages, 0);
+
+	/* Contexts are independent of each other */
+	assert_int_equal(rtas_context_free(ctx), 0);
+	assert_int_equal(rtas_get_sysparm(42, sizeof(data), data), 0);
+	assert_int_equal(rtas_context_free(ctx2), 0);
+
+	/* A backend change drops the warmed state; calls rebuild it */
+	assert_int_equal(rtas_sim_enable(&config), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+}
+
+struct sched_job {
+	int *order;
+	int *next;
+	int id;
+	int *release;
+};
+
+static void sched_job(void *arg)
+{
+	struct sched_job *job = arg;
+	int value;
+
+	while (job->release && !__atomic_load_n(job->release, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	(void)rtas_get_sensor(3, 0, &value);
+	job->order[(*job->next)++] = job->id;
+}
+
+static void test_sched(void **state)
+{
+	struct rtas_sched_config scfg = { .workers = 1, .aging_ms = 60000 };
+	struct rtas_sched_stats stats;
+	struct sched_job jobs[5];
+	int order[5], next = 0, release = 0;
+	int i;
+
+	assert_int_equal(rtas_sched_submit(RTAS_SCHED_BULK, sched_job, NULL),
+			 RTAS_IO_ASSERT);
+	assert_int_equal(rtas_sched_start(&scfg), 0);
+	assert_int_equal(rtas_sched_start(&scfg), RTAS_IO_ASSERT);
+	assert_int_equal(rtas_sched_get_stats(&stats, 1), 0);
+
+	/* The first job holds the only worker while the rest queue up */
+	for (i = 0; i < 5; i++) {
+		jobs[i].order = order;
+		jobs[i].next = &next;
+		jobs[i].id = i;
+		jobs[i].release = i ? NULL : &release;
+	}
+	assert_int_equal(rtas_sched_submit(RTAS_SCHED_BULK, sched_job,
+					   &jobs[0]), 0);
+	while (!rtas_sched_get_stats(&stats, 0) &&
+	       stats.jobs[RTAS_SCHED_BULK].dispatched == 0)
+		sched_yield();
+	for (i = 1; i < 4; i++)
+		assert_int_equal(rtas_sched_submit(RTAS_SCHED_BULK, sched_job,
+						   &jobs[i]), 0);
+	assert_int_equal(rtas_sched_submit(RTAS_SCHED_CRITICAL, sched_job,
+					   &jobs[4]), 0);
+
+	assert_int_equal(rtas_sched_get_stats(&stats, 0), 0);
+	assert_int_equal(stats.jobs[RTAS_SCHED_BULK].depth, 3);
+	assert_int_equal(stats.jobs[RTAS_SCHED_CRITICAL].depth, 1);
+
+	__atomic_store_n(&release, 1, __ATOMIC_RELEASE);
+	assert_int_equal(rtas_sched_stop(), 0);
+
+	/* Stopping ran the queued jobs, the critical one first */
+	assert_int_equal(next, 5);
+	assert_int_equal(order[0], 0);
+	assert_int_equal(order[1], 4);
+	for (i = 2; i < 5; i++)
+		assert_int_equal(order[i], i - 1);
+
+	assert_int_equal(rtas_sched_get_stats(&stats, 1), 0);
+	assert_int_equal(stats.jobs[RTAS_SCHED_BULK].dispatched, 4);
+	assert_int_equal(stats.jobs[RTAS_SCHED_CRITICAL].dispatched, 1);
+	assert_int_equal(stats.calls[RTAS_SCHED_BULK].dispatched, 4);
+	assert_int_equal(stats.calls[RTAS_SCHED_CRITICAL].dispatched, 1);
+	assert_int_equal(rtas_sched_set_class(RTAS_SCHED_CLASSES),
+			 RTAS_IO_ASSERT);
+}
+
+static void *rate_limit_thread(void *arg)
+{
+	int *value = arg;
+
+	if (rtas_get_sensor(3, 0, value) != 0)
+		*value = -1;
+
+	return NULL;
+}
+
+static void test_rate_limit(void **state)
+{
+	struct rtas_rate_limit limit = { .rate = 10, .burst = 2,
+					 .mode = RTAS_RATE_FAIL };
+	struct rtas_sim_sensor sensors[1] = { { 3, 0, 10 } };
+	struct rtas_sim_config cfg = config;
+	struct rtas_rate_limit_stats rstats;
+	struct rtas_batch_call batch = { 0 };
+	struct rtas_sim_stats stats;
+	struct timespec start, end;
+	pthread_t threads[8];
+	int values[8];
+	int i, value;
+
+	cfg.sensors = sensors;
+	cfg.nsensors = 1;
+	cfg.latency_us = 1000;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+
+	/* Fail fast: the burst goes through, the next call does not */
+	assert_int_equal(rtas_set_rate_limit("get-sensor-state", &limit), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), RTAS_THROTTLED);
+	assert_int_equal(rtas_get_rate_limit_stats("get-sensor-state",
+						   &rstats, 1), 0);
+	assert_int_equal(rstats.calls, 2);
+	assert_int_equal(rstats.rejected, 1);
+
+	/* Batched calls are limited too, named or by token */
+	batch.name = "get-sensor-state";
+	batch.ninputs = 2;
+	batch.nrets = 2;
+	batch.inputs[0] = 3;
+	assert_int_equal(rtas_call_batch(&batch, 1), 0);
+	assert_int_equal(batch.rc, RTAS_THROTTLED);
+	batch.name = NULL;
+	assert_int_equal(rtas_call_batch(&batch, 1), 0);
+	assert_int_equal(batch.rc, RTAS_THROTTLED);
+	assert_int_equal(rtas_get_rate_limit_stats("get-sensor-state",
+						   &rstats, 1), 0);
+	assert_int_equal(rstats.rejected, 2);
+
+	/* Block: calls are spread out at the rate */
+	limit.rate = 100;
+	limit.burst = 1;
+	limit.mode = RTAS_RATE_BLOCK;
+	assert_int_equal(rtas_set_rate_limit("get-sensor-state", &limit), 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < 5; i++)
+		assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert_true((end.tv_sec - start.tv_sec) * 1000000000ll +
+		    end.tv_nsec - start.tv_nsec >= 35000000ll);
+	assert_int_equal(rtas_get_rate_limit_stats("get-sensor-state",
+						   &rstats, 1), 0);
+	assert_int_equal(rstats.calls, 5);
+	assert_true(rstats.delayed >= 3);
+
+	/* Coalesce: identical calls over the limit share one call */
+	limit.rate = 10;
+	limit.mode = RTAS_RATE_COALESCE;
+	assert_int_equal(rtas_set_rate_limit("get-sensor-state", &limit), 0);
+	assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+	for (i = 0; i < 8; i++)
+		assert_int_equal(pthread_create(&threads[i], NULL,
+						rate_limit_thread,
+						&values[i]), 0);
+	for (i = 0; i < 8; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_equal(values[i], 10);
+	}
+	assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+	assert_true(stats.syscalls < 8);
+
+	assert_int_equal(rtas_set_rate_limit("get-sensor-state", NULL), 0);
+	assert_int_equal(rtas_get_sensor(3, 0, &value), 0);
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+#define TRACE_RING 8
+
+struct trace_calls {
+	int base;
+	int n;
+};
+
+static void *trace_thread(void *arg)
+{
+	const struct trace_calls *calls = arg;
+	int i, value;
+
+	for (i = 0; i < calls->n; i++)
+		if (rtas_get_sensor(3, calls->base + i, &value) != 0)
+			break;
+
+	return NULL;
+}
+
+static int trace_stop;
+
+static void *trace_writer(void *arg)
+{
+	int i = 0, value;
+
+	while (!__atomic_load_n(&trace_stop, __ATOMIC_RELAXED))
+		(void)rtas_get_sensor(3, 100 + i++ % 20, &value);
+
+	return NULL;
+}
+
+static void test_trace(void **state)
+{
+	struct rtas_sim_sensor sensors[3 * 20];
+	struct trace_calls first = { 200, 6 }, second = { 300, 6 };
+	struct rtas_sim_config cfg = config;
+	struct rtas_sim_stats stats;
+	unsigned int attempts[20], tid, tok, in0, in1, out0, out1, tries;
+	unsigned int seen_main = 0, seen_first = 0, seen_second = 0;
+	int status, rc, idx, i, fd, value;
+	char *text, *line;
+	size_t len;
+	FILE *dump, *out;
+	pthread_t thread;
+
+	for (i = 0; i < 20; i++) {
+		sensors[i] = (struct rtas_sim_sensor){ 3, 100 + i, 1100 + i };
+		sensors[20 + i] = (struct rtas_sim_sensor){ 3, 200 + i, 1200 + i };
+		sensors[40 + i] = (struct rtas_sim_sensor){ 3, 300 + i, 1300 + i };
+	}
+	cfg.sensors = sensors;
+	cfg.nsensors = 60;
+	cfg.busy_every = 3;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+
+	assert_int_equal(rtas_set_trace(TRACE_RING - 1), 0);
+
+	/* More calls than the ring holds, some retried after RC_BUSY */
+	for (i = 0; i < 20; i++) {
+		assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+		assert_int_equal(rtas_get_sensor(3, 100 + i, &value), 0);
+		assert_int_equal(rtas_sim_get_stats(&stats, 1), 0);
+		attempts[i] = stats.syscalls;
+	}
+
+	/* The second thread takes over the ring the first one left */
+	assert_int_equal(pthread_create(&thread, NULL, trace_thread, &first), 0);
+	pthread_join(thread, NULL);
+	assert_int_equal(pthread_create(&thread, NULL, trace_thread, &second), 0);
+	pthread_join(thread, NULL);
+
+	assert_int_equal(rtas_set_trace(0), 0);
+
+	dump = tmpfile();
+	assert_non_null(dump);
+	fd = fileno(dump);
+	assert_int_equal(rtas_trace_dump(fd), 0);
+	assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+
+	out = open_memstream(&text, &len);
+	assert_non_null(out);
+	assert_int_equal(rtas_trace_decode(fd, out), 0);
+	fclose(out);
+	fclose(dump);
+
+	for (line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+		assert_int_equal(sscanf(line, "%u %*u.%*u token %u in: %x %x "
+					"out: %x %x status %d rc %d attempts %u",
+					&tid, &tok, &in0, &in1, &out0, &out1,
+					&status, &rc, &tries), 9);
+		assert_int_equal(tok, 3);
+		assert_int_equal(in0, 3);
+		assert_int_equal(out0, 0);
+		assert_int_equal(status, 0);
+		assert_int_equal(rc, 0);
+		assert_int_equal(out1, in1 + 1000);
+
+		idx = in1 % 100;
+		if (in1 / 100 == 1) {
+			/* Only the newest calls of the main thread are left */
+			assert_in_range(idx, 20 - TRACE_RING, 19);
+			assert_int_equal(tries, attempts[idx]);
+			seen_main++;
+		} else if (in1 / 100 == 2) {
+			assert_in_range(idx, first.n + second.n - TRACE_RING,
+					first.n - 1);
+			assert_in_range(tries, 1, 2);
+			seen_first++;
+		} else {
+			assert_int_equal(in1 / 100, 3);
+			assert_in_range(tries, 1, 2);
+			seen_second++;
+		}
+	}
+	free(text);
+
+	assert_int_equal(seen_main, TRACE_RING);
+	assert_int_equal(seen_first, TRACE_RING - second.n);
+	assert_int_equal(seen_second, second.n);
+
+	/* Records overwritten while a dump reads them are left out */
+	cfg.busy_every = 0;
+	assert_int_equal(rtas_sim_enable(&cfg), 0);
+	assert_int_equal(rtas_set_trace(TRACE_RING), 0);
+	assert_int_equal(pthread_create(&thread, NULL, trace_writer, NULL), 0);
+	for (i = 0; i < 100; i++) {
+		dump = tmpfile();
+		assert_non_null(dump);
+		fd = fileno(dump);
+		assert_int_equal(rtas_trace_dump(fd), 0);
+		assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+		out = open_memstream(&text, &len);
+		assert_non_null(out);
+		assert_int_equal(rtas_trace_decode(fd, out), 0);
+		fclose(out);
+		fclose(dump);
+
+		for (line = strtok(text, "\n"); line;
+		     line = strtok(NULL, "\n")) {
+			assert_int_equal(sscanf(line, "%u %*u.%*u token %u "
+						"in: %x %x out: %x %x",
+						&tid, &tok, &in0, &in1, &out0,
+						&out1), 6);
+			assert_int_equal(out1, in1 + 1000);
+		}
+		free(text);
+	}
+	__atomic_store_n(&trace_stop, 1, __ATOMIC_RELAXED);
+	pthread_join(thread, NULL);
+	assert_int_equal(rtas_set_trace(0), 0);
+
+	assert_int_equal(rtas_sim_enable(&config), 0);
+}
+
+static void test_rmo_in_use(void **state)
+{
+	uint32_t phys_addr;
+	void *buf;
+
+	/* The backend cannot change under an allocated work area */
+	assert_int_equal(rtas_get_rmo_buffer(4096, &buf, &phys_addr), 0);
+	assert_int_equal(rtas_sim_disable(), RTAS_IO_ASSERT);
+	assert_int_equal(rtas_free_rmo_buffer(buf, phys_addr, 4096), 0);
+}
+
+static void *rmo_alloc_thread(void *arg)
+{
+	uint32_t *phys_addr = arg;
+	void *buf;
+
+	if (rtas_get_rmo_buffer(4096, &buf, phys_addr) ||
+	    rtas_free_rmo_buffer(buf, *phys_addr, 4096))
+		*phys_addr = 0;
+	return NULL;
+}
+
+static void test_rmo_parking(void **state)
+{
+	const struct timespec park = { 0, 50 * 1000000 };
+	uint32_t phys_addr, other;
+	pthread_t thread;
+	void *buf;
+	pid_t pid;
+	int status;
+
+	/* A parked page goes back to the region after a short while */
+	assert_int_equal(rtas_get_rmo_buffer(4096, &buf, &phys_addr), 0);
+	assert_int_equal(rtas_free_rmo_buffer(buf, phys_addr, 4096), 0);
+	nanosleep(&park, NULL);
+	assert_int_equal(pthread_create(&thread, NULL, rmo_alloc_thread,
+					&other), 0);
+	pthread_join(thread, NULL);
+	assert_int_equal(other, phys_addr);
+
+	/* A child never gets the page its parent parked */
+	assert_int_equal(rtas_get_rmo_buffer(4096, &buf, &phys_addr), 0);
+	assert_int_equal(rtas_free_rmo_buffer(buf, phys_addr, 4096), 0);
+	pid = fork();
+	assert_true(pid >= 0);
+	if (!pid) {
+		if (rtas_get_rmo_buffer(4096, &buf, &other) ||
+		    other == phys_addr ||
+		    rtas_free_rmo_buffer(buf, other, 4096))
+			_exit(1);
+		_exit(0);
+	}
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+}
+
+int main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_simple_call),
+		cmocka_unit_test(test_vpd),
+		cmocka_unit_test(test_vpd_chardev),
+		cmocka_unit_test(test_sysparm),
+		cmocka_unit_test(test_platform_dump_with_delays),
+		cmocka_unit_test(test_platform_dump_cancel),
+		cmocka_unit_test(test_platform_dump_to_fd),
+		cmocka_unit_test(test_platform_dump_compress),
+		cmocka_unit_test(test_dump_decompress_corrupt),
+		cmocka_unit_test(test_scan_log_dump_compress),
+		cmocka_unit_test(test_workarea),
+		cmocka_unit_test(test_cfg_connector_tree),
+		cmocka_unit_test(test_index_table),
+		cmocka_unit_test(test_monitor),
+		cmocka_unit_test(test_coalescing),
+		cmocka_unit_test(test_result_cache),
+		cmocka_unit_test(test_context),
+		cmocka_unit_test(test_sched),
+		cmocka_unit_test(test_rate_limit),
+		cmocka_unit_test(test_trace),
+		cmocka_unit_test(test_rmo_in_use),
+		cmocka_unit_test(test_rmo_parking),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}